@@ -15,6 +15,12 @@ LOCAL_SRC_FILES:= \
 	SecCamera.cpp \
 	SecCameraHWInterface.cpp \
 	SecCameraUtils.cpp \
+	SecCameraImage.cpp \
+	SecCameraBackend.cpp \
+	SecCameraTrace.cpp \
+	SecCameraJpeg.cpp \
+	SecCameraExif.cpp \
+	SecCameraHeapPool.cpp \
 
 LOCAL_SHARED_LIBRARIES:= libutils libcutils libbinder liblog libcamera_client libhardware
 LOCAL_SHARED_LIBRARIES+= libs3cjpeg
@@ -25,4 +31,6 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(call all-makefiles-under,$(LOCAL_PATH))
+
 endif
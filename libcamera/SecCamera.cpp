@@ -33,7 +33,10 @@
 #include <stdlib.h>
 #include <sys/poll.h>
 #include "SecCamera.h"
+#include "SecCameraBackend.h"
+#include "SecCameraImage.h"
 #include "cutils/properties.h"
+#include "cutils/atomic.h"
 
 using namespace android;
 
@@ -97,6 +100,7 @@ static int get_pixel_depth(unsigned int fmt)
         depth = 12;
         break;
     case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YVU420:
         depth = 12;
         break;
 
@@ -123,14 +127,14 @@ static int get_pixel_depth(unsigned int fmt)
 #define ALIGN_H(x)      (((x) + 0x1F) & (~0x1F))    // Set as multiple of 32
 #define ALIGN_BUF(x)    (((x) + 0x1FFF)& (~0x1FFF)) // Set as multiple of 8K
 
-static int fimc_poll(struct pollfd *events)
+static int fimc_poll(SecCameraBackend *backend, struct pollfd *events)
 {
     int ret;
 
     /* 10 second delay is because sensor can take a long time
      * to do auto focus and capture in dark settings
      */
-    ret = poll(events, 1, 10000);
+    ret = backend->poll(events, 1, 10000);
     if (ret < 0) {
         ALOGE("ERR(%s):poll error\n", __func__);
         return ret;
@@ -162,9 +166,9 @@ int SecCamera::previewPoll(bool preview)
         }
 #endif
 
-        ret = poll(&m_events_c, 1, 1000);
+        ret = m_backend->poll(&m_events_c, 1, 1000);
     } else {
-        ret = poll(&m_events_c2, 1, 1000);
+        ret = m_backend->poll(&m_events_c2, 1, 1000);
     }
 
     if (ret < 0) {
@@ -180,12 +184,12 @@ int SecCamera::previewPoll(bool preview)
     return ret;
 }
 
-static int fimc_v4l2_querycap(int fp)
+static int fimc_v4l2_querycap(SecCameraBackend *backend, int fp)
 {
     struct v4l2_capability cap;
     int ret = 0;
 
-    ret = ioctl(fp, VIDIOC_QUERYCAP, &cap);
+    ret = backend->ioctl(fp, VIDIOC_QUERYCAP, &cap);
 
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_QUERYCAP failed\n", __func__);
@@ -200,29 +204,28 @@ static int fimc_v4l2_querycap(int fp)
     return ret;
 }
 
-static const __u8* fimc_v4l2_enuminput(int fp, int index)
+/* input is the caller's, both capture nodes may be set up at once */
+static const __u8* fimc_v4l2_enuminput(SecCameraBackend *backend, int fp, int index, struct v4l2_input *input)
 {
-    static struct v4l2_input input;
-
-    input.index = index;
-    if (ioctl(fp, VIDIOC_ENUMINPUT, &input) != 0) {
+    input->index = index;
+    if (backend->ioctl(fp, VIDIOC_ENUMINPUT, input) != 0) {
         ALOGE("ERR(%s):No matching index found\n", __func__);
         return NULL;
     }
-    ALOGI("Name of input channel[%d] is %s\n", input.index, input.name);
+    ALOGI("Name of input channel[%d] is %s\n", input->index, input->name);
 
-    return input.name;
+    return input->name;
 }
 
 
-static int fimc_v4l2_s_input(int fp, int index)
+static int fimc_v4l2_s_input(SecCameraBackend *backend, int fp, int index)
 {
     struct v4l2_input input;
     int ret;
 
     input.index = index;
 
-    ret = ioctl(fp, VIDIOC_S_INPUT, &input);
+    ret = backend->ioctl(fp, VIDIOC_S_INPUT, &input);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_S_INPUT failed\n", __func__);
         return ret;
@@ -231,7 +234,7 @@ static int fimc_v4l2_s_input(int fp, int index)
     return ret;
 }
 
-static int fimc_v4l2_s_fmt(int fp, int width, int height, unsigned int fmt, int flag_capture)
+static int fimc_v4l2_s_fmt(SecCameraBackend *backend, int fp, int width, int height, unsigned int fmt, int flag_capture)
 {
     struct v4l2_format v4l2_fmt;
     struct v4l2_pix_format pixfmt;
@@ -252,7 +255,7 @@ static int fimc_v4l2_s_fmt(int fp, int width, int height, unsigned int fmt, int
     v4l2_fmt.fmt.pix = pixfmt;
 
     /* Set up for capture */
-    ret = ioctl(fp, VIDIOC_S_FMT, &v4l2_fmt);
+    ret = backend->ioctl(fp, VIDIOC_S_FMT, &v4l2_fmt);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_S_FMT failed\n", __func__);
         return -1;
@@ -261,7 +264,7 @@ static int fimc_v4l2_s_fmt(int fp, int width, int height, unsigned int fmt, int
     return 0;
 }
 
-static int fimc_v4l2_s_fmt_cap(int fp, int width, int height, unsigned int fmt)
+static int fimc_v4l2_s_fmt_cap(SecCameraBackend *backend, int fp, int width, int height, unsigned int fmt)
 {
     struct v4l2_format v4l2_fmt;
     struct v4l2_pix_format pixfmt;
@@ -285,7 +288,7 @@ static int fimc_v4l2_s_fmt_cap(int fp, int width, int height, unsigned int fmt)
     //ALOGE("ori_w %d, ori_h %d, w %d, h %d\n", width, height, v4l2_fmt.fmt.pix.width, v4l2_fmt.fmt.pix.height);
 
     /* Set up for capture */
-    ret = ioctl(fp, VIDIOC_S_FMT, &v4l2_fmt);
+    ret = backend->ioctl(fp, VIDIOC_S_FMT, &v4l2_fmt);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_S_FMT failed\n", __func__);
         return ret;
@@ -294,7 +297,7 @@ static int fimc_v4l2_s_fmt_cap(int fp, int width, int height, unsigned int fmt)
     return ret;
 }
 
-static int fimc_v4l2_enum_fmt(int fp, unsigned int fmt)
+static int fimc_v4l2_enum_fmt(SecCameraBackend *backend, int fp, unsigned int fmt)
 {
     struct v4l2_fmtdesc fmtdesc;
     int found = 0;
@@ -302,7 +305,7 @@ static int fimc_v4l2_enum_fmt(int fp, unsigned int fmt)
     fmtdesc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     fmtdesc.index = 0;
 
-    while (ioctl(fp, VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
+    while (backend->ioctl(fp, VIDIOC_ENUM_FMT, &fmtdesc) == 0) {
         if (fmtdesc.pixelformat == fmt) {
             ALOGV("passed fmt = %#x found pixel format[%d]: %s\n", fmt, fmtdesc.index, fmtdesc.description);
             found = 1;
@@ -320,16 +323,17 @@ static int fimc_v4l2_enum_fmt(int fp, unsigned int fmt)
     return 0;
 }
 
-static int fimc_v4l2_reqbufs(int fp, enum v4l2_buf_type type, int nr_bufs)
+static int fimc_v4l2_reqbufs(SecCameraBackend *backend, int fp, enum v4l2_buf_type type, int nr_bufs,
+                             enum v4l2_memory memory = V4L2_MEMORY_MMAP)
 {
     struct v4l2_requestbuffers req;
     int ret;
 
     req.count = nr_bufs;
     req.type = type;
-    req.memory = V4L2_MEMORY_MMAP;
+    req.memory = memory;
 
-    ret = ioctl(fp, VIDIOC_REQBUFS, &req);
+    ret = backend->ioctl(fp, VIDIOC_REQBUFS, &req);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_REQBUFS failed\n", __func__);
         return -1;
@@ -338,7 +342,8 @@ static int fimc_v4l2_reqbufs(int fp, enum v4l2_buf_type type, int nr_bufs)
     return req.count;
 }
 
-static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_type type)
+static int fimc_v4l2_querybuf(SecCameraBackend *backend, int fp, struct fimc_buffer *buffer, enum v4l2_buf_type type,
+                              int index = 0)
 {
     struct v4l2_buffer v4l2_buf;
     int ret;
@@ -347,16 +352,16 @@ static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_
 
     v4l2_buf.type = type;
     v4l2_buf.memory = V4L2_MEMORY_MMAP;
-    v4l2_buf.index = 0;
+    v4l2_buf.index = index;
 
-    ret = ioctl(fp , VIDIOC_QUERYBUF, &v4l2_buf);
+    ret = backend->ioctl(fp, VIDIOC_QUERYBUF, &v4l2_buf);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_QUERYBUF failed\n", __func__);
         return -1;
     }
 
     buffer->length = v4l2_buf.length;
-    if ((buffer->start = (char *)mmap(0, v4l2_buf.length,
+    if ((buffer->start = (char *)backend->mmap(0, v4l2_buf.length,
                                          PROT_READ | PROT_WRITE, MAP_SHARED,
                                          fp, v4l2_buf.m.offset)) < 0) {
          ALOGE("%s %d] mmap() failed\n",__func__, __LINE__);
@@ -369,12 +374,12 @@ static int fimc_v4l2_querybuf(int fp, struct fimc_buffer *buffer, enum v4l2_buf_
     return 0;
 }
 
-static int fimc_v4l2_streamon(int fp)
+static int fimc_v4l2_streamon(SecCameraBackend *backend, int fp)
 {
     enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     int ret;
 
-    ret = ioctl(fp, VIDIOC_STREAMON, &type);
+    ret = backend->ioctl(fp, VIDIOC_STREAMON, &type);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_STREAMON failed\n", __func__);
         return ret;
@@ -383,13 +388,13 @@ static int fimc_v4l2_streamon(int fp)
     return ret;
 }
 
-static int fimc_v4l2_streamoff(int fp)
+static int fimc_v4l2_streamoff(SecCameraBackend *backend, int fp)
 {
     enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     int ret;
 
     ALOGV("%s :", __func__);
-    ret = ioctl(fp, VIDIOC_STREAMOFF, &type);
+    ret = backend->ioctl(fp, VIDIOC_STREAMOFF, &type);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_STREAMOFF failed\n", __func__);
         return ret;
@@ -398,7 +403,7 @@ static int fimc_v4l2_streamoff(int fp)
     return ret;
 }
 
-static int fimc_v4l2_qbuf(int fp, int index)
+static int fimc_v4l2_qbuf(SecCameraBackend *backend, int fp, int index)
 {
     struct v4l2_buffer v4l2_buf;
     int ret;
@@ -407,7 +412,7 @@ static int fimc_v4l2_qbuf(int fp, int index)
     v4l2_buf.memory = V4L2_MEMORY_MMAP;
     v4l2_buf.index = index;
 
-    ret = ioctl(fp, VIDIOC_QBUF, &v4l2_buf);
+    ret = backend->ioctl(fp, VIDIOC_QBUF, &v4l2_buf);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_QBUF failed\n", __func__);
         return ret;
@@ -416,31 +421,88 @@ static int fimc_v4l2_qbuf(int fp, int index)
     return 0;
 }
 
-static int fimc_v4l2_dqbuf(int fp)
+static int fimc_v4l2_qbuf_userptr(SecCameraBackend *backend, int fp, int index, struct fimc_buffer *buffer)
 {
     struct v4l2_buffer v4l2_buf;
     int ret;
 
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
     v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    v4l2_buf.memory = V4L2_MEMORY_MMAP;
+    v4l2_buf.memory = V4L2_MEMORY_USERPTR;
+    v4l2_buf.index = index;
+    v4l2_buf.m.userptr = (unsigned long)buffer->start;
+    v4l2_buf.length = buffer->length;
+
+    ret = backend->ioctl(fp, VIDIOC_QBUF, &v4l2_buf);
+    if (ret < 0) {
+        ALOGE("ERR(%s):VIDIOC_QBUF(userptr %p) failed\n", __func__, buffer->start);
+        return ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Capture time of a dequeued buffer on the SYSTEM_TIME_MONOTONIC clock.
+ * FIMC stamps buffers with do_gettimeofday(), so the stamp is moved over
+ * by the current offset between the two clocks. A buffer without a stamp,
+ * or one that a wall clock step pushed outside the last second, gets the
+ * dequeue time instead.
+ */
+static nsecs_t fimc_v4l2_timestamp(const struct v4l2_buffer *buf)
+{
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    nsecs_t stamp = s2ns(buf->timestamp.tv_sec) + us2ns(buf->timestamp.tv_usec);
+
+#ifdef V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+    if (!(buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC))
+#endif
+        stamp += now - systemTime(SYSTEM_TIME_REALTIME);
+
+    if (stamp > now || stamp < now - s2ns(1))
+        return now;
+
+    return stamp;
+}
+
+static int fimc_v4l2_dqbuf(SecCameraBackend *backend, int fp, enum v4l2_memory memory = V4L2_MEMORY_MMAP,
+                           nsecs_t *timestamp = NULL)
+{
+    struct v4l2_buffer v4l2_buf;
+    int ret;
 
-    ret = ioctl(fp, VIDIOC_DQBUF, &v4l2_buf);
+    memset(&v4l2_buf, 0, sizeof(v4l2_buf));
+    v4l2_buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    v4l2_buf.memory = memory;
+
+    ret = backend->ioctl(fp, VIDIOC_DQBUF, &v4l2_buf);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_DQBUF failed, dropped frame\n", __func__);
         return ret;
     }
 
+    if (timestamp)
+        *timestamp = fimc_v4l2_timestamp(&v4l2_buf);
+
     return v4l2_buf.index;
 }
 
-static int fimc_v4l2_g_ctrl(int fp, unsigned int id)
+/* keep the stamps of one stream strictly increasing for the encoder */
+static void fimc_v4l2_order_timestamp(nsecs_t *timestamp, nsecs_t *last)
+{
+    if (*timestamp <= *last)
+        *timestamp = *last + 1;
+    *last = *timestamp;
+}
+
+static int fimc_v4l2_g_ctrl(SecCameraBackend *backend, int fp, unsigned int id)
 {
     struct v4l2_control ctrl;
     int ret;
 
     ctrl.id = id;
 
-    ret = ioctl(fp, VIDIOC_G_CTRL, &ctrl);
+    ret = backend->ioctl(fp, VIDIOC_G_CTRL, &ctrl);
     if (ret < 0) {
         ALOGE("ERR(%s): VIDIOC_G_CTRL(id = 0x%x (%d)) failed, ret = %d\n",
              __func__, id, id-V4L2_CID_PRIVATE_BASE, ret);
@@ -450,7 +512,7 @@ static int fimc_v4l2_g_ctrl(int fp, unsigned int id)
     return ctrl.value;
 }
 
-static int fimc_v4l2_s_ctrl(int fp, unsigned int id, unsigned int value)
+static int fimc_v4l2_s_ctrl(SecCameraBackend *backend, int fp, unsigned int id, unsigned int value)
 {
     struct v4l2_control ctrl;
     int ret;
@@ -458,7 +520,7 @@ static int fimc_v4l2_s_ctrl(int fp, unsigned int id, unsigned int value)
     ctrl.id = id;
     ctrl.value = value;
 
-    ret = ioctl(fp, VIDIOC_S_CTRL, &ctrl);
+    ret = backend->ioctl(fp, VIDIOC_S_CTRL, &ctrl);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_S_CTRL(id = %#x (%d), value = %d) failed ret = %d\n",
              __func__, id, id-V4L2_CID_PRIVATE_BASE, value, ret);
@@ -469,13 +531,13 @@ static int fimc_v4l2_s_ctrl(int fp, unsigned int id, unsigned int value)
     return ctrl.value;
 }
 
-static int fimc_v4l2_g_parm(int fp, struct v4l2_streamparm *streamparm)
+static int fimc_v4l2_g_parm(SecCameraBackend *backend, int fp, struct v4l2_streamparm *streamparm)
 {
     int ret;
 
     streamparm->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    ret = ioctl(fp, VIDIOC_G_PARM, streamparm);
+    ret = backend->ioctl(fp, VIDIOC_G_PARM, streamparm);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_G_PARM failed\n", __func__);
         return -1;
@@ -488,13 +550,13 @@ static int fimc_v4l2_g_parm(int fp, struct v4l2_streamparm *streamparm)
     return 0;
 }
 
-static int fimc_v4l2_s_parm(int fp, struct v4l2_streamparm *streamparm)
+static int fimc_v4l2_s_parm(SecCameraBackend *backend, int fp, struct v4l2_streamparm *streamparm)
 {
     int ret;
 
     streamparm->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    ret = ioctl(fp, VIDIOC_S_PARM, streamparm);
+    ret = backend->ioctl(fp, VIDIOC_S_PARM, streamparm);
     if (ret < 0) {
         ALOGE("ERR(%s):VIDIOC_S_PARM failed\n", __func__);
         return ret;
@@ -509,8 +571,10 @@ static int fimc_v4l2_s_parm(int fp, struct v4l2_streamparm *streamparm)
 SecCamera::SecCamera() :
             m_flag_init(0),
             m_camera_id(CAMERA_ID_BACK),
+            m_backend(SecCameraBackend::getInstance()),
             m_cam_fd(-1),
             m_cam_fd2(-1),
+            m_preview_memory(V4L2_MEMORY_MMAP),
             m_preview_v4lformat(V4L2_PIX_FMT_NV21),
             m_preview_width      (0),
             m_preview_height     (0),
@@ -570,7 +634,36 @@ SecCamera::SecCamera() :
     m_params->sharpness = -1;
     m_params->white_balance = -1;
 
-    memset(&m_capture_buf, 0, sizeof(m_capture_buf));
+    memset(m_capture_buf, 0, sizeof(m_capture_buf));
+    m_capture_count = 0;
+    memset(m_preview_user_buf, 0, sizeof(m_preview_user_buf));
+    for (int i = 0; i < MAX_BUFFERS; i++)
+        m_preview_owner[i] = PREVIEW_OWNER_DRIVER;
+    m_af_cancel = false;
+    m_af_start = 0;
+    m_preview_timestamp = 0;
+    m_record_timestamp = 0;
+    m_preview_configured = false;
+    m_preview_cfg_format = 0;
+    m_preview_cfg_width = 0;
+    m_preview_cfg_height = 0;
+    m_preview_cfg_memory = 0;
+    m_preview_warm = false;
+    m_preview_started = 0;
+    memset((void *)m_preview_starts, 0, sizeof(m_preview_starts));
+    m_open_time = 0;
+    m_sensor_name[0] = '\0';
+    m_record_dev_opening = false;
+    m_jpeg_enc = NULL;
+    m_scale_scratch = NULL;
+    m_scale_scratch_size = 0;
+    m_exif_template = true;
+    m_ctrl_ioctls = 0;
+    m_shot_valid = false;
+    m_shot_missing = 0;
+    memset(m_shot_ctrls, 0, sizeof(m_shot_ctrls));
+    m_shot_date_time[0] = '\0';
+    memset((void *)m_af_stats, 0, sizeof(m_af_stats));
 
     ALOGV("%s :", __func__);
 }
@@ -591,8 +684,20 @@ int SecCamera::initCamera(int index)
          * reset between shot to shot
          */
         m_camera_af_flag = -1;
+        m_preview_configured = false;
+
+        /* what the last shot of the other sensor reported does not apply */
+        m_shot_lock.lock();
+        m_shot_valid = false;
+        m_shot_missing = 0;
+        m_shot_ctrls[SHOT_CTRL_SHUTTER] = 100;
+        m_shot_ctrls[SHOT_CTRL_ISO] = ISO_100;
+        m_shot_ctrls[SHOT_CTRL_FLASH] = -1;
+        m_shot_lock.unlock();
 
-        m_cam_fd = open(CAMERA_DEV_NAME, O_RDWR);
+        m_open_time = systemTime(SYSTEM_TIME_MONOTONIC);
+
+        m_cam_fd = m_backend->open(CAMERA_DEV_NAME, O_RDWR);
         if (m_cam_fd < 0) {
             ALOGE("ERR(%s):Cannot open %s (error : %s)\n", __func__, CAMERA_DEV_NAME, strerror(errno));
             return -1;
@@ -601,28 +706,49 @@ int SecCamera::initCamera(int index)
 
         ALOGE("initCamera: m_cam_fd(%d), m_jpeg_fd(%d)", m_cam_fd, m_jpeg_fd);
 
-        ret = fimc_v4l2_querycap(m_cam_fd);
-        CHECK(ret);
-        if (!fimc_v4l2_enuminput(m_cam_fd, index))
-            return -1;
-        ret = fimc_v4l2_s_input(m_cam_fd, index);
-        CHECK(ret);
+        /* the record node is only needed by startRecord(); unless told to
+         * open it lazily, bring it up on the side while m_cam_fd is set up
+         */
+        char property[PROPERTY_VALUE_MAX];
+        property_get("camera.record.open", property, "prewarm");
+        if (strcmp(property, "lazy")) {
+            m_record_dev_opening = true;
+            m_record_open_thread = new RecordOpenThread(this);
+            if (m_record_open_thread->run("CameraRecordOpen") != NO_ERROR) {
+                ALOGW("%s: no prewarm thread, opening %s on first use", __func__, CAMERA_DEV_NAME2);
+                m_record_open_thread.clear();
+                m_record_dev_opening = false;
+            }
+        }
 
-        m_cam_fd2 = open(CAMERA_DEV_NAME2, O_RDWR);
-        ALOGV("%s: open(%s) --> m_cam_fd2 = %d", __FUNCTION__, CAMERA_DEV_NAME2, m_cam_fd2);
-        if (m_cam_fd2 < 0) {
-            ALOGE("ERR(%s):Cannot open %s (error : %s)\n", __func__, CAMERA_DEV_NAME2, strerror(errno));
+        struct v4l2_input input;
+        const __u8 *name = NULL;
+        ret = fimc_v4l2_querycap(m_backend, m_cam_fd);
+        if (ret == 0)
+            name = fimc_v4l2_enuminput(m_backend, m_cam_fd, index, &input);
+        if (name)
+            ret = fimc_v4l2_s_input(m_backend, m_cam_fd, index);
+        if (ret < 0 || !name) {
+            ALOGE("ERR(%s):Cannot select input %d on %s\n", __func__, index, CAMERA_DEV_NAME);
+            closeRecordDevice();
+            m_backend->close(m_cam_fd);
+            m_cam_fd = -1;
             return -1;
         }
+        memcpy(m_sensor_name, name, sizeof(m_sensor_name));
+        m_sensor_name[sizeof(m_sensor_name) - 1] = '\0';
 
-        ALOGE("initCamera: m_cam_fd2(%d)", m_cam_fd2);
-
-        ret = fimc_v4l2_querycap(m_cam_fd2);
-        CHECK(ret);
-        if (!fimc_v4l2_enuminput(m_cam_fd2, index))
-            return -1;
-        ret = fimc_v4l2_s_input(m_cam_fd2, index);
-        CHECK(ret);
+        /* the sensor is powered up, select it on the prewarmed record node
+         * too; done here rather than on the prewarm thread so that it is
+         * over before startPreview() can run. A node that fails is reopened
+         * by startRecord().
+         */
+        m_record_dev_lock.lock();
+        while (m_record_dev_opening)
+            m_record_dev_condition.wait(m_record_dev_lock);
+        if (m_cam_fd2 > -1)
+            m_cam_fd2 = selectRecordInput(m_cam_fd2, index);
+        m_record_dev_lock.unlock();
 
         m_camera_id = index;
 
@@ -670,15 +796,20 @@ void SecCamera::DeinitCamera()
          */
         ALOGI("DeinitCamera: m_cam_fd(%d)", m_cam_fd);
         if (m_cam_fd > -1) {
-            close(m_cam_fd);
+            m_backend->close(m_cam_fd);
             m_cam_fd = -1;
         }
 
         ALOGI("DeinitCamera: m_cam_fd2(%d)", m_cam_fd2);
-        if (m_cam_fd2 > -1) {
-            close(m_cam_fd2);
-            m_cam_fd2 = -1;
-        }
+        closeRecordDevice();
+
+        m_jpeg_lock.lock();
+        delete m_jpeg_enc;
+        m_jpeg_enc = NULL;
+        free(m_scale_scratch);
+        m_scale_scratch = NULL;
+        m_scale_scratch_size = 0;
+        m_jpeg_lock.unlock();
 
         m_flag_init = 0;
     }
@@ -686,6 +817,99 @@ void SecCamera::DeinitCamera()
 }
 
 
+/*
+ * Open CAMERA_DEV_NAME2. Neither the open nor the querycap depends on
+ * m_cam_fd, so this is what the prewarm thread runs.
+ */
+int SecCamera::openRecordDevice(void)
+{
+    int fd = m_backend->open(CAMERA_DEV_NAME2, O_RDWR);
+    ALOGV("%s: open(%s) --> %d", __func__, CAMERA_DEV_NAME2, fd);
+    if (fd < 0) {
+        ALOGE("ERR(%s):Cannot open %s (error : %s)\n", __func__, CAMERA_DEV_NAME2, strerror(errno));
+        return -1;
+    }
+
+    if (fimc_v4l2_querycap(m_backend, fd) < 0) {
+        m_backend->close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Select the sensor on the record node. Both nodes drive the same sensor,
+ * so this only runs once m_cam_fd has selected it. Closes fd on failure.
+ */
+int SecCamera::selectRecordInput(int fd, int index)
+{
+    struct v4l2_input input;
+    int ret = -1;
+
+    if (fimc_v4l2_enuminput(m_backend, fd, index, &input))
+        ret = fimc_v4l2_s_input(m_backend, fd, index);
+    if (ret < 0) {
+        ALOGE("ERR(%s):Cannot select input %d on %s\n", __func__, index, CAMERA_DEV_NAME2);
+        m_backend->close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void SecCamera::recordOpenThread(void)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int fd = openRecordDevice();
+
+    Mutex::Autolock lock(m_record_dev_lock);
+    m_cam_fd2 = fd;
+    m_record_dev_opening = false;
+    m_record_dev_condition.broadcast();
+    ALOGV("%s: %s open after %lld us", __func__, CAMERA_DEV_NAME2,
+          (long long)ns2us(systemTime(SYSTEM_TIME_MONOTONIC) - start));
+}
+
+/*
+ * The record node for startRecord(): waits for the prewarm thread, or
+ * opens it here when it is not up yet (lazy open or failed prewarm).
+ */
+int SecCamera::waitRecordDevice(void)
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    Mutex::Autolock lock(m_record_dev_lock);
+
+    while (m_record_dev_opening)
+        m_record_dev_condition.wait(m_record_dev_lock);
+
+    if (m_cam_fd2 < 0) {
+        m_record_dev_lock.unlock();
+        int fd = openRecordDevice();
+        if (fd > -1)
+            fd = selectRecordInput(fd, m_camera_id);
+        m_record_dev_lock.lock();
+        m_cam_fd2 = fd;
+    }
+
+    m_trace.record(SEC_TRACE_RECORD_OPEN, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    return m_cam_fd2;
+}
+
+void SecCamera::closeRecordDevice(void)
+{
+    if (m_record_open_thread != NULL) {
+        m_record_open_thread->requestExitAndWait();
+        m_record_open_thread.clear();
+    }
+
+    if (m_cam_fd2 > -1) {
+        m_backend->close(m_cam_fd2);
+        m_cam_fd2 = -1;
+    }
+    m_record_dev_opening = false;
+}
+
 int SecCamera::getCameraFd(void)
 {
     return m_cam_fd;
@@ -712,65 +936,125 @@ int SecCamera::startPreview(void)
         return -1;
     }
 
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
     memset(&m_events_c, 0, sizeof(m_events_c));
     m_events_c.fd = m_cam_fd;
     m_events_c.events = POLLIN | POLLERR;
 
-    /* enum_fmt, s_fmt sample */
-    int ret = fimc_v4l2_enum_fmt(m_cam_fd,m_preview_v4lformat);
-    CHECK(ret);
-    ret = fimc_v4l2_s_fmt(m_cam_fd, m_preview_width,m_preview_height,m_preview_v4lformat, 0);
-    CHECK(ret);
+    /* gralloc YV12 buffers keep V ahead of U, so when FIMC writes
+     * straight into them ask for the matching plane order.
+     */
+    unsigned int v4lformat = m_preview_v4lformat;
+    if (m_preview_memory == V4L2_MEMORY_USERPTR && v4lformat == V4L2_PIX_FMT_YUV420)
+        v4lformat = V4L2_PIX_FMT_YVU420;
 
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS);
-    CHECK(ret);
+    /* streamoff left the format and the buffers in place; only a capture
+     * or a sensor reset in between, or new settings, need them set up again.
+     */
+    m_preview_warm = m_preview_configured &&
+                     m_preview_cfg_format == v4lformat &&
+                     m_preview_cfg_width == m_preview_width &&
+                     m_preview_cfg_height == m_preview_height &&
+                     m_preview_cfg_memory == m_preview_memory;
+
+    int ret;
+    if (!m_preview_warm) {
+        m_preview_configured = false;
+
+        /* enum_fmt, s_fmt sample */
+        ret = fimc_v4l2_enum_fmt(m_backend, m_cam_fd, v4lformat);
+        CHECK(ret);
+        ret = fimc_v4l2_s_fmt(m_backend, m_cam_fd, m_preview_width, m_preview_height, v4lformat, 0);
+        CHECK(ret);
+
+        ret = fimc_v4l2_reqbufs(m_backend, m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS,
+                                (enum v4l2_memory)m_preview_memory);
+        CHECK(ret);
+
+        m_preview_configured = true;
+        m_preview_cfg_format = v4lformat;
+        m_preview_cfg_width = m_preview_width;
+        m_preview_cfg_height = m_preview_height;
+        m_preview_cfg_memory = m_preview_memory;
+    }
 
     ALOGV("%s : m_preview_width: %d m_preview_height: %d m_angle: %d\n",
             __func__, m_preview_width, m_preview_height, m_angle);
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd,
-                           V4L2_CID_CAMERA_CHECK_DATALINE, m_chk_dataline);
+    ret = setCtrl(V4L2_CID_CAMERA_CHECK_DATALINE, m_chk_dataline);
     CHECK(ret);
 
     if (m_camera_id == CAMERA_ID_FRONT) {
         /* VT mode setting */
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VT_MODE, m_vtmode);
+        ret = setCtrl(V4L2_CID_CAMERA_VT_MODE, m_vtmode);
         CHECK(ret);
     }
 
-    /* start with all buffers in queue */
-    for (int i = 0; i < MAX_BUFFERS; i++) {
-        ret = fimc_v4l2_qbuf(m_cam_fd, i);
-        CHECK(ret);
-    }
+    /* start with all buffers in queue, except those a consumer still
+     * holds; they are queued once released.
+     */
+    {
+        Mutex::Autolock lock(m_preview_buf_lock);
+
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+            if (m_preview_owner[i] & ~PREVIEW_OWNER_DRIVER)
+                continue;
+            if (m_preview_memory == V4L2_MEMORY_USERPTR) {
+                if (!m_preview_user_buf[i].start)
+                    continue;
+                ret = fimc_v4l2_qbuf_userptr(m_backend, m_cam_fd, i, &m_preview_user_buf[i]);
+            } else {
+                ret = fimc_v4l2_qbuf(m_backend, m_cam_fd, i);
+            }
+            CHECK(ret);
+            m_preview_owner[i] = PREVIEW_OWNER_DRIVER;
+        }
 
-    ret = fimc_v4l2_streamon(m_cam_fd);
-    CHECK(ret);
+        ret = fimc_v4l2_streamon(m_backend, m_cam_fd);
+        CHECK(ret);
 
-    m_flag_camera_start = 1;
+        m_flag_camera_start = 1;
+    }
 
-    ret = fimc_v4l2_s_parm(m_cam_fd, &m_streamparm);
+    ret = fimc_v4l2_s_parm(m_backend, m_cam_fd, &m_streamparm);
     CHECK(ret);
 
     if (m_camera_id == CAMERA_ID_FRONT) {
         /* Blur setting */
         ALOGV("m_blur_level = %d", m_blur_level);
-        ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VGA_BLUR,
-                               m_blur_level);
+        ret = setCtrl(V4L2_CID_CAMERA_VGA_BLUR, m_blur_level);
         CHECK(ret);
     }
 
+    android_atomic_inc(&m_preview_starts[m_preview_warm]);
+    m_preview_started = start;
+
+    /* a warm start returns right away, getPreview() finishes it on the
+     * first frame
+     */
+    if (m_preview_warm) {
+        m_trace.record(SEC_TRACE_PREVIEW_START, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+        return 0;
+    }
+
     // It is a delay for a new frame, not to show the previous bigger ugly picture frame.
-    ret = fimc_poll(&m_events_c);
+    ret = fimc_poll(m_backend, &m_events_c);
     CHECK(ret);
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_RETURN_FOCUS, 0);
+    ret = setCtrl(V4L2_CID_CAMERA_RETURN_FOCUS, 0);
     CHECK(ret);
 
     ALOGV("%s: got the first frame of the preview\n", __func__);
+    m_trace.record(SEC_TRACE_PREVIEW_START, systemTime(SYSTEM_TIME_MONOTONIC) - start);
 
     return 0;
 }
 
+bool SecCamera::isPreviewWarmStart(void)
+{
+    return m_preview_warm;
+}
+
 int SecCamera::stopPreview(void)
 {
     int ret;
@@ -790,7 +1074,9 @@ int SecCamera::stopPreview(void)
         return -1;
     }
 
-    ret = fimc_v4l2_streamoff(m_cam_fd);
+    Mutex::Autolock lock(m_preview_buf_lock);
+
+    ret = fimc_v4l2_streamoff(m_backend, m_cam_fd);
     CHECK(ret);
 
     m_flag_camera_start = 0;
@@ -811,43 +1097,48 @@ int SecCamera::startRecord(void)
         return 0;
     }
 
-    if (m_cam_fd2 <= 0) {
+    if (m_cam_fd <= 0) {
         ALOGE("ERR(%s):Camera was closed\n", __func__);
         return -1;
     }
 
+    if (waitRecordDevice() < 0) {
+        ALOGE("ERR(%s):Cannot set up %s\n", __func__, CAMERA_DEV_NAME2);
+        return -1;
+    }
+
     /* enum_fmt, s_fmt sample */
-    ret = fimc_v4l2_enum_fmt(m_cam_fd2, V4L2_PIX_FMT_NV12T);
+    ret = fimc_v4l2_enum_fmt(m_backend, m_cam_fd2, V4L2_PIX_FMT_NV12T);
     CHECK(ret);
 
     ALOGI("%s: m_recording_width = %d, m_recording_height = %d\n",
          __func__, m_recording_width, m_recording_height);
 
-    ret = fimc_v4l2_s_fmt(m_cam_fd2, m_recording_width,
+    ret = fimc_v4l2_s_fmt(m_backend, m_cam_fd2, m_recording_width,
                           m_recording_height, V4L2_PIX_FMT_NV12T, 0);
     CHECK(ret);
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE,
-                            m_params->capture.timeperframe.denominator);
+    ret = setCtrl(V4L2_CID_CAMERA_FRAME_RATE,
+                     m_params->capture.timeperframe.denominator);
     CHECK(ret);
 
-    ret = fimc_v4l2_reqbufs(m_cam_fd2, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS);
+    ret = fimc_v4l2_reqbufs(m_backend, m_cam_fd2, V4L2_BUF_TYPE_VIDEO_CAPTURE, MAX_BUFFERS);
     CHECK(ret);
 
     /* start with all buffers in queue */
     for (i = 0; i < MAX_BUFFERS; i++) {
-        ret = fimc_v4l2_qbuf(m_cam_fd2, i);
+        ret = fimc_v4l2_qbuf(m_backend, m_cam_fd2, i);
         CHECK(ret);
     }
 
-    ret = fimc_v4l2_streamon(m_cam_fd2);
+    ret = fimc_v4l2_streamon(m_backend, m_cam_fd2);
     CHECK(ret);
 
     // Get and throw away the first frame since it is often garbled.
     memset(&m_events_c2, 0, sizeof(m_events_c2));
     m_events_c2.fd = m_cam_fd2;
     m_events_c2.events = POLLIN | POLLERR;
-    ret = fimc_poll(&m_events_c2);
+    ret = fimc_poll(m_backend, &m_events_c2);
     CHECK(ret);
 
     m_flag_record_start = 1;
@@ -873,11 +1164,10 @@ int SecCamera::stopRecord(void)
 
     m_flag_record_start = 0;
 
-    ret = fimc_v4l2_streamoff(m_cam_fd2);
+    ret = fimc_v4l2_streamoff(m_backend, m_cam_fd2);
     CHECK(ret);
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE,
-                            FRAME_RATE_AUTO);
+    ret = setCtrl(V4L2_CID_CAMERA_FRAME_RATE, FRAME_RATE_AUTO);
     CHECK(ret);
 
     return 0;
@@ -887,7 +1177,7 @@ unsigned int SecCamera::getRecPhyAddrY(int index)
 {
     unsigned int addr_y;
 
-    addr_y = fimc_v4l2_s_ctrl(m_cam_fd2, V4L2_CID_PADDR_Y, index);
+    addr_y = fimc_v4l2_s_ctrl(m_backend, m_cam_fd2, V4L2_CID_PADDR_Y, index);
     CHECK((int)addr_y);
     return addr_y;
 }
@@ -896,7 +1186,7 @@ unsigned int SecCamera::getRecPhyAddrC(int index)
 {
     unsigned int addr_c;
 
-    addr_c = fimc_v4l2_s_ctrl(m_cam_fd2, V4L2_CID_PADDR_CBCR, index);
+    addr_c = fimc_v4l2_s_ctrl(m_backend, m_cam_fd2, V4L2_CID_PADDR_CBCR, index);
     CHECK((int)addr_c);
     return addr_c;
 }
@@ -905,7 +1195,7 @@ unsigned int SecCamera::getPhyAddrY(int index)
 {
     unsigned int addr_y;
 
-    addr_y = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_PADDR_Y, index);
+    addr_y = fimc_v4l2_s_ctrl(m_backend, m_cam_fd, V4L2_CID_PADDR_Y, index);
     CHECK((int)addr_y);
     return addr_y;
 }
@@ -914,66 +1204,199 @@ unsigned int SecCamera::getPhyAddrC(int index)
 {
     unsigned int addr_c;
 
-    addr_c = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_PADDR_CBCR, index);
+    addr_c = fimc_v4l2_s_ctrl(m_backend, m_cam_fd, V4L2_CID_PADDR_CBCR, index);
     CHECK((int)addr_c);
     return addr_c;
 }
 
 void SecCamera::pausePreview()
 {
-    fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_STREAM_PAUSE, 0);
+    setCtrl(V4L2_CID_STREAM_PAUSE, 0);
 }
 
-int SecCamera::getPreview()
+/*
+ * Restart a stalled sensor. The caller flushes whatever consumers hold
+ * preview frames first, so no frame comes back while the stream is down.
+ */
+int SecCamera::resetPreview(void)
 {
-    int index;
     int ret;
 
-    if (m_flag_camera_start == 0 || previewPoll(true) == 0) {
-        ALOGE("ERR(%s):Start Camera Device Reset \n", __func__);
-        /* GAUDI Project([arun.c@samsung.com]) 2010.05.20. [Implemented ESD code] */
-        /*
-         * When there is no data for more than 1 second from the camera we inform
-         * the FIMC driver by calling fimc_v4l2_s_input() with a special value = 1000
-         * FIMC driver identify that there is something wrong with the camera
-         * and it restarts the sensor.
-         */
-        stopPreview();
-        /* Reset Only Camera Device */
-        ret = fimc_v4l2_querycap(m_cam_fd);
-        CHECK(ret);
-        if (fimc_v4l2_enuminput(m_cam_fd, m_camera_id))
-            return -1;
-        ret = fimc_v4l2_s_input(m_cam_fd, 1000);
-        CHECK(ret);
-        ret = startPreview();
-        if (ret < 0) {
-            ALOGE("ERR(%s): startPreview() return %d\n", __func__, ret);
-            return 0;
+    ALOGE("ERR(%s):Start Camera Device Reset \n", __func__);
+    /* GAUDI Project([arun.c@samsung.com]) 2010.05.20. [Implemented ESD code] */
+    /*
+     * When there is no data for more than 1 second from the camera we inform
+     * the FIMC driver by calling fimc_v4l2_s_input(m_backend, ) with a special value = 1000
+     * FIMC driver identify that there is something wrong with the camera
+     * and it restarts the sensor.
+     */
+    stopPreview();
+    m_preview_configured = false;
+    /* Reset Only Camera Device */
+    struct v4l2_input input;
+    ret = fimc_v4l2_querycap(m_backend, m_cam_fd);
+    CHECK(ret);
+    if (fimc_v4l2_enuminput(m_backend, m_cam_fd, m_camera_id, &input))
+        return -1;
+    ret = fimc_v4l2_s_input(m_backend, m_cam_fd, 1000);
+    CHECK(ret);
+    ret = startPreview();
+    if (ret < 0) {
+        ALOGE("ERR(%s): startPreview() return %d\n", __func__, ret);
+        return -1;
+    }
+
+    return 0;
+}
+
+int SecCamera::getPreview(nsecs_t *timestamp)
+{
+    int index;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (m_flag_camera_start == 0 || previewPoll(true) == 0)
+        return PREVIEW_STALLED;
+
+    nsecs_t stamp;
+    index = fimc_v4l2_dqbuf(m_backend, m_cam_fd, (enum v4l2_memory)m_preview_memory, &stamp);
+    if (!(0 <= index && index < MAX_BUFFERS)) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
+        return -1;
+    }
+    fimc_v4l2_order_timestamp(&stamp, &m_preview_timestamp);
+    if (timestamp)
+        *timestamp = stamp;
+
+    if (m_preview_started) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        m_trace.record(SEC_TRACE_PREVIEW_FIRST, now - m_preview_started);
+        m_preview_started = 0;
+        if (m_open_time) {
+            m_trace.record(SEC_TRACE_OPEN_FIRST, now - m_open_time);
+            m_open_time = 0;
         }
+        if (m_preview_warm)
+            setCtrl(V4L2_CID_CAMERA_RETURN_FOCUS, 0);
     }
 
-    index = fimc_v4l2_dqbuf(m_cam_fd);
+    /* the frame stays with the HAL until every owner has released it */
+    android_atomic_release_store(PREVIEW_OWNER_HAL, &m_preview_owner[index]);
+    m_trace.record(SEC_TRACE_PREVIEW_DQBUF, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    return index;
+}
+
+void SecCamera::acquirePreviewFrame(int index, int owner)
+{
+    if (!(0 <= index && index < MAX_BUFFERS)) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
+        return;
+    }
+
+    android_atomic_or(owner, &m_preview_owner[index]);
+}
+
+int SecCamera::releasePreviewFrame(int index, int owner)
+{
     if (!(0 <= index && index < MAX_BUFFERS)) {
         ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
         return -1;
     }
 
-    ret = fimc_v4l2_qbuf(m_cam_fd, index);
+    /* startPreview() and stopPreview() must not queue or drop the
+     * driver queue between the owner change and the QBUF
+     */
+    Mutex::Autolock lock(m_preview_buf_lock);
+
+    int32_t prev = android_atomic_and(~owner, &m_preview_owner[index]);
+    if (!(prev & owner)) {
+        ALOGW("%s: index %d not held by 0x%x (owners 0x%x)", __func__, index, owner, prev);
+        return 0;
+    }
+
+    /* someone else still has it */
+    if (prev & ~owner)
+        return 0;
+
+    android_atomic_or(PREVIEW_OWNER_DRIVER, &m_preview_owner[index]);
+
+    /* buffers released while streaming is off get queued on the next start */
+    if (!m_flag_camera_start)
+        return 0;
+
+    int ret;
+    if (m_preview_memory == V4L2_MEMORY_USERPTR)
+        ret = fimc_v4l2_qbuf_userptr(m_backend, m_cam_fd, index, &m_preview_user_buf[index]);
+    else
+        ret = fimc_v4l2_qbuf(m_backend, m_cam_fd, index);
     CHECK(ret);
 
-    return index;
+    return 0;
+}
+
+int SecCamera::setPreviewUserBuffer(int index, void *addr, size_t length)
+{
+    if (!(0 <= index && index < MAX_BUFFERS)) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
+        return -1;
+    }
+
+    Mutex::Autolock lock(m_preview_buf_lock);
+
+    if (m_flag_camera_start && m_preview_memory != V4L2_MEMORY_USERPTR) {
+        ALOGE("ERR(%s):preview is running with driver buffers\n", __func__);
+        return -1;
+    }
+
+    m_preview_memory = V4L2_MEMORY_USERPTR;
+    m_preview_user_buf[index].start = addr;
+    m_preview_user_buf[index].length = length;
+    m_preview_owner[index] = PREVIEW_OWNER_HAL;
+
+    return 0;
 }
 
-int SecCamera::getRecordFrame()
+void SecCamera::clearPreviewUserBuffers(void)
 {
+    Mutex::Autolock lock(m_preview_buf_lock);
+
+    if (m_flag_camera_start) {
+        ALOGE("ERR(%s):preview is running\n", __func__);
+        return;
+    }
+
+    m_preview_memory = V4L2_MEMORY_MMAP;
+    memset(m_preview_user_buf, 0, sizeof(m_preview_user_buf));
+    for (int i = 0; i < MAX_BUFFERS; i++)
+        m_preview_owner[i] = PREVIEW_OWNER_DRIVER;
+}
+
+bool SecCamera::isPreviewUserBuffer(void)
+{
+    return m_preview_memory == V4L2_MEMORY_USERPTR;
+}
+
+int SecCamera::getRecordFrame(nsecs_t *timestamp)
+{
+    nsecs_t stamp;
+    int index;
+
     if (m_flag_record_start == 0) {
         ALOGE("%s: m_flag_record_start is 0", __func__);
         return -1;
     }
 
+    SecTraceScope trace(&m_trace, SEC_TRACE_RECORD_DQBUF);
     previewPoll(false);
-    return fimc_v4l2_dqbuf(m_cam_fd2);
+    index = fimc_v4l2_dqbuf(m_backend, m_cam_fd2, V4L2_MEMORY_MMAP, &stamp);
+    if (index < 0)
+        return index;
+
+    fimc_v4l2_order_timestamp(&stamp, &m_record_timestamp);
+    if (timestamp)
+        *timestamp = stamp;
+
+    return index;
 }
 
 int SecCamera::releaseRecordFrame(int index)
@@ -989,7 +1412,7 @@ int SecCamera::releaseRecordFrame(int index)
         return 0;
     }
 
-    return fimc_v4l2_qbuf(m_cam_fd2, index);
+    return fimc_v4l2_qbuf(m_backend, m_cam_fd2, index);
 }
 
 int SecCamera::setPreviewSize(int width, int height, int pixel_format)
@@ -1054,7 +1477,16 @@ int SecCamera::getPreviewPixelFormat(void)
  */
 int SecCamera::setSnapshotCmd(void)
 {
-    ALOGV("%s :", __func__);
+    return armCapture(1) < 0 ? -1 : 0;
+}
+
+/*
+ * Set up the JPEG capture stream with count buffers, all queued, and start
+ * it. Returns the number of buffers the driver gave us.
+ */
+int SecCamera::armCapture(int count)
+{
+    ALOGV("%s : %d buffers", __func__, count);
 
     int ret = 0;
 
@@ -1077,26 +1509,38 @@ int SecCamera::setSnapshotCmd(void)
     m_events_c.fd = m_cam_fd;
     m_events_c.events = POLLIN | POLLERR;
 
-    LOG_TIME_START(1) // prepare
-    int nframe = 1;
+    m_shot_lock.lock();
+    m_shot_valid = false;
+    m_shot_lock.unlock();
+    m_preview_configured = false;
 
-    ret = fimc_v4l2_enum_fmt(m_cam_fd,m_snapshot_v4lformat);
-    CHECK(ret);
-    ret = fimc_v4l2_s_fmt_cap(m_cam_fd, m_snapshot_width, m_snapshot_height, V4L2_PIX_FMT_JPEG);
+    LOG_TIME_START(1) // prepare
+    ret = fimc_v4l2_enum_fmt(m_backend, m_cam_fd,m_snapshot_v4lformat);
     CHECK(ret);
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe);
+    ret = fimc_v4l2_s_fmt_cap(m_backend, m_cam_fd, m_snapshot_width, m_snapshot_height, V4L2_PIX_FMT_JPEG);
     CHECK(ret);
-    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    ret = fimc_v4l2_reqbufs(m_backend, m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, count);
     CHECK(ret);
+    if (ret < 1 || ret > CAPTURE_BUFFERS) {
+        ALOGE("ERR(%s):driver gave %d capture buffers for %d\n", __func__, ret, count);
+        return -1;
+    }
+    count = ret;
 
-    ret = fimc_v4l2_qbuf(m_cam_fd, 0);
-    CHECK(ret);
+    /* endSnapshot() unmaps whatever got mapped */
+    for (int i = 0; i < count; i++) {
+        ret = fimc_v4l2_querybuf(m_backend, m_cam_fd, &m_capture_buf[i], V4L2_BUF_TYPE_VIDEO_CAPTURE, i);
+        CHECK(ret);
+        ret = fimc_v4l2_qbuf(m_backend, m_cam_fd, i);
+        CHECK(ret);
+    }
+    m_capture_count = count;
 
-    ret = fimc_v4l2_streamon(m_cam_fd);
+    ret = fimc_v4l2_streamon(m_backend, m_cam_fd);
     CHECK(ret);
     LOG_TIME_END(1)
 
-    return 0;
+    return count;
 }
 
 int SecCamera::endSnapshot(void)
@@ -1104,64 +1548,153 @@ int SecCamera::endSnapshot(void)
     int ret;
 
     ALOGI("%s :", __func__);
-    if (m_capture_buf.start) {
-        munmap(m_capture_buf.start, m_capture_buf.length);
-        ALOGI("munmap():virt. addr %p size = %d\n",
-             m_capture_buf.start, m_capture_buf.length);
-        m_capture_buf.start = NULL;
-        m_capture_buf.length = 0;
+    for (int i = 0; i < CAPTURE_BUFFERS; i++) {
+        struct fimc_buffer *buf = &m_capture_buf[i];
+        if (buf->start) {
+            m_backend->munmap(buf->start, buf->length);
+            ALOGI("munmap():virt. addr %p size = %d\n", buf->start, buf->length);
+            buf->start = NULL;
+            buf->length = 0;
+        }
     }
+    m_capture_count = 0;
     return 0;
 }
 
 /*
- * Set Jpeg quality & exif info and get JPEG data from camera ISP
+ * Burst capture keeps a JPEG capture stream with CAPTURE_BUFFERS buffers
+ * running: every getBurstJpeg() hands out the next filled buffer while the
+ * sensor goes on exposing into the others, and releaseBurstJpeg() queues
+ * it again once the caller is done with it. Returns the number of buffers,
+ * which is how many frames the caller may hold at once.
  */
-unsigned char* SecCamera::getJpeg(int *jpeg_size, unsigned int *phyaddr)
+int SecCamera::startBurstCapture(void)
 {
     ALOGV("%s :", __func__);
 
-    int index, ret = 0;
-    unsigned char *addr;
+    if (m_camera_id != CAMERA_ID_BACK) {
+        ALOGE("ERR(%s):burst capture needs the back camera\n", __func__);
+        return -1;
+    }
 
-    LOG_TIME_DEFINE(2)
+    return armCapture(CAPTURE_BUFFERS);
+}
+
+/*
+ * The frame's sensor state is returned with it: the next getBurstJpeg()
+ * overwrites the shared copy while this frame may still be encoded.
+ */
+unsigned char* SecCamera::getBurstJpeg(int *jpeg_size, int *index, ShotInfo *shot)
+{
+    unsigned int phyaddr;
+    unsigned char *addr = waitJpeg(jpeg_size, &phyaddr, index);
+
+    if (addr != NULL)
+        getShotInfo(shot);
+    return addr;
+}
+
+int SecCamera::releaseBurstJpeg(int index)
+{
+    if (!(0 <= index && index < m_capture_count)) {
+        ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
+        return -1;
+    }
+
+    int ret = fimc_v4l2_qbuf(m_backend, m_cam_fd, index);
+    CHECK(ret);
+
+    return 0;
+}
+
+/* safe after a failed startBurstCapture(), the buffers are always unmapped */
+int SecCamera::stopBurstCapture(void)
+{
+    ALOGV("%s :", __func__);
+
+    int ret = setCtrl(V4L2_CID_STREAM_PAUSE, 0);
+    if (ret >= 0)
+        ret = fimc_v4l2_streamoff(m_backend, m_cam_fd);
+    if (ret < 0)
+        ALOGE("ERR(%s):Fail on stopping the capture stream\n", __func__);
+
+    endSnapshot();
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Set Jpeg quality & exif info and get JPEG data from camera ISP
+ */
+/* wait for the armed capture buffer and read back where the JPEG is */
+unsigned char* SecCamera::waitJpeg(int *jpeg_size, unsigned int *phyaddr, int *buf_index)
+{
+    int index, ret = 0;
 
     // capture
-    ret = fimc_poll(&m_events_c);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    ret = fimc_poll(m_backend, &m_events_c);
     CHECK_PTR(ret);
-    index = fimc_v4l2_dqbuf(m_cam_fd);
-    if (index != 0) {
+    index = fimc_v4l2_dqbuf(m_backend, m_cam_fd);
+    if (!(0 <= index && index < m_capture_count)) {
         ALOGE("ERR(%s):wrong index = %d\n", __func__, index);
         return NULL;
     }
+    m_trace.record(SEC_TRACE_SNAPSHOT, systemTime(SYSTEM_TIME_MONOTONIC) - start);
 
-    *jpeg_size = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAM_JPEG_MAIN_SIZE);
-    CHECK_PTR(*jpeg_size);
+    ret = readShotState(true);
+    CHECK_PTR(ret);
 
-    int main_offset = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAM_JPEG_MAIN_OFFSET);
-    CHECK_PTR(main_offset);
-    m_postview_offset = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAM_JPEG_POSTVIEW_OFFSET);
-    CHECK_PTR(m_postview_offset);
+    *jpeg_size = m_shot_ctrls[SHOT_CTRL_JPEG_SIZE];
+    int main_offset = m_shot_ctrls[SHOT_CTRL_MAIN_OFFSET];
+    m_postview_offset = m_shot_ctrls[SHOT_CTRL_POSTVIEW_OFFSET];
 
-    ret = fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_STREAM_PAUSE, 0);
-    CHECK_PTR(ret);
     ALOGV("\nsnapshot dqueued buffer = %d snapshot_width = %d snapshot_height = %d, size = %d\n\n",
             index, m_snapshot_width, m_snapshot_height, *jpeg_size);
 
-    addr = (unsigned char*)(m_capture_buf.start) + main_offset;
     *phyaddr = getPhyAddrY(index) + m_postview_offset;
+    if (buf_index)
+        *buf_index = index;
+    return (unsigned char*)(m_capture_buf[index].start) + main_offset;
+}
+
+unsigned char* SecCamera::getJpeg(int *jpeg_size, unsigned int *phyaddr)
+{
+    ALOGV("%s :", __func__);
+
+    int ret = 0;
+    unsigned char *addr;
+
+    LOG_TIME_DEFINE(2)
+
+    addr = waitJpeg(jpeg_size, phyaddr);
+    if (addr == NULL)
+        return NULL;
+
+    ret = setCtrl(V4L2_CID_STREAM_PAUSE, 0);
+    CHECK_PTR(ret);
 
     LOG_TIME_START(2) // post
-    ret = fimc_v4l2_streamoff(m_cam_fd);
+    ret = fimc_v4l2_streamoff(m_backend, m_cam_fd);
     CHECK_PTR(ret);
     LOG_TIME_END(2)
 
     return addr;
 }
 
-int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc)
+/*
+ * Write the APP1 segment for the shot to pExifDst, at most maxSize bytes
+ * of it: the thumbnail is dropped if it does not fit. shot is the state
+ * getBurstJpeg() returned, NULL for the last shot. Returns the segment's
+ * size or -1.
+ */
+int SecCamera::getExif(unsigned char *pExifDst, const void *pPostview,
+                       int postviewWidth, int postviewHeight, int maxSize,
+                       const ShotInfo *shot)
 {
-    JpegEncoder jpgEnc;
+    Mutex::Autolock lock(m_jpeg_lock);
+    JpegEncoder &jpgEnc = *jpegEncoder();
+    const void *thumb = NULL;
+    unsigned int thumbSize = 0;
 
     ALOGV("%s : m_jpeg_thumbnail_width = %d, height = %d",
          __func__, m_jpeg_thumbnail_width, m_jpeg_thumbnail_height);
@@ -1202,12 +1735,25 @@ int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc)
         char *pInBuf = (char *)jpgEnc.getInBuf(thumbSrcSize);
         if (pInBuf == NULL)
             return -1;
-        memcpy(pInBuf, pThumbSrc, thumbSrcSize);
 
-        unsigned int thumbSize;
+        size_t scratchSize = secScaleYuyvScratchSize(postviewWidth, thumbWidth);
+        if (scratchSize > m_scale_scratch_size) {
+            void *scratch = realloc(m_scale_scratch, scratchSize);
+            if (scratch == NULL)
+                return -1;
+            m_scale_scratch = scratch;
+            m_scale_scratch_size = scratchSize;
+        }
+        // the thumbnail is scaled from the postview straight into the encoder
+        if (!secScaleYuyv(pPostview, postviewWidth, postviewHeight,
+                          pInBuf, thumbWidth, thumbHeight, m_scale_scratch))
+            return -1;
 
         jpgEnc.encode(&thumbSize, NULL);
 
+        uint64_t outbuf_size;
+        thumb = jpgEnc.getOutBuf(&outbuf_size);
+
         ALOGV("%s : enableThumb set to true", __func__);
         mExifInfo.enableThumb = true;
     } else {
@@ -1217,12 +1763,26 @@ int SecCamera::getExif(unsigned char *pExifDst, unsigned char *pThumbSrc)
 
     unsigned int exifSize;
 
-    setExifChangedAttribute();
+    setExifChangedAttribute(shot);
 
-    ALOGV("%s: calling jpgEnc.makeExif, mExifInfo.width set to %d, height to %d\n",
+    ALOGV("%s: writing EXIF, mExifInfo.width set to %d, height to %d\n",
          __func__, mExifInfo.width, mExifInfo.height);
 
-    jpgEnc.makeExif(pExifDst, &mExifInfo, &exifSize, true);
+    if (m_exif_template)
+        return m_exif_writer.write(pExifDst, &mExifInfo, thumb, thumbSize, maxSize);
+
+    /* the encoder's writer knows no bound, it gets a buffer of its own */
+    unsigned char *exif = (unsigned char *)malloc(EXIF_FILE_SIZE + JPG_STREAM_BUF_SIZE);
+    if (exif == NULL)
+        return -1;
+    jpgEnc.makeExif(exif, &mExifInfo, &exifSize, true);
+    if ((int)exifSize > maxSize) {
+        ALOGE("ERR(%s):EXIF of %u bytes does not fit in %d\n", __func__, exifSize, maxSize);
+        free(exif);
+        return -1;
+    }
+    memcpy(pExifDst, exif, exifSize);
+    free(exif);
 
     return exifSize;
 }
@@ -1262,8 +1822,12 @@ int SecCamera::getPostViewOffset(void)
     return m_postview_offset;
 }
 
-int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_buf,
-                                            unsigned int *output_size)
+/*
+ * Front camera capture: one YUV frame copied from the capture buffer into
+ * yuv_buf, which the HAL makes the client's raw heap. The JPEG is encoded
+ * from there by encodeSnapshot() once the EXIF is done.
+ */
+int SecCamera::getSnapshot(unsigned char *yuv_buf)
 {
     ALOGV("%s :", __func__);
 
@@ -1276,10 +1840,8 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
     LOG_TIME_DEFINE(1)
     LOG_TIME_DEFINE(2)
     LOG_TIME_DEFINE(3)
-    LOG_TIME_DEFINE(4)
-    LOG_TIME_DEFINE(5)
 
-    //fimc_v4l2_streamoff(m_cam_fd); [zzangdol] remove - it is separate in HWInterface with camera_id
+    //fimc_v4l2_streamoff(m_backend, m_cam_fd); [zzangdol] remove - it is separate in HWInterface with camera_id
 
     if (m_cam_fd <= 0) {
         ALOGE("ERR(%s):Camera was closed\n", __func__);
@@ -1318,45 +1880,78 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
         ALOGV("SnapshotFormat:UnknownFormat");
 #endif
 
+    m_shot_lock.lock();
+    m_shot_valid = false;
+    m_shot_lock.unlock();
+    m_preview_configured = false;
+
     LOG_TIME_START(1) // prepare
     int nframe = 1;
 
-    ret = fimc_v4l2_enum_fmt(m_cam_fd,m_snapshot_v4lformat);
+    ret = fimc_v4l2_enum_fmt(m_backend, m_cam_fd,m_snapshot_v4lformat);
     CHECK(ret);
-    ret = fimc_v4l2_s_fmt_cap(m_cam_fd, m_snapshot_width, m_snapshot_height, m_snapshot_v4lformat);
+    ret = fimc_v4l2_s_fmt_cap(m_backend, m_cam_fd, m_snapshot_width, m_snapshot_height, m_snapshot_v4lformat);
     CHECK(ret);
-    ret = fimc_v4l2_reqbufs(m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe);
+    ret = fimc_v4l2_reqbufs(m_backend, m_cam_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, nframe);
     CHECK(ret);
-    ret = fimc_v4l2_querybuf(m_cam_fd, &m_capture_buf, V4L2_BUF_TYPE_VIDEO_CAPTURE);
+    ret = fimc_v4l2_querybuf(m_backend, m_cam_fd, &m_capture_buf[0], V4L2_BUF_TYPE_VIDEO_CAPTURE);
     CHECK(ret);
+    m_capture_count = 1;
 
-    ret = fimc_v4l2_qbuf(m_cam_fd, 0);
+    ret = fimc_v4l2_qbuf(m_backend, m_cam_fd, 0);
     CHECK(ret);
 
-    ret = fimc_v4l2_streamon(m_cam_fd);
+    ret = fimc_v4l2_streamon(m_backend, m_cam_fd);
     CHECK(ret);
     LOG_TIME_END(1)
 
     LOG_TIME_START(2) // capture
-    fimc_poll(&m_events_c);
-    index = fimc_v4l2_dqbuf(m_cam_fd);
-    fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_STREAM_PAUSE, 0);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    fimc_poll(m_backend, &m_events_c);
+    index = fimc_v4l2_dqbuf(m_backend, m_cam_fd);
+    m_trace.record(SEC_TRACE_SNAPSHOT, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    setCtrl(V4L2_CID_STREAM_PAUSE, 0);
     ALOGV("\nsnapshot dequeued buffer = %d snapshot_width = %d snapshot_height = %d\n\n",
             index, m_snapshot_width, m_snapshot_height);
+    readShotState(false);
 
     LOG_TIME_END(2)
 
-    ALOGI("%s : calling memcpy from m_capture_buf", __func__);
-    memcpy(yuv_buf, (unsigned char*)m_capture_buf.start, m_snapshot_width * m_snapshot_height * 2);
-    LOG_TIME_START(5) // post
-    fimc_v4l2_streamoff(m_cam_fd);
-    LOG_TIME_END(5)
-
-    LOG_CAMERA("getSnapshotAndJpeg intervals : stopPreview(%lu), prepare(%lu),"
-                " capture(%lu), memcpy(%lu), yuv2Jpeg(%lu), post(%lu)  us",
-                    LOG_TIME(0), LOG_TIME(1), LOG_TIME(2), LOG_TIME(3), LOG_TIME(4), LOG_TIME(5));
-    /* JPEG encoding */
-    JpegEncoder jpgEnc;
+    LOG_TIME_START(3) // copy
+    memcpy(yuv_buf, (unsigned char*)m_capture_buf[0].start, m_snapshot_width * m_snapshot_height * 2);
+    LOG_TIME_END(3)
+    fimc_v4l2_streamoff(m_backend, m_cam_fd);
+
+    LOG_CAMERA("getSnapshot intervals : stopPreview(%lu), prepare(%lu),"
+                " capture(%lu), memcpy(%lu) us",
+                    LOG_TIME(0), LOG_TIME(1), LOG_TIME(2), LOG_TIME(3));
+
+    return 0;
+}
+
+/*
+ * The hardware JPEG encoder is opened on first use and kept until the
+ * camera is closed; it encodes both the front camera picture and every
+ * thumbnail. Encoder instances share the driver's buffers, which is why
+ * there is only one. Called with m_jpeg_lock held.
+ */
+JpegEncoder *SecCamera::jpegEncoder(void)
+{
+    if (!m_jpeg_enc)
+        m_jpeg_enc = new JpegEncoder;
+    return m_jpeg_enc;
+}
+
+/*
+ * Encode a front camera frame. The returned stream lives in the encoder's
+ * output buffer: it stays valid until the next encode or getExif() call,
+ * the HAL copies it straight into the picture it hands out.
+ */
+const unsigned char *SecCamera::encodeSnapshot(const unsigned char *yuv_buf,
+                                               unsigned int *output_size)
+{
+    Mutex::Autolock lock(m_jpeg_lock);
+    JpegEncoder &jpgEnc = *jpegEncoder();
     int inFormat = JPG_MODESEL_YCBCR;
     int outFormat = JPG_422;
 
@@ -1404,7 +1999,7 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
 
     if (pInBuf == NULL) {
         ALOGE("JPEG input buffer is NULL!!\n");
-        return -1;
+        return NULL;
     }
     memcpy(pInBuf, yuv_buf, snapshot_size);
 
@@ -1416,12 +2011,10 @@ int SecCamera::getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_bu
 
     if (pOutBuf == NULL) {
         ALOGE("JPEG output buffer is NULL!!\n");
-        return -1;
+        return NULL;
     }
 
-    memcpy(jpeg_buf, pOutBuf, outbuf_size);
-
-    return 0;
+    return pOutBuf;
 }
 
 
@@ -1520,6 +2113,120 @@ int SecCamera::getCameraId(void)
 
 // -----------------------------------
 
+/*
+ * The FIMC and sensor drivers only implement VIDIOC_S_CTRL and
+ * VIDIOC_G_CTRL for the private camera ctrls, so there is no batching:
+ * the setters only call this when the value changed.
+ */
+int SecCamera::setCtrl(unsigned int id, int value)
+{
+    android_atomic_inc(&m_ctrl_ioctls);
+    return fimc_v4l2_s_ctrl(m_backend, m_cam_fd, id, value);
+}
+
+int SecCamera::getCtrl(unsigned int id)
+{
+    android_atomic_inc(&m_ctrl_ioctls);
+    return fimc_v4l2_g_ctrl(m_backend, m_cam_fd, id);
+}
+
+/*
+ * Read a set of sensor ctrls, one VIDIOC_G_CTRL each: the drivers do not
+ * serve the private camera ctrls through VIDIOC_G_EXT_CTRLS. A ctrl that
+ * fails gets a negative value.
+ */
+int SecCamera::getCtrls(struct v4l2_ext_control *ctrls, int count)
+{
+    int failed = 0;
+
+    for (int i = 0; i < count; i++) {
+        ctrls[i].value = getCtrl(ctrls[i].id);
+        if (ctrls[i].value < 0)
+            failed++;
+    }
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * Snapshot of everything the EXIF and, for a JPEG capture, the demuxer
+ * need from the sensor, taken right after the frame is dequeued. EXIF
+ * ctrls the sensor does not report (the front camera has none of them)
+ * keep their last good value and are not asked for again until the
+ * camera is reopened.
+ */
+int SecCamera::readShotState(bool jpeg)
+{
+    static const unsigned int ids[SHOT_CTRL_COUNT] = {
+        V4L2_CID_CAMERA_GET_SHT_TIME,
+        V4L2_CID_CAMERA_GET_ISO,
+        V4L2_CID_CAMERA_GET_FLASH_ONOFF,
+        V4L2_CID_CAM_JPEG_MAIN_SIZE,
+        V4L2_CID_CAM_JPEG_MAIN_OFFSET,
+        V4L2_CID_CAM_JPEG_POSTVIEW_OFFSET
+    };
+    struct v4l2_ext_control ctrls[SHOT_CTRL_COUNT];
+    int slots[SHOT_CTRL_COUNT];
+    int last = jpeg ? SHOT_CTRL_COUNT : SHOT_CTRL_JPEG_SIZE;
+    int count = 0;
+    int ret = 0;
+
+    for (int i = 0; i < last; i++) {
+        if (m_shot_missing & (1 << i))
+            continue;
+        memset(&ctrls[count], 0, sizeof(ctrls[0]));
+        ctrls[count].id = ids[i];
+        slots[count++] = i;
+    }
+
+    getCtrls(ctrls, count);
+
+    time_t rawtime;
+    struct tm timeinfo;
+    time(&rawtime);
+    localtime_r(&rawtime, &timeinfo);
+
+    Mutex::Autolock lock(m_shot_lock);
+    for (int i = 0; i < count; i++) {
+        int slot = slots[i];
+        if (ctrls[i].value >= 0) {
+            m_shot_ctrls[slot] = ctrls[i].value;
+        } else if (slot < SHOT_CTRL_JPEG_SIZE) {
+            ALOGW("%s: sensor does not report ctrl 0x%x, using %d for the EXIF",
+                  __func__, ids[slot], m_shot_ctrls[slot]);
+            m_shot_missing |= 1 << slot;
+        } else {
+            ret = -1;
+        }
+    }
+    strftime(m_shot_date_time, sizeof(m_shot_date_time), "%Y:%m:%d %H:%M:%S", &timeinfo);
+    m_shot_valid = true;
+
+    return ret;
+}
+
+void SecCamera::getShotInfo(ShotInfo *shot)
+{
+    Mutex::Autolock lock(m_shot_lock);
+
+    if (!m_shot_valid) {
+        m_shot_lock.unlock();
+        readShotState(false);
+        m_shot_lock.lock();
+    }
+    shot->shutter = m_shot_ctrls[SHOT_CTRL_SHUTTER];
+    shot->iso = m_shot_ctrls[SHOT_CTRL_ISO];
+    shot->flash = m_shot_ctrls[SHOT_CTRL_FLASH];
+    memcpy(shot->date_time, m_shot_date_time, sizeof(shot->date_time));
+}
+
+int SecCamera::getCtrlIoctlCount(void) const
+{
+    return android_atomic_acquire_load(&m_ctrl_ioctls);
+}
+
+// -----------------------------------
+
 int SecCamera::setAutofocus(void)
 {
     ALOGV("%s :", __func__);
@@ -1529,7 +2236,12 @@ int SecCamera::setAutofocus(void)
         return -1;
     }
 
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_AUTO_FOCUS, AUTO_FOCUS_ON) < 0) {
+    m_af_lock.lock();
+    m_af_cancel = false;
+    m_af_start = systemTime(SYSTEM_TIME_MONOTONIC);
+    m_af_lock.unlock();
+
+    if (setCtrl(V4L2_CID_CAMERA_SET_AUTO_FOCUS, AUTO_FOCUS_ON) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_AUTO_FOCUS", __func__);
         return -1;
     }
@@ -1537,40 +2249,78 @@ int SecCamera::setAutofocus(void)
     return 0;
 }
 
+/*
+ * Sleep for *interval, then back the next interval off by half up to
+ * AF_DELAY: a sweep that ends quickly is seen quickly, a long one is not
+ * polled any harder than before. Returns false once AF was cancelled.
+ */
+bool SecCamera::waitAutoFocus(nsecs_t *interval)
+{
+    Mutex::Autolock lock(m_af_lock);
+
+    if (!m_af_cancel)
+        m_af_condition.waitRelative(m_af_lock, *interval);
+
+    *interval += *interval / 2;
+    if (*interval > us2ns(AF_DELAY))
+        *interval = us2ns(AF_DELAY);
+
+    return !m_af_cancel;
+}
+
 int SecCamera::getAutoFocusResult(void)
 {
-    int af_result, count, ret;
+    int af_result, ret;
+    nsecs_t interval = us2ns(AF_DELAY_MIN);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+                       us2ns((nsecs_t)FIRST_AF_SEARCH_COUNT * AF_DELAY);
 
-    for (count = 0; count < FIRST_AF_SEARCH_COUNT; count++) {
-        ret = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST);
+    for (;;) {
+        ret = getCtrl(V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST);
         if (ret != AF_PROGRESS)
             break;
-        usleep(AF_DELAY);
+        if (systemTime(SYSTEM_TIME_MONOTONIC) >= deadline)
+            break;
+        if (!waitAutoFocus(&interval)) {
+            ALOGV("%s : 1st AF was canceled", __func__);
+            af_result = 2;
+            goto finish_auto_focus;
+        }
     }
-    if ((count >= FIRST_AF_SEARCH_COUNT) || (ret != AF_SUCCESS)) {
+    if (ret != AF_SUCCESS) {
         ALOGV("%s : 1st AF timed out, failed, or was canceled", __func__);
         af_result = 0;
         goto finish_auto_focus;
     }
 
-    for (count = 0; count < SECOND_AF_SEARCH_COUNT; count++) {
-        ret = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_SECOND);
+    interval = us2ns(AF_DELAY_MIN);
+    deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+               us2ns((nsecs_t)SECOND_AF_SEARCH_COUNT * AF_DELAY);
+    for (;;) {
+        ret = getCtrl(V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_SECOND);
         /* low byte is garbage.  done when high byte is 0x0 */
         if (!(ret & 0xff00))
             break;
-        usleep(AF_DELAY);
-    }
-    if (count >= SECOND_AF_SEARCH_COUNT) {
-        ALOGV("%s : 2nd AF timed out, failed, or was canceled", __func__);
-        af_result = 0;
-        goto finish_auto_focus;
+        if (systemTime(SYSTEM_TIME_MONOTONIC) >= deadline) {
+            ALOGV("%s : 2nd AF timed out", __func__);
+            af_result = 0;
+            goto finish_auto_focus;
+        }
+        if (!waitAutoFocus(&interval)) {
+            ALOGV("%s : 2nd AF was canceled", __func__);
+            af_result = 2;
+            goto finish_auto_focus;
+        }
     }
 
     af_result = 1;
     ALOGV("%s : AF was successful, returning %d", __func__, af_result);
 
 finish_auto_focus:
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FINISH_AUTO_FOCUS, 0) < 0) {
+    m_trace.record(SEC_TRACE_AUTOFOCUS, systemTime(SYSTEM_TIME_MONOTONIC) - m_af_start);
+    android_atomic_inc(&m_af_stats[af_result]);
+
+    if (setCtrl(V4L2_CID_CAMERA_FINISH_AUTO_FOCUS, 0) < 0) {
         ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_PRE_FLASH", __func__);
         return -1;
     }
@@ -1581,12 +2331,18 @@ int SecCamera::cancelAutofocus(void)
 {
     ALOGV("%s :", __func__);
 
+    // wake up a getAutoFocusResult() in progress
+    m_af_lock.lock();
+    m_af_cancel = true;
+    m_af_condition.broadcast();
+    m_af_lock.unlock();
+
     if (m_cam_fd <= 0) {
         ALOGE("ERR(%s):Camera was closed\n", __func__);
         return -1;
     }
 
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_AUTO_FOCUS, AUTO_FOCUS_OFF) < 0) {
+    if (setCtrl(V4L2_CID_CAMERA_SET_AUTO_FOCUS, AUTO_FOCUS_OFF) < 0) {
         ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_AUTO_FOCUS", __func__);
         return -1;
     }
@@ -1643,7 +2399,7 @@ int SecCamera::SetRotate(int angle)
         }
 
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_ROTATION, angle) < 0) {
+            if (setCtrl(V4L2_CID_ROTATION, angle) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_ROTATION", __func__);
                 return -1;
             }
@@ -1669,7 +2425,7 @@ int SecCamera::setFrameRate(int frame_rate)
     if (m_params->capture.timeperframe.denominator != (unsigned)frame_rate) {
         m_params->capture.timeperframe.denominator = frame_rate;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FRAME_RATE, frame_rate) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_FRAME_RATE, frame_rate) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FRAME_RATE", __func__);
                 return -1;
             }
@@ -1690,7 +2446,7 @@ int SecCamera::setVerticalMirror(void)
         return -1;
     }
 
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_VFLIP, 0) < 0) {
+    if (setCtrl(V4L2_CID_VFLIP, 0) < 0) {
         ALOGE("ERR(%s):Fail on V4L2_CID_VFLIP", __func__);
         return -1;
     }
@@ -1707,7 +2463,7 @@ int SecCamera::setHorizontalMirror(void)
         return -1;
     }
 
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_HFLIP, 0) < 0) {
+    if (setCtrl(V4L2_CID_HFLIP, 0) < 0) {
         ALOGE("ERR(%s):Fail on V4L2_CID_HFLIP", __func__);
         return -1;
     }
@@ -1729,7 +2485,7 @@ int SecCamera::setWhiteBalance(int white_balance)
     if (m_params->white_balance != white_balance) {
         m_params->white_balance = white_balance;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_WHITE_BALANCE, white_balance) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_WHITE_BALANCE, white_balance) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_WHITE_BALANCE", __func__);
                 return -1;
             }
@@ -1761,7 +2517,7 @@ int SecCamera::setBrightness(int brightness)
     if (m_params->brightness != brightness) {
         m_params->brightness = brightness;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BRIGHTNESS, brightness) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_BRIGHTNESS, brightness) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_BRIGHTNESS", __func__);
                 return -1;
             }
@@ -1791,7 +2547,7 @@ int SecCamera::setImageEffect(int image_effect)
     if (m_params->effects != image_effect) {
         m_params->effects = image_effect;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_EFFECT, image_effect) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_EFFECT, image_effect) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_EFFECT", __func__);
                 return -1;
             }
@@ -1820,7 +2576,7 @@ int SecCamera::setAntiBanding(int anti_banding)
     if (m_anti_banding != anti_banding) {
         m_anti_banding = anti_banding;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ANTI_BANDING, anti_banding) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_ANTI_BANDING, anti_banding) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ANTI_BANDING", __func__);
                  return -1;
             }
@@ -1843,7 +2599,7 @@ int SecCamera::setSceneMode(int scene_mode)
     if (m_params->scene_mode != scene_mode) {
         m_params->scene_mode = scene_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SCENE_MODE, scene_mode) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_SCENE_MODE, scene_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SCENE_MODE", __func__);
                 return -1;
             }
@@ -1872,7 +2628,7 @@ int SecCamera::setFlashMode(int flash_mode)
     if (m_params->flash_mode != flash_mode) {
         m_params->flash_mode = flash_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FLASH_MODE, flash_mode) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_FLASH_MODE, flash_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FLASH_MODE", __func__);
                 return -1;
             }
@@ -1900,7 +2656,7 @@ int SecCamera::setISO(int iso_value)
     if (m_params->iso != iso_value) {
         m_params->iso = iso_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ISO, iso_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_ISO, iso_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ISO", __func__);
                 return -1;
             }
@@ -1929,7 +2685,7 @@ int SecCamera::setContrast(int contrast_value)
     if (m_params->contrast != contrast_value) {
         m_params->contrast = contrast_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_CONTRAST, contrast_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_CONTRAST, contrast_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_CONTRAST", __func__);
                 return -1;
             }
@@ -1958,7 +2714,7 @@ int SecCamera::setSaturation(int saturation_value)
     if (m_params->saturation != saturation_value) {
         m_params->saturation = saturation_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SATURATION, saturation_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_SATURATION, saturation_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SATURATION", __func__);
                 return -1;
             }
@@ -1987,7 +2743,7 @@ int SecCamera::setSharpness(int sharpness_value)
     if (m_params->sharpness != sharpness_value) {
         m_params->sharpness = sharpness_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SHARPNESS, sharpness_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_SHARPNESS, sharpness_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SHARPNESS", __func__);
                 return -1;
             }
@@ -2016,7 +2772,7 @@ int SecCamera::setWDR(int wdr_value)
     if (m_wdr != wdr_value) {
         m_wdr = wdr_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_WDR, wdr_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_WDR, wdr_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_WDR", __func__);
                 return -1;
             }
@@ -2045,7 +2801,7 @@ int SecCamera::setAntiShake(int anti_shake)
     if (m_anti_shake != anti_shake) {
         m_anti_shake = anti_shake;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ANTI_SHAKE, anti_shake) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_ANTI_SHAKE, anti_shake) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ANTI_SHAKE", __func__);
                 return -1;
             }
@@ -2075,7 +2831,7 @@ int SecCamera::setMetering(int metering_value)
     if (m_params->metering != metering_value) {
         m_params->metering = metering_value;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_METERING, metering_value) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_METERING, metering_value) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_METERING", __func__);
                 return -1;
             }
@@ -2104,7 +2860,7 @@ int SecCamera::setJpegQuality(int jpeg_quality)
     if (m_jpeg_quality != jpeg_quality) {
         m_jpeg_quality = jpeg_quality;
         if (m_flag_camera_start && (m_camera_id == CAMERA_ID_BACK)) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAM_JPEG_QUALITY, jpeg_quality) < 0) {
+            if (setCtrl(V4L2_CID_CAM_JPEG_QUALITY, jpeg_quality) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAM_JPEG_QUALITY", __func__);
                 return -1;
             }
@@ -2133,7 +2889,7 @@ int SecCamera::setZoom(int zoom_level)
     if (m_zoom_level != zoom_level) {
         m_zoom_level = zoom_level;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_ZOOM, zoom_level) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_ZOOM, zoom_level) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_ZOOM", __func__);
                 return -1;
             }
@@ -2174,7 +2930,7 @@ int SecCamera::getObjectTracking(void)
 int SecCamera::getObjectTrackingStatus(void)
 {
     int obj_status = 0;
-    obj_status = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_OBJ_TRACKING_STATUS);
+    obj_status = getCtrl(V4L2_CID_CAMERA_OBJ_TRACKING_STATUS);
     return obj_status;
 }
 
@@ -2184,7 +2940,7 @@ int SecCamera::setObjectTrackingStartStop(int start_stop)
 
     if (m_object_tracking_start_stop != start_stop) {
         m_object_tracking_start_stop = start_stop;
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_OBJ_TRACKING_START_STOP, start_stop) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_OBJ_TRACKING_START_STOP, start_stop) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_OBJ_TRACKING_START_STOP", __func__);
             return -1;
         }
@@ -2200,7 +2956,7 @@ int SecCamera::setTouchAFStartStop(int start_stop)
     if (m_flag_camera_start) {
         // We need to send this command regardless of previous state to trigger AF
         m_touch_af_start_stop = start_stop;
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_TOUCH_AF_START_STOP, start_stop) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_TOUCH_AF_START_STOP, start_stop) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_TOUCH_AF_START_STOP", __func__);
             return -1;
         }
@@ -2223,7 +2979,7 @@ int SecCamera::setSmartAuto(int smart_auto)
     if (m_smart_auto != smart_auto) {
         m_smart_auto = smart_auto;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SMART_AUTO, smart_auto) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_SMART_AUTO, smart_auto) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SMART_AUTO", __func__);
                 return -1;
             }
@@ -2243,7 +2999,7 @@ int SecCamera::getAutosceneStatus(void)
     int autoscene_status = -1;
 
     if (getSmartAuto() == SMART_AUTO_ON) {
-        autoscene_status = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_SMART_AUTO_STATUS);
+        autoscene_status = getCtrl(V4L2_CID_CAMERA_SMART_AUTO_STATUS);
 
         if ((autoscene_status < SMART_AUTO_STATUS_AUTO) || (autoscene_status > SMART_AUTO_STATUS_MAX)) {
             ALOGE("ERR(%s):Invalid getAutosceneStatus (%d)", __func__, autoscene_status);
@@ -2267,7 +3023,7 @@ int SecCamera::setBeautyShot(int beauty_shot)
     if (m_beauty_shot != beauty_shot) {
         m_beauty_shot = beauty_shot;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BEAUTY_SHOT, beauty_shot) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_BEAUTY_SHOT, beauty_shot) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_BEAUTY_SHOT", __func__);
                 return -1;
             }
@@ -2298,7 +3054,7 @@ int SecCamera::setVintageMode(int vintage_mode)
     if (m_vintage_mode != vintage_mode) {
         m_vintage_mode = vintage_mode;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VINTAGE_MODE, vintage_mode) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_VINTAGE_MODE, vintage_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_VINTAGE_MODE", __func__);
                 return -1;
             }
@@ -2328,7 +3084,7 @@ int SecCamera::setFocusMode(int focus_mode)
         m_params->focus_mode = focus_mode;
 
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FOCUS_MODE, focus_mode) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_FOCUS_MODE, focus_mode) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FOCUS_MODE", __func__);
                 return -1;
             }
@@ -2353,12 +3109,12 @@ int SecCamera::setFaceDetect(int face_detect)
         m_face_detect = face_detect;
         if (m_flag_camera_start) {
             if (m_face_detect != FACE_DETECTION_OFF) {
-                if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FOCUS_MODE, FOCUS_MODE_AUTO) < 0) {
+                if (setCtrl(V4L2_CID_CAMERA_FOCUS_MODE, FOCUS_MODE_AUTO) < 0) {
                     ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FOCUS_MODin face detecion", __func__);
                     return -1;
                 }
             }
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FACE_DETECTION, face_detect) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_FACE_DETECTION, face_detect) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FACE_DETECTION", __func__);
                 return -1;
             }
@@ -2446,7 +3202,7 @@ int SecCamera::setFaceDetectLockUnlock(int facedetect_lockunlock)
 {
     ALOGV("%s(facedetect_lockunlock(%d))", __func__, facedetect_lockunlock);
 
-    if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_FACEDETECT_LOCKUNLOCK, facedetect_lockunlock) < 0) {
+    if (setCtrl(V4L2_CID_CAMERA_FACEDETECT_LOCKUNLOCK, facedetect_lockunlock) < 0) {
         ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_FACEDETECT_LOCKUNLOCK", __func__);
         return -1;
     }
@@ -2459,12 +3215,12 @@ int SecCamera::setObjectPosition(int x, int y)
     ALOGV("%s(setObjectPosition(x=%d, y=%d))", __func__, x, y);
 
     if (m_flag_camera_start) {
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_OBJECT_POSITION_X, x) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_OBJECT_POSITION_X, x) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_OBJECT_POSITION_X", __func__);
             return -1;
         }
 
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_OBJECT_POSITION_Y, y) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_OBJECT_POSITION_Y, y) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_OBJECT_POSITION_Y", __func__);
             return -1;
         }
@@ -2487,7 +3243,7 @@ int SecCamera::setGamma(int gamma)
      if (m_video_gamma != gamma) {
          m_video_gamma = gamma;
          if (m_flag_camera_start) {
-             if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_GAMMA, gamma) < 0) {
+             if (setCtrl(V4L2_CID_CAMERA_SET_GAMMA, gamma) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_GAMMA", __func__);
                  return -1;
              }
@@ -2511,7 +3267,7 @@ int SecCamera::setSlowAE(int slow_ae)
      if (m_slow_ae!= slow_ae) {
          m_slow_ae = slow_ae;
          if (m_flag_camera_start) {
-             if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_SET_SLOW_AE, slow_ae) < 0) {
+             if (setCtrl(V4L2_CID_CAMERA_SET_SLOW_AE, slow_ae) < 0) {
                  ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_SET_SLOW_AE", __func__);
                  return -1;
              }
@@ -2551,7 +3307,7 @@ int SecCamera::setExifOrientationInfo(int orientationInfo)
 int SecCamera::setBatchReflection()
 {
     if (m_flag_camera_start) {
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_BATCH_REFLECTION, 1) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_BATCH_REFLECTION, 1) < 0) {
              ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_BATCH_REFLECTION", __func__);
              return -1;
         }
@@ -2630,7 +3386,7 @@ int SecCamera::setBlur(int blur_level)
     if (m_blur_level != blur_level) {
         m_blur_level = blur_level;
         if (m_flag_camera_start) {
-            if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_VGA_BLUR, blur_level) < 0) {
+            if (setCtrl(V4L2_CID_CAMERA_VGA_BLUR, blur_level) < 0) {
                 ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_VGA_BLUR", __func__);
                 return -1;
             }
@@ -2668,7 +3424,7 @@ int SecCamera::setDataLineCheckStop(void)
     ALOGV("%s", __func__);
 
     if (m_flag_camera_start) {
-        if (fimc_v4l2_s_ctrl(m_cam_fd, V4L2_CID_CAMERA_CHECK_DATALINE_STOP, 1) < 0) {
+        if (setCtrl(V4L2_CID_CAMERA_CHECK_DATALINE_STOP, 1) < 0) {
             ALOGE("ERR(%s):Fail on V4L2_CID_CAMERA_CHECK_DATALINE_STOP", __func__);
             return -1;
         }
@@ -2680,7 +3436,8 @@ const __u8* SecCamera::getCameraSensorName(void)
 {
     ALOGV("%s", __func__);
 
-    return fimc_v4l2_enuminput(m_cam_fd, getCameraId());
+    /* looked up by initCamera() */
+    return m_sensor_name;
 }
 
 #ifdef ENABLE_ESD_PREVIEW_CHECK
@@ -2689,7 +3446,7 @@ int SecCamera::getCameraSensorESDStatus(void)
     ALOGV("%s", __func__);
 
     // 0 : normal operation, 1 : abnormal operation
-    int status = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_ESD_INT);
+    int status = getCtrl(V4L2_CID_ESD_INT);
 
     return status;
 }
@@ -2782,9 +3539,14 @@ void SecCamera::setExifFixedAttribute()
     mExifInfo.y_resolution.num = EXIF_DEF_RESOLUTION_NUM;
     mExifInfo.y_resolution.den = EXIF_DEF_RESOLUTION_DEN;
     mExifInfo.resolution_unit = EXIF_DEF_RESOLUTION_UNIT;
+
+    /* the templates hold the attributes above, serialize them again */
+    property_get("camera.exif.template", property, "1");
+    m_exif_template = atoi(property) != 0;
+    m_exif_writer.reset();
 }
 
-void SecCamera::setExifChangedAttribute()
+void SecCamera::setExifChangedAttribute(const ShotInfo *shot)
 {
     //2 0th IFD TIFF Tags
     //3 Width
@@ -2809,39 +3571,27 @@ void SecCamera::setExifChangedAttribute()
         mExifInfo.orientation = EXIF_ORIENTATION_UP;
         break;
     }
+    /* the sensor state comes from the shot, no ctrl is read here */
+    ShotInfo last;
+    if (!shot) {
+        getShotInfo(&last);
+        shot = &last;
+    }
+    int shutterSpeed = shot->shutter;
+    int iso = shot->iso;
+    int flash = shot->flash;
     //3 Date time
-    time_t rawtime;
-    struct tm *timeinfo;
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    strftime((char *)mExifInfo.date_time, 20, "%Y:%m:%d %H:%M:%S", timeinfo);
+    memcpy(mExifInfo.date_time, shot->date_time, sizeof(shot->date_time));
 
     //2 0th IFD Exif Private Tags
     //3 Exposure Time
-    int shutterSpeed = fimc_v4l2_g_ctrl(m_cam_fd,
-                                            V4L2_CID_CAMERA_GET_SHT_TIME);
-    /* TBD - front camera needs to be fixed to support this g_ctrl,
-       it current returns a negative err value, so avoid putting
-       odd value into exif for now */
-    if (shutterSpeed < 0) {
-        ALOGE("%s: error %d getting shutterSpeed, camera_id = %d, using 100",
-             __func__, shutterSpeed, m_camera_id);
+    if (shutterSpeed <= 0)
         shutterSpeed = 100;
-    }
     mExifInfo.exposure_time.num = 1;
     // x us -> 1/x s */
     mExifInfo.exposure_time.den = (uint32_t)(1000000 / shutterSpeed);
 
     //3 ISO Speed Rating
-    int iso = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_GET_ISO);
-    /* TBD - front camera needs to be fixed to support this g_ctrl,
-       it current returns a negative err value, so avoid putting
-       odd value into exif for now */
-    if (iso < 0) {
-        ALOGE("%s: error %d getting iso, camera_id = %d, using 100",
-             __func__, iso, m_camera_id);
-        iso = ISO_100;
-    }
     switch(iso) {
         case ISO_50:
             mExifInfo.iso_speed_rating = 50;
@@ -2906,7 +3656,6 @@ void SecCamera::setExifChangedAttribute()
     }
 
     //3 Flash
-    int flash = fimc_v4l2_g_ctrl(m_cam_fd, V4L2_CID_CAMERA_GET_FLASH_ONOFF);
     if (flash < 0)
         mExifInfo.flash = EXIF_DEF_FLASH;
     else
@@ -2997,6 +3746,7 @@ inline int SecCamera::m_frameSize(int format, int width, int height)
 
     switch (format) {
     case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YVU420:
     case V4L2_PIX_FMT_NV12:
     case V4L2_PIX_FMT_NV21:
         size = (width * height * 3 / 2);
@@ -3030,10 +3780,53 @@ status_t SecCamera::dump(int fd)
     String8 result;
     snprintf(buffer, 255, "dump(%d)\n", fd);
     result.append(buffer);
+
+    snprintf(buffer, 255, " preview buffers(%s):\n",
+             m_preview_memory == V4L2_MEMORY_USERPTR ? "userptr" : "mmap");
+    result.append(buffer);
+    for (int i = 0; i < MAX_BUFFERS; i++) {
+        int owner = android_atomic_acquire_load(&m_preview_owner[i]);
+        snprintf(buffer, 255, "  [%d] owner(0x%x)%s%s%s%s\n", i, owner,
+                 owner & PREVIEW_OWNER_DRIVER  ? " driver"  : "",
+                 owner & PREVIEW_OWNER_HAL     ? " hal"     : "",
+                 owner & PREVIEW_OWNER_DISPLAY ? " display" : "",
+                 owner & PREVIEW_OWNER_CLIENT  ? " client"  : "");
+        result.append(buffer);
+    }
+
+    snprintf(buffer, 255, " preview starts: cold(%d) warm(%d)\n",
+             android_atomic_acquire_load(&m_preview_starts[0]),
+             android_atomic_acquire_load(&m_preview_starts[1]));
+    result.append(buffer);
+
+    m_record_dev_lock.lock();
+    snprintf(buffer, 255, " record node: %s%s\n",
+             m_record_dev_opening ? "opening" : m_cam_fd2 > -1 ? "open" : "closed",
+             m_record_open_thread != NULL ? " (prewarmed)" : "");
+    m_record_dev_lock.unlock();
+    result.append(buffer);
+
+    snprintf(buffer, 255, " ctrl ioctls(%d)\n", android_atomic_acquire_load(&m_ctrl_ioctls));
+    result.append(buffer);
+
+    snprintf(buffer, 255, " autofocus: focused(%d) failed(%d) cancelled(%d)\n",
+             android_atomic_acquire_load(&m_af_stats[1]),
+             android_atomic_acquire_load(&m_af_stats[0]),
+             android_atomic_acquire_load(&m_af_stats[2]));
+    result.append(buffer);
+
+    result.append(" latency:\n");
+    m_trace.dump(result);
+
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
 
+void SecCamera::resetTrace(void)
+{
+    m_trace.reset();
+}
+
 double SecCamera::jpeg_ratio = 0.7;
 int SecCamera::interleaveDataSize = 5242880;
 int SecCamera::jpegLineLength = 636;
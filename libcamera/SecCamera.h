@@ -38,11 +38,16 @@
 #include <videodev2_samsung.h>
 
 #include <utils/String8.h>
+#include <utils/threads.h>
 
 #include "JpegEncoder.h"
+#include "SecCameraExif.h"
+#include "SecCameraTrace.h"
 
 namespace android {
 
+class SecCameraBackend;
+
 #define ENABLE_ESD_PREVIEW_CHECK
 
 #if defined(LOG_NDEBUG) && LOG_NDEBUG == 0
@@ -152,6 +157,7 @@ namespace android {
 #define AF_PROGRESS 0x01
 #define AF_SUCCESS 0x02
 #define AF_DELAY 50000
+#define AF_DELAY_MIN 10000
 
 /*
  * V 4 L 2   F I M C   E X T E N S I O N S
@@ -256,6 +262,22 @@ public:
         CHK_DATALINE_MAX,
     };
 
+    /* who holds a preview buffer; it goes back to the driver once the
+     * mask is empty.
+     */
+    enum PREVIEW_OWNER {
+        PREVIEW_OWNER_DRIVER    = 1 << 0,
+        PREVIEW_OWNER_HAL       = 1 << 1,
+        PREVIEW_OWNER_DISPLAY   = 1 << 2,
+        PREVIEW_OWNER_CLIENT    = 1 << 3,
+    };
+
+    /* JPEG capture buffers a burst keeps in flight, see startBurstCapture() */
+    enum { CAPTURE_BUFFERS = 3 };
+
+    /* getPreview() found the sensor stalled, see resetPreview() */
+    enum { PREVIEW_STALLED = -2 };
+
     int m_touch_af_start_stop;
 
     struct gps_info_latiude {
@@ -286,6 +308,7 @@ public:
         return &singleton;
     }
     status_t dump(int fd);
+    void            resetTrace(void);
 
     int             getCameraId(void);
 
@@ -294,12 +317,20 @@ public:
 
     int             startRecord(void);
     int             stopRecord(void);
-    int             getRecordFrame(void);
+    /* timestamps are the V4L2 capture time on the monotonic clock */
+    int             getRecordFrame(nsecs_t *timestamp);
     int             releaseRecordFrame(int index);
     unsigned int    getRecPhyAddrY(int);
     unsigned int    getRecPhyAddrC(int);
 
-    int             getPreview(void);
+    int             getPreview(nsecs_t *timestamp);
+    int             resetPreview(void);
+    bool            isPreviewWarmStart(void);
+    void            acquirePreviewFrame(int index, int owner);
+    int             releasePreviewFrame(int index, int owner);
+    int             setPreviewUserBuffer(int index, void *addr, size_t length);
+    void            clearPreviewUserBuffers(void);
+    bool            isPreviewUserBuffer(void);
     int             setPreviewSize(int width, int height, int pixel_format);
     int             getPreviewSize(int *width, int *height, int *frame_size);
     int             getPreviewMaxSize(int *width, int *height);
@@ -398,6 +429,8 @@ public:
     int             setGPSTimeStamp(const char *gps_timestamp);
     int             setGPSProcessingMethod(const char *gps_timestamp);
     int             cancelAutofocus(void);
+
+    int             getCtrlIoctlCount(void) const;
     int             setFaceDetectLockUnlock(int facedetect_lockunlock);
     int             setObjectPosition(int x, int y);
     int             setObjectTrackingStartStop(int start_stop);
@@ -434,9 +467,23 @@ public:
 
     int setFrameRate(int frame_rate);
     unsigned char*  getJpeg(int*, unsigned int*);
-    int             getSnapshotAndJpeg(unsigned char *yuv_buf, unsigned char *jpeg_buf,
+    int             startBurstCapture(void);
+    /* the sensor state the EXIF of one shot is written from */
+    struct ShotInfo {
+        int         shutter;
+        int         iso;
+        int         flash;
+        char        date_time[20];
+    };
+    unsigned char*  getBurstJpeg(int *jpeg_size, int *index, ShotInfo *shot);
+    int             releaseBurstJpeg(int index);
+    int             stopBurstCapture(void);
+    int             getSnapshot(unsigned char *yuv_buf);
+    const unsigned char *encodeSnapshot(const unsigned char *yuv_buf,
                                         unsigned int *output_size);
-    int             getExif(unsigned char *pExifDst, unsigned char *pThumbSrc);
+    int             getExif(unsigned char *pExifDst, const void *pPostview,
+                            int postviewWidth, int postviewHeight, int maxSize,
+                            const ShotInfo *shot = NULL);
 
     void            getPostViewConfig(int*, int*, int*);
     void            getThumbnailConfig(int *width, int *height, int *size);
@@ -485,18 +532,129 @@ public:
 
 
 private:
+    unsigned char*  waitJpeg(int *jpeg_size, unsigned int *phyaddr, int *buf_index = NULL);
+    int             armCapture(int count);
     v4l2_streamparm m_streamparm;
     struct sec_cam_parm   *m_params;
     int             m_flag_init;
 
     int             m_camera_id;
 
+    /* resolved once, every ioctl on m_cam_fd and m_cam_fd2 goes through it */
+    SecCameraBackend *m_backend;
     int             m_cam_fd;
 
     int             m_cam_fd2;
     struct pollfd   m_events_c2;
     int             m_flag_record_start;
 
+    /* the record node is opened off the open path: by a prewarm thread
+     * started in initCamera(), or by startRecord() when camera.record.open
+     * is "lazy". The thread only opens it; the input is selected on the
+     * thread that opens the camera, so it cannot overlap startPreview().
+     */
+    class RecordOpenThread : public Thread {
+        SecCamera  *mCamera;
+    public:
+        RecordOpenThread(SecCamera *camera)
+            : Thread(false), mCamera(camera) { }
+        virtual bool threadLoop() {
+            mCamera->recordOpenThread();
+            return false;
+        }
+    };
+    int             openRecordDevice(void);
+    int             selectRecordInput(int fd, int index);
+    void            recordOpenThread(void);
+    int             waitRecordDevice(void);
+    void            closeRecordDevice(void);
+    sp<RecordOpenThread> m_record_open_thread;
+    Mutex           m_record_dev_lock;
+    Condition       m_record_dev_condition;
+    bool            m_record_dev_opening;
+
+    __u8            m_sensor_name[32];
+    nsecs_t         m_open_time;        /* until the first preview frame */
+
+    int             m_preview_memory;
+    struct fimc_buffer m_preview_user_buf[MAX_BUFFERS];
+    volatile int32_t m_preview_owner[MAX_BUFFERS];
+    /* owner changes to PREVIEW_OWNER_DRIVER, m_flag_camera_start and the
+     * preview QBUF/STREAMON/STREAMOFF
+     */
+    Mutex           m_preview_buf_lock;
+
+    SecCameraTrace  m_trace;
+
+    /* EXIF from prebuilt templates, camera.exif.template=0 goes back to
+     * the encoder's makeExif()
+     */
+    SecExifWriter   m_exif_writer;
+    bool            m_exif_template;
+
+    /* shared hardware JPEG encoder, see jpegEncoder() */
+    Mutex           m_jpeg_lock;
+    JpegEncoder    *m_jpeg_enc;
+    JpegEncoder    *jpegEncoder(void);
+
+    /* secScaleYuyv() row scratch for the thumbnail, kept across shots
+     * under m_jpeg_lock
+     */
+    void           *m_scale_scratch;
+    size_t          m_scale_scratch_size;
+
+    /* preview setup last done on m_cam_fd; a start with the same one
+     * reuses the buffers and does not wait for the first frame
+     */
+    bool            m_preview_configured;
+    unsigned int    m_preview_cfg_format;
+    int             m_preview_cfg_width;
+    int             m_preview_cfg_height;
+    int             m_preview_cfg_memory;
+    bool            m_preview_warm;
+    nsecs_t         m_preview_started;  /* while the first frame is due */
+    volatile int32_t m_preview_starts[2];   /* cold, warm */
+
+    /* last capture time handed out per stream */
+    nsecs_t         m_preview_timestamp;
+    nsecs_t         m_record_timestamp;
+
+    /* autofocus: result polling backs off from AF_DELAY_MIN to AF_DELAY
+     * and is woken up at once by cancelAutofocus()
+     */
+    Mutex           m_af_lock;
+    Condition       m_af_condition;
+    bool            m_af_cancel;
+    nsecs_t         m_af_start;
+    volatile int32_t m_af_stats[3];     /* failed, focused, cancelled */
+    bool            waitAutoFocus(nsecs_t *interval);
+
+    /* every sensor ctrl ioctl on m_cam_fd, counted for dump() */
+    int             setCtrl(unsigned int id, int value);
+    int             getCtrl(unsigned int id);
+    volatile int32_t m_ctrl_ioctls;
+    int             getCtrls(struct v4l2_ext_control *ctrls, int count);
+
+    /* sensor state of the last shot, read in one go right after the
+     * capture is dequeued, see readShotState()
+     */
+    enum {
+        SHOT_CTRL_SHUTTER,
+        SHOT_CTRL_ISO,
+        SHOT_CTRL_FLASH,
+        SHOT_CTRL_JPEG_SIZE,
+        SHOT_CTRL_MAIN_OFFSET,
+        SHOT_CTRL_POSTVIEW_OFFSET,
+        SHOT_CTRL_COUNT
+    };
+    int             readShotState(bool jpeg);
+    void            getShotInfo(ShotInfo *shot);
+    Mutex           m_shot_lock;
+    bool            m_shot_valid;
+    int             m_shot_ctrls[SHOT_CTRL_COUNT];
+    uint32_t        m_shot_missing;     /* EXIF ctrls the sensor does not report */
+    char            m_shot_date_time[20];
+
     int             m_preview_v4lformat;
     int             m_preview_width;
     int             m_preview_height;
@@ -554,12 +712,13 @@ private:
 
     exif_attribute_t mExifInfo;
 
-    struct fimc_buffer m_capture_buf;
+    struct fimc_buffer m_capture_buf[CAPTURE_BUFFERS];
+    int             m_capture_count;
     struct pollfd   m_events_c;
 
     inline int      m_frameSize(int format, int width, int height);
 
-    void            setExifChangedAttribute();
+    void            setExifChangedAttribute(const ShotInfo *shot = NULL);
     void            setExifFixedAttribute();
     void            resetCamera();
 
@@ -0,0 +1,93 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SecCameraBackend"
+#include <utils/Log.h>
+
+#include "SecCameraBackend.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <utils/threads.h>
+
+namespace android {
+
+class SecCameraV4L2Backend : public SecCameraBackend {
+public:
+    virtual int open(const char *path, int flags)
+    {
+        return ::open(path, flags);
+    }
+
+    virtual int close(int fd)
+    {
+        return ::close(fd);
+    }
+
+    virtual int ioctl(int fd, unsigned long request, void *arg)
+    {
+        return ::ioctl(fd, request, arg);
+    }
+
+    virtual void *mmap(void *addr, size_t length, int prot, int flags,
+                       int fd, off_t offset)
+    {
+        return ::mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    virtual int munmap(void *addr, size_t length)
+    {
+        return ::munmap(addr, length);
+    }
+
+    virtual int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+    {
+        return ::poll(fds, nfds, timeout);
+    }
+};
+
+static Mutex gBackendLock;
+static SecCameraBackend *gBackend;
+
+SecCameraBackend *SecCameraBackend::createV4L2(void)
+{
+    return new SecCameraV4L2Backend();
+}
+
+SecCameraBackend *SecCameraBackend::getInstance(void)
+{
+    Mutex::Autolock lock(gBackendLock);
+
+    if (!gBackend)
+        gBackend = createV4L2();
+
+    return gBackend;
+}
+
+void SecCameraBackend::setInstance(SecCameraBackend *backend)
+{
+    Mutex::Autolock lock(gBackendLock);
+
+    if (gBackend)
+        ALOGW("%s: replacing backend %p with %p", __func__, gBackend, backend);
+    gBackend = backend;
+}
+
+}; // namespace android
@@ -0,0 +1,58 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_BACKEND_H
+#define ANDROID_HARDWARE_CAMERA_SEC_BACKEND_H
+
+#include <sys/types.h>
+#include <sys/poll.h>
+
+namespace android {
+
+/*
+ * The device calls SecCamera makes on the FIMC nodes. The default backend
+ * passes them straight to the kernel; the fake one emulates /dev/video0
+ * and /dev/video2 in process so SecCamera can run without the sensor.
+ *
+ * The HAL always gets the kernel backend. The fake is only built into the
+ * test programs under tests/, which install it with setInstance() before
+ * creating the SecCamera: the camera resolves its backend once, when it is
+ * constructed.
+ */
+class SecCameraBackend {
+public:
+    virtual ~SecCameraBackend() {}
+
+    virtual int     open(const char *path, int flags) = 0;
+    virtual int     close(int fd) = 0;
+    virtual int     ioctl(int fd, unsigned long request, void *arg) = 0;
+    virtual void    *mmap(void *addr, size_t length, int prot, int flags,
+                          int fd, off_t offset) = 0;
+    virtual int     munmap(void *addr, size_t length) = 0;
+    virtual int     poll(struct pollfd *fds, nfds_t nfds, int timeout) = 0;
+
+    static SecCameraBackend *getInstance(void);
+    static void     setInstance(SecCameraBackend *backend);
+
+    static SecCameraBackend *createV4L2(void);
+    /* in SecCameraFakeFimc.cpp, not part of the HAL */
+    static SecCameraBackend *createFakeFimc(void);
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_BACKEND_H
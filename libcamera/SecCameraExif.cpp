@@ -0,0 +1,366 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "SecCameraExif.h"
+
+#include <string.h>
+
+namespace android {
+
+enum {
+    EXIF_TYPE_BYTE = 1,
+    EXIF_TYPE_ASCII = 2,
+    EXIF_TYPE_SHORT = 3,
+    EXIF_TYPE_LONG = 4,
+    EXIF_TYPE_RATIONAL = 5,
+    EXIF_TYPE_UNDEFINED = 7,
+    EXIF_TYPE_SRATIONAL = 10
+};
+
+/* FF E1, segment length, "Exif\0\0"; IFD offsets count from what follows */
+#define EXIF_APP1_HEADER_SIZE   10
+#define EXIF_APP1_MAX           0xFFFF
+#define EXIF_CHARSET_SIZE       8
+#define EXIF_DATE_TIME_SIZE     20
+
+static const unsigned char exif_app1_header[EXIF_APP1_HEADER_SIZE] = {
+    0xFF, 0xE1, 0x00, 0x00, 'E', 'x', 'i', 'f', 0x00, 0x00
+};
+static const unsigned char exif_tiff_header[8] = {
+    'I', 'I', 0x2A, 0x00, 0x08, 0x00, 0x00, 0x00
+};
+static const unsigned char exif_charset_ascii[EXIF_CHARSET_SIZE] = {
+    'A', 'S', 'C', 'I', 'I', 0x00, 0x00, 0x00
+};
+
+static inline void put16(unsigned char *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline void putRational(unsigned char *p, uint32_t num, uint32_t den)
+{
+    put32(p, num);
+    put32(p + 4, den);
+}
+
+static int typeSize(int type)
+{
+    switch (type) {
+    case EXIF_TYPE_SHORT:
+        return 2;
+    case EXIF_TYPE_LONG:
+        return 4;
+    case EXIF_TYPE_RATIONAL:
+    case EXIF_TYPE_SRATIONAL:
+        return 8;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Lays out one IFD: the entries, the next IFD offset, then the values
+ * that do not fit in an entry. Positions are offsets from the TIFF header.
+ */
+struct ExifIfd {
+    unsigned char   *tiff;
+    int             entry;
+    int             data;
+
+    ExifIfd(unsigned char *base, int start, int count) : tiff(base)
+    {
+        put16(tiff + start, count);
+        entry = start + 2;
+        data = entry + count * 12 + 4;
+    }
+
+    /* adds an entry, reserving room for at least reserve bytes of value,
+     * and returns where the value goes
+     */
+    int add(uint16_t tag, uint16_t type, uint32_t count, int reserve = 0)
+    {
+        int size = count * typeSize(type);
+        int value;
+
+        if (reserve < size)
+            reserve = size;
+
+        put16(tiff + entry, tag);
+        put16(tiff + entry + 2, type);
+        put32(tiff + entry + 4, count);
+        if (reserve <= 4) {
+            value = entry + 8;
+            put32(tiff + value, 0);
+        } else {
+            value = data;
+            put32(tiff + entry + 8, value);
+            memset(tiff + value, 0, reserve);
+            data += (reserve + 1) & ~1;
+        }
+        entry += 12;
+
+        return value;
+    }
+
+    int addShort(uint16_t tag, uint16_t v)
+    {
+        int value = add(tag, EXIF_TYPE_SHORT, 1);
+        put16(tiff + value, v);
+        return value;
+    }
+
+    int addLong(uint16_t tag, uint32_t v)
+    {
+        int value = add(tag, EXIF_TYPE_LONG, 1);
+        put32(tiff + value, v);
+        return value;
+    }
+
+    int addRational(uint16_t tag, const rational_t &v)
+    {
+        int value = add(tag, EXIF_TYPE_RATIONAL, 1);
+        putRational(tiff + value, v.num, v.den);
+        return value;
+    }
+
+    int addString(uint16_t tag, const unsigned char *s, size_t max)
+    {
+        size_t len = strnlen((const char *)s, max - 1) + 1;
+        int value = add(tag, EXIF_TYPE_ASCII, len);
+        memcpy(tiff + value, s, len - 1);
+        return value;
+    }
+
+    /* returns where the next IFD offset goes */
+    int end(void)
+    {
+        put32(tiff + entry, 0);
+        return entry;
+    }
+};
+
+SecExifWriter::SecExifWriter()
+{
+    reset();
+}
+
+void SecExifWriter::reset(void)
+{
+    for (int gps = 0; gps < 2; gps++) {
+        for (int thumb = 0; thumb < 2; thumb++)
+            m_templates[gps][thumb].size = 0;
+    }
+}
+
+void SecExifWriter::build(Template *t, const exif_attribute_t *info, bool gps, bool thumb)
+{
+    unsigned char *tiff = t->data + EXIF_APP1_HEADER_SIZE;
+    int *f = t->fields;
+    int value;
+
+    memcpy(t->data, exif_app1_header, sizeof(exif_app1_header));
+    memcpy(tiff, exif_tiff_header, sizeof(exif_tiff_header));
+
+    //2 0th IFD TIFF Tags
+    ExifIfd ifd0(tiff, 8, gps ? 10 : 9);
+    f[FIELD_WIDTH] = ifd0.add(0x0100, EXIF_TYPE_LONG, 1);
+    f[FIELD_HEIGHT] = ifd0.add(0x0101, EXIF_TYPE_LONG, 1);
+    ifd0.addString(0x010F, info->maker, sizeof(info->maker));
+    ifd0.addString(0x0110, info->model, sizeof(info->model));
+    f[FIELD_ORIENTATION] = ifd0.add(0x0112, EXIF_TYPE_SHORT, 1);
+    ifd0.addString(0x0131, info->software, sizeof(info->software));
+    f[FIELD_DATE_TIME] = ifd0.add(0x0132, EXIF_TYPE_ASCII, EXIF_DATE_TIME_SIZE);
+    ifd0.addShort(0x0213, info->ycbcr_positioning);
+    int exifPointer = ifd0.add(0x8769, EXIF_TYPE_LONG, 1);
+    int gpsPointer = gps ? ifd0.add(0x8825, EXIF_TYPE_LONG, 1) : 0;
+    int ifd1Pointer = ifd0.end();
+
+    //2 0th IFD Exif Private Tags
+    put32(tiff + exifPointer, ifd0.data);
+    ExifIfd exif(tiff, ifd0.data, 22);
+    f[FIELD_EXPOSURE_TIME] = exif.add(0x829A, EXIF_TYPE_RATIONAL, 1);
+    exif.addRational(0x829D, info->fnumber);
+    exif.addShort(0x8822, info->exposure_program);
+    f[FIELD_ISO] = exif.add(0x8827, EXIF_TYPE_SHORT, 1);
+    value = exif.add(0x9000, EXIF_TYPE_UNDEFINED, sizeof(info->exif_version));
+    memcpy(tiff + value, info->exif_version, sizeof(info->exif_version));
+    f[FIELD_DATE_TIME_ORIGINAL] = exif.add(0x9003, EXIF_TYPE_ASCII, EXIF_DATE_TIME_SIZE);
+    f[FIELD_DATE_TIME_DIGITIZED] = exif.add(0x9004, EXIF_TYPE_ASCII, EXIF_DATE_TIME_SIZE);
+    f[FIELD_SHUTTER_SPEED] = exif.add(0x9201, EXIF_TYPE_SRATIONAL, 1);
+    exif.addRational(0x9202, info->aperture);
+    f[FIELD_BRIGHTNESS] = exif.add(0x9203, EXIF_TYPE_SRATIONAL, 1);
+    f[FIELD_EXPOSURE_BIAS] = exif.add(0x9204, EXIF_TYPE_SRATIONAL, 1);
+    exif.addRational(0x9205, info->max_aperture);
+    f[FIELD_METERING_MODE] = exif.add(0x9207, EXIF_TYPE_SHORT, 1);
+    f[FIELD_FLASH] = exif.add(0x9209, EXIF_TYPE_SHORT, 1);
+    exif.addRational(0x920A, info->focal_length);
+    size_t comment = strnlen((const char *)info->user_comment, sizeof(info->user_comment));
+    value = exif.add(0x9286, EXIF_TYPE_UNDEFINED, EXIF_CHARSET_SIZE + comment);
+    memcpy(tiff + value, exif_charset_ascii, EXIF_CHARSET_SIZE);
+    memcpy(tiff + value + EXIF_CHARSET_SIZE, info->user_comment, comment);
+    exif.addShort(0xA001, info->color_space);
+    f[FIELD_PIXEL_X] = exif.add(0xA002, EXIF_TYPE_LONG, 1);
+    f[FIELD_PIXEL_Y] = exif.add(0xA003, EXIF_TYPE_LONG, 1);
+    exif.addShort(0xA402, info->exposure_mode);
+    f[FIELD_WHITE_BALANCE] = exif.add(0xA403, EXIF_TYPE_SHORT, 1);
+    f[FIELD_SCENE_CAPTURE_TYPE] = exif.add(0xA406, EXIF_TYPE_SHORT, 1);
+    exif.end();
+    int next = exif.data;
+
+    //2 0th IFD GPS Info Tags
+    if (gps) {
+        put32(tiff + gpsPointer, next);
+        ExifIfd gpsIfd(tiff, next, 10);
+        value = gpsIfd.add(0x0000, EXIF_TYPE_BYTE, sizeof(info->gps_version_id));
+        memcpy(tiff + value, info->gps_version_id, sizeof(info->gps_version_id));
+        f[FIELD_GPS_LATITUDE_REF] = gpsIfd.add(0x0001, EXIF_TYPE_ASCII, 2);
+        f[FIELD_GPS_LATITUDE] = gpsIfd.add(0x0002, EXIF_TYPE_RATIONAL, 3);
+        f[FIELD_GPS_LONGITUDE_REF] = gpsIfd.add(0x0003, EXIF_TYPE_ASCII, 2);
+        f[FIELD_GPS_LONGITUDE] = gpsIfd.add(0x0004, EXIF_TYPE_RATIONAL, 3);
+        f[FIELD_GPS_ALTITUDE_REF] = gpsIfd.add(0x0005, EXIF_TYPE_BYTE, 1);
+        f[FIELD_GPS_ALTITUDE] = gpsIfd.add(0x0006, EXIF_TYPE_RATIONAL, 1);
+        f[FIELD_GPS_TIMESTAMP] = gpsIfd.add(0x0007, EXIF_TYPE_RATIONAL, 3);
+        /* the method changes per shot: reserve the longest, patch the count */
+        f[FIELD_GPS_METHOD_ENTRY] = gpsIfd.entry;
+        f[FIELD_GPS_METHOD] = gpsIfd.add(0x001B, EXIF_TYPE_UNDEFINED, EXIF_CHARSET_SIZE,
+                                         EXIF_CHARSET_SIZE + sizeof(info->gps_processing_method));
+        memcpy(tiff + f[FIELD_GPS_METHOD], exif_charset_ascii, EXIF_CHARSET_SIZE);
+        f[FIELD_GPS_DATESTAMP] = gpsIfd.add(0x001D, EXIF_TYPE_ASCII, sizeof(info->gps_datestamp));
+        gpsIfd.end();
+        next = gpsIfd.data;
+    }
+
+    //2 1th IFD TIFF Tags
+    if (thumb) {
+        put32(tiff + ifd1Pointer, next);
+        ExifIfd ifd1(tiff, next, 9);
+        f[FIELD_THUMB_WIDTH] = ifd1.add(0x0100, EXIF_TYPE_LONG, 1);
+        f[FIELD_THUMB_HEIGHT] = ifd1.add(0x0101, EXIF_TYPE_LONG, 1);
+        ifd1.addShort(0x0103, info->compression_scheme);
+        f[FIELD_THUMB_ORIENTATION] = ifd1.add(0x0112, EXIF_TYPE_SHORT, 1);
+        ifd1.addRational(0x011A, info->x_resolution);
+        ifd1.addRational(0x011B, info->y_resolution);
+        ifd1.addShort(0x0128, info->resolution_unit);
+        f[FIELD_THUMB_OFFSET] = ifd1.add(0x0201, EXIF_TYPE_LONG, 1);
+        f[FIELD_THUMB_SIZE] = ifd1.add(0x0202, EXIF_TYPE_LONG, 1);
+        ifd1.end();
+        next = ifd1.data;
+    }
+
+    t->size = EXIF_APP1_HEADER_SIZE + next;
+}
+
+int SecExifWriter::write(unsigned char *dst, const exif_attribute_t *info,
+                         const void *thumb, unsigned int thumbSize, int maxSize)
+{
+    bool gps = info->enableGps;
+    bool withThumb = info->enableThumb && thumb && thumbSize;
+
+    if (maxSize > EXIF_APP1_MAX + 2)
+        maxSize = EXIF_APP1_MAX + 2;
+
+    Template *t = &m_templates[gps][withThumb];
+    if (!t->size)
+        build(t, info, gps, withThumb);
+
+    if (withThumb && t->size + thumbSize > (unsigned int)maxSize) {
+        withThumb = false;
+        t = &m_templates[gps][0];
+        if (!t->size)
+            build(t, info, gps, false);
+    }
+    if (t->size > maxSize)
+        return -1;
+
+    memcpy(dst, t->data, t->size);
+
+    unsigned char *tiff = dst + EXIF_APP1_HEADER_SIZE;
+    const int *f = t->fields;
+
+    put32(tiff + f[FIELD_WIDTH], info->width);
+    put32(tiff + f[FIELD_HEIGHT], info->height);
+    put16(tiff + f[FIELD_ORIENTATION], info->orientation);
+    memcpy(tiff + f[FIELD_DATE_TIME], info->date_time, EXIF_DATE_TIME_SIZE - 1);
+    tiff[f[FIELD_DATE_TIME] + EXIF_DATE_TIME_SIZE - 1] = '\0';
+
+    putRational(tiff + f[FIELD_EXPOSURE_TIME], info->exposure_time.num, info->exposure_time.den);
+    put16(tiff + f[FIELD_ISO], info->iso_speed_rating);
+    memcpy(tiff + f[FIELD_DATE_TIME_ORIGINAL], tiff + f[FIELD_DATE_TIME], EXIF_DATE_TIME_SIZE);
+    memcpy(tiff + f[FIELD_DATE_TIME_DIGITIZED], tiff + f[FIELD_DATE_TIME], EXIF_DATE_TIME_SIZE);
+    putRational(tiff + f[FIELD_SHUTTER_SPEED], info->shutter_speed.num, info->shutter_speed.den);
+    putRational(tiff + f[FIELD_BRIGHTNESS], info->brightness.num, info->brightness.den);
+    putRational(tiff + f[FIELD_EXPOSURE_BIAS], info->exposure_bias.num, info->exposure_bias.den);
+    put16(tiff + f[FIELD_METERING_MODE], info->metering_mode);
+    put16(tiff + f[FIELD_FLASH], info->flash);
+    put32(tiff + f[FIELD_PIXEL_X], info->width);
+    put32(tiff + f[FIELD_PIXEL_Y], info->height);
+    put16(tiff + f[FIELD_WHITE_BALANCE], info->white_balance);
+    put16(tiff + f[FIELD_SCENE_CAPTURE_TYPE], info->scene_capture_type);
+
+    if (gps) {
+        tiff[f[FIELD_GPS_LATITUDE_REF]] = info->gps_latitude_ref[0];
+        tiff[f[FIELD_GPS_LONGITUDE_REF]] = info->gps_longitude_ref[0];
+        for (int i = 0; i < 3; i++) {
+            putRational(tiff + f[FIELD_GPS_LATITUDE] + i * 8,
+                        info->gps_latitude[i].num, info->gps_latitude[i].den);
+            putRational(tiff + f[FIELD_GPS_LONGITUDE] + i * 8,
+                        info->gps_longitude[i].num, info->gps_longitude[i].den);
+            putRational(tiff + f[FIELD_GPS_TIMESTAMP] + i * 8,
+                        info->gps_timestamp[i].num, info->gps_timestamp[i].den);
+        }
+        tiff[f[FIELD_GPS_ALTITUDE_REF]] = info->gps_altitude_ref;
+        putRational(tiff + f[FIELD_GPS_ALTITUDE], info->gps_altitude.num, info->gps_altitude.den);
+
+        size_t method = strnlen((const char *)info->gps_processing_method,
+                                sizeof(info->gps_processing_method));
+        put32(tiff + f[FIELD_GPS_METHOD_ENTRY] + 4, EXIF_CHARSET_SIZE + method);
+        memcpy(tiff + f[FIELD_GPS_METHOD] + EXIF_CHARSET_SIZE,
+               info->gps_processing_method, method);
+
+        memcpy(tiff + f[FIELD_GPS_DATESTAMP], info->gps_datestamp,
+               sizeof(info->gps_datestamp) - 1);
+    }
+
+    int size = t->size;
+    if (withThumb) {
+        put32(tiff + f[FIELD_THUMB_WIDTH], info->widthThumb);
+        put32(tiff + f[FIELD_THUMB_HEIGHT], info->heightThumb);
+        put16(tiff + f[FIELD_THUMB_ORIENTATION], info->orientation);
+        put32(tiff + f[FIELD_THUMB_OFFSET], size - EXIF_APP1_HEADER_SIZE);
+        put32(tiff + f[FIELD_THUMB_SIZE], thumbSize);
+        memcpy(dst + size, thumb, thumbSize);
+        size += thumbSize;
+    }
+
+    /* the segment length is big endian and skips the marker */
+    dst[2] = (size - 2) >> 8;
+    dst[3] = (size - 2) & 0xFF;
+
+    return size;
+}
+
+}; // namespace android
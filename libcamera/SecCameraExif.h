@@ -0,0 +1,103 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_EXIF_H
+#define ANDROID_HARDWARE_CAMERA_SEC_EXIF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "JpegEncoder.h"
+
+namespace android {
+
+/*
+ * EXIF APP1 writer working from prebuilt templates. The IFD structure and
+ * every attribute set by setExifFixedAttribute() are serialized once per
+ * layout (with or without GPS and thumbnail); a shot copies the template
+ * and patches the per-shot fields in place, then appends the thumbnail.
+ */
+class SecExifWriter {
+public:
+    SecExifWriter();
+
+    /* the fixed attributes changed, rebuild the templates on next use */
+    void reset(void);
+
+    /*
+     * Write the APP1 segment, marker included, for info to dst and return
+     * its size, or -1 if even the segment without thumbnail would not fit
+     * in maxSize bytes. thumb is the encoded thumbnail, used when
+     * info->enableThumb is set; it is left out if it would not fit in the
+     * segment or in maxSize.
+     */
+    int write(unsigned char *dst, const exif_attribute_t *info,
+              const void *thumb, unsigned int thumbSize, int maxSize);
+
+private:
+    enum {
+        FIELD_WIDTH,
+        FIELD_HEIGHT,
+        FIELD_ORIENTATION,
+        FIELD_DATE_TIME,
+        FIELD_EXPOSURE_TIME,
+        FIELD_ISO,
+        FIELD_DATE_TIME_ORIGINAL,
+        FIELD_DATE_TIME_DIGITIZED,
+        FIELD_SHUTTER_SPEED,
+        FIELD_BRIGHTNESS,
+        FIELD_EXPOSURE_BIAS,
+        FIELD_METERING_MODE,
+        FIELD_FLASH,
+        FIELD_PIXEL_X,
+        FIELD_PIXEL_Y,
+        FIELD_WHITE_BALANCE,
+        FIELD_SCENE_CAPTURE_TYPE,
+        FIELD_GPS_LATITUDE_REF,
+        FIELD_GPS_LATITUDE,
+        FIELD_GPS_LONGITUDE_REF,
+        FIELD_GPS_LONGITUDE,
+        FIELD_GPS_ALTITUDE_REF,
+        FIELD_GPS_ALTITUDE,
+        FIELD_GPS_TIMESTAMP,
+        FIELD_GPS_METHOD_ENTRY,
+        FIELD_GPS_METHOD,
+        FIELD_GPS_DATESTAMP,
+        FIELD_THUMB_WIDTH,
+        FIELD_THUMB_HEIGHT,
+        FIELD_THUMB_ORIENTATION,
+        FIELD_THUMB_OFFSET,
+        FIELD_THUMB_SIZE,
+        FIELD_COUNT
+    };
+
+    enum { TEMPLATE_MAX = 2048 };
+
+    struct Template {
+        int             size;               /* 0 until built */
+        int             fields[FIELD_COUNT];/* offsets from the TIFF header */
+        unsigned char   data[TEMPLATE_MAX];
+    };
+
+    void build(Template *t, const exif_attribute_t *info, bool gps, bool thumb);
+
+    Template m_templates[2][2];             /* [gps][thumbnail] */
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_EXIF_H
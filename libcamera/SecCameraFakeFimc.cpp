@@ -0,0 +1,791 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * In-process stand-in for the s5pc110 FIMC camera nodes. It implements the
+ * subset of V4L2 SecCamera uses, plus the Samsung private controls, and
+ * synthesizes frames at the configured rate:
+ *
+ *  - preview/record formats get a moving luma ramp with neutral chroma
+ *  - V4L2_PIX_FMT_JPEG on /dev/video0 produces the interleaved JPEG+YUV
+ *    postview stream of the back sensor, in the S5K4ECGX (video comment
+ *    markers) or the Sony (word aligned start/end codes) flavour depending
+ *    on the reported sensor name.
+ *
+ * Buffers live in an ashmem region per node, so the fd handed back by
+ * open() can be mmap()ed by SecCamera and by the camera service alike.
+ *
+ * Properties:
+ *  camera.fake.fps     frame rate, 0 (default) follows VIDIOC_S_PARM
+ *  camera.fake.sensor  name reported for the back camera (S5K4ECGX)
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SecCameraFakeFimc"
+#include <utils/Log.h>
+
+#include "SecCameraBackend.h"
+#include "SecCamera.h"
+
+#include <sys/time.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <cutils/ashmem.h>
+#include <cutils/properties.h>
+
+namespace android {
+
+#define FAKE_FIMC_MEM_SIZE      (16 << 20)
+#define FAKE_FIMC_PHYS_BASE     0x40000000
+#define FAKE_FIMC_MAX_DEVICES   4
+#define FAKE_FIMC_MAX_CTRLS     64
+#define FAKE_FIMC_AF_TIME       ms2ns(300)
+#define FAKE_FIMC_DQBUF_TIMEOUT ms2ns(2000)
+
+#define FAKE_ALIGN_W(x)         (((x) + 0x7F) & (~0x7F))
+#define FAKE_ALIGN_H(x)         (((x) + 0x1F) & (~0x1F))
+#define FAKE_ALIGN_BUF(x)       (((x) + 0x1FFF) & (~0x1FFF))
+
+static const uint32_t fake_formats[] = {
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_NV21,
+    V4L2_PIX_FMT_NV12T,
+    V4L2_PIX_FMT_YUV420,
+    V4L2_PIX_FMT_YVU420,
+    V4L2_PIX_FMT_YUYV,
+    V4L2_PIX_FMT_UYVY,
+    V4L2_PIX_FMT_YUV422P,
+    V4L2_PIX_FMT_RGB565,
+    V4L2_PIX_FMT_JPEG,
+};
+
+static const struct {
+    uint32_t id;
+    int32_t value;
+} fake_ctrl_defaults[] = {
+    { V4L2_CID_CAMERA_GET_SHT_TIME,     16666 },
+    { V4L2_CID_CAMERA_GET_ISO,          ISO_100 },
+    { V4L2_CID_CAMERA_GET_FLASH_ONOFF,  0 },
+    { V4L2_CID_ESD_INT,                 0 },
+};
+
+class SecCameraFakeFimc : public SecCameraBackend {
+public:
+    SecCameraFakeFimc();
+    virtual ~SecCameraFakeFimc();
+
+    virtual int     open(const char *path, int flags);
+    virtual int     close(int fd);
+    virtual int     ioctl(int fd, unsigned long request, void *arg);
+    virtual void    *mmap(void *addr, size_t length, int prot, int flags,
+                          int fd, off_t offset);
+    virtual int     munmap(void *addr, size_t length);
+    virtual int     poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+private:
+    struct Device {
+        int         fd;
+        int         node;
+        int         input;
+        uint8_t     *mem;
+
+        uint32_t    width;
+        uint32_t    height;
+        uint32_t    pixfmt;
+        uint32_t    sizeimage;
+        uint32_t    previewWidth;
+
+        int         memory;
+        int         count;
+        uint32_t    length;
+        unsigned long userptr[MAX_BUFFERS];
+        int         fifo[MAX_BUFFERS];
+        int         fifoHead;
+        int         fifoCount;
+
+        bool        streaming;
+        nsecs_t     streamStart;
+        uint32_t    sequence;
+        struct v4l2_streamparm parm;
+
+        uint32_t    ctrlId[FAKE_FIMC_MAX_CTRLS];
+        int32_t     ctrlValue[FAKE_FIMC_MAX_CTRLS];
+        int         ctrlCount;
+        nsecs_t     afStart;
+        int32_t     jpegSize;
+    };
+
+    Device          *lookup(int fd);
+    nsecs_t         framePeriod(Device *dev);
+    nsecs_t         frameDue(Device *dev);
+    uint32_t        frameSize(uint32_t pixfmt, uint32_t width, uint32_t height);
+
+    int             setFmt(Device *dev, struct v4l2_format *fmt);
+    int             reqbufs(Device *dev, struct v4l2_requestbuffers *req);
+    int             qbuf(Device *dev, struct v4l2_buffer *buf);
+    int             dqbuf(Device *dev, struct v4l2_buffer *buf);
+    int             gCtrl(Device *dev, struct v4l2_control *ctrl);
+    int             sCtrl(Device *dev, struct v4l2_control *ctrl);
+    int32_t         *findCtrl(Device *dev, uint32_t id, bool create);
+
+    void            fillFrame(Device *dev, uint8_t *dst, uint32_t sequence);
+    int32_t         fillInterleaved(Device *dev, uint8_t *dst, uint32_t sequence);
+
+    mutable Mutex   mLock;
+    Condition       mCond;
+    Device          mDevices[FAKE_FIMC_MAX_DEVICES];
+    int             mFps;
+    char            mSensorName[PROPERTY_VALUE_MAX];
+};
+
+SecCameraBackend *SecCameraBackend::createFakeFimc(void)
+{
+    return new SecCameraFakeFimc();
+}
+
+SecCameraFakeFimc::SecCameraFakeFimc()
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    for (int i = 0; i < FAKE_FIMC_MAX_DEVICES; i++)
+        mDevices[i].fd = -1;
+
+    property_get("camera.fake.fps", value, "0");
+    mFps = atoi(value);
+    property_get("camera.fake.sensor", mSensorName, "S5K4ECGX");
+}
+
+SecCameraFakeFimc::~SecCameraFakeFimc()
+{
+    for (int i = 0; i < FAKE_FIMC_MAX_DEVICES; i++) {
+        if (mDevices[i].fd >= 0)
+            close(mDevices[i].fd);
+    }
+}
+
+SecCameraFakeFimc::Device *SecCameraFakeFimc::lookup(int fd)
+{
+    for (int i = 0; i < FAKE_FIMC_MAX_DEVICES; i++) {
+        if (fd >= 0 && mDevices[i].fd == fd)
+            return &mDevices[i];
+    }
+    return NULL;
+}
+
+int SecCameraFakeFimc::open(const char *path, int flags)
+{
+    int node;
+
+    if (!strcmp(path, CAMERA_DEV_NAME))
+        node = 0;
+    else if (!strcmp(path, CAMERA_DEV_NAME2))
+        node = 2;
+    else
+        return ::open(path, flags);
+
+    Mutex::Autolock lock(mLock);
+
+    Device *dev = lookup(-1);
+    for (int i = 0; i < FAKE_FIMC_MAX_DEVICES && !dev; i++) {
+        if (mDevices[i].fd < 0)
+            dev = &mDevices[i];
+    }
+    if (!dev) {
+        errno = EMFILE;
+        return -1;
+    }
+
+    int fd = ashmem_create_region(path, FAKE_FIMC_MEM_SIZE);
+    if (fd < 0) {
+        ALOGE("ERR(%s):could not create region for %s", __func__, path);
+        return -1;
+    }
+
+    void *mem = ::mmap(NULL, FAKE_FIMC_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        ALOGE("ERR(%s):could not map region for %s", __func__, path);
+        ::close(fd);
+        return -1;
+    }
+
+    memset(dev, 0, sizeof(*dev));
+    dev->fd = fd;
+    dev->node = node;
+    dev->mem = (uint8_t *)mem;
+    dev->memory = V4L2_MEMORY_MMAP;
+    dev->parm.parm.capture.timeperframe.numerator = 1;
+    dev->parm.parm.capture.timeperframe.denominator = 30;
+
+    ALOGI("%s: %s -> fd %d", __func__, path, fd);
+    return fd;
+}
+
+int SecCameraFakeFimc::close(int fd)
+{
+    {
+        Mutex::Autolock lock(mLock);
+        Device *dev = lookup(fd);
+        if (dev) {
+            ::munmap(dev->mem, FAKE_FIMC_MEM_SIZE);
+            dev->fd = -1;
+            dev->streaming = false;
+            mCond.broadcast();
+        }
+    }
+    return ::close(fd);
+}
+
+void *SecCameraFakeFimc::mmap(void *addr, size_t length, int prot, int flags,
+                              int fd, off_t offset)
+{
+    /* the device fd is the ashmem region itself */
+    return ::mmap(addr, length, prot, flags, fd, offset);
+}
+
+int SecCameraFakeFimc::munmap(void *addr, size_t length)
+{
+    return ::munmap(addr, length);
+}
+
+nsecs_t SecCameraFakeFimc::framePeriod(Device *dev)
+{
+    if (mFps > 0)
+        return s2ns(1) / mFps;
+
+    struct v4l2_fract *tpf = &dev->parm.parm.capture.timeperframe;
+    if (!tpf->numerator || !tpf->denominator)
+        return s2ns(1) / 30;
+
+    return s2ns(1) * tpf->numerator / tpf->denominator;
+}
+
+nsecs_t SecCameraFakeFimc::frameDue(Device *dev)
+{
+    return dev->streamStart + framePeriod(dev) * (dev->sequence + 1);
+}
+
+uint32_t SecCameraFakeFimc::frameSize(uint32_t pixfmt, uint32_t width, uint32_t height)
+{
+    switch (pixfmt) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YVU420:
+        return width * height * 3 / 2;
+
+    case V4L2_PIX_FMT_NV12T:
+        return FAKE_ALIGN_BUF(FAKE_ALIGN_W(width) * FAKE_ALIGN_H(height)) +
+               FAKE_ALIGN_BUF(FAKE_ALIGN_W(width) * FAKE_ALIGN_H(height / 2));
+
+    case V4L2_PIX_FMT_JPEG:
+        return SecCamera::getInterleaveDataSize();
+
+    default:
+        return width * height * 2;
+    }
+}
+
+int SecCameraFakeFimc::setFmt(Device *dev, struct v4l2_format *fmt)
+{
+    struct v4l2_pix_format *pix = &fmt->fmt.pix;
+
+    if (dev->streaming) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    dev->width = pix->width;
+    dev->height = pix->height;
+    dev->pixfmt = pix->pixelformat;
+    dev->sizeimage = frameSize(pix->pixelformat, pix->width, pix->height);
+    if (pix->pixelformat != V4L2_PIX_FMT_JPEG)
+        dev->previewWidth = pix->width;
+
+    pix->sizeimage = dev->sizeimage;
+    return 0;
+}
+
+int SecCameraFakeFimc::reqbufs(Device *dev, struct v4l2_requestbuffers *req)
+{
+    if (dev->streaming) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    int count = req->count > MAX_BUFFERS ? MAX_BUFFERS : req->count;
+    uint32_t length = (dev->sizeimage + 0xFFF) & ~0xFFF;
+
+    if (req->memory == V4L2_MEMORY_MMAP && (size_t)count * length > FAKE_FIMC_MEM_SIZE) {
+        ALOGE("ERR(%s):%d buffers of %u bytes do not fit", __func__, count, length);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    dev->memory = req->memory;
+    dev->count = count;
+    dev->length = length;
+    dev->fifoHead = 0;
+    dev->fifoCount = 0;
+    memset(dev->userptr, 0, sizeof(dev->userptr));
+
+    req->count = count;
+    return 0;
+}
+
+int SecCameraFakeFimc::qbuf(Device *dev, struct v4l2_buffer *buf)
+{
+    if (buf->index >= (uint32_t)dev->count || buf->memory != (uint32_t)dev->memory) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (int i = 0; i < dev->fifoCount; i++) {
+        if (dev->fifo[(dev->fifoHead + i) % MAX_BUFFERS] == (int)buf->index) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    if (dev->memory == V4L2_MEMORY_USERPTR) {
+        if (!buf->m.userptr || buf->length < dev->sizeimage) {
+            errno = EINVAL;
+            return -1;
+        }
+        dev->userptr[buf->index] = buf->m.userptr;
+    }
+
+    dev->fifo[(dev->fifoHead + dev->fifoCount) % MAX_BUFFERS] = buf->index;
+    dev->fifoCount++;
+    mCond.broadcast();
+    return 0;
+}
+
+int SecCameraFakeFimc::dqbuf(Device *dev, struct v4l2_buffer *buf)
+{
+    nsecs_t giveUp = systemTime(SYSTEM_TIME_MONOTONIC) + FAKE_FIMC_DQBUF_TIMEOUT;
+
+    /* block like the driver until a queued buffer has been "exposed" */
+    for (;;) {
+        if (!dev->streaming || dev->fd < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t wake = giveUp;
+        if (dev->fifoCount > 0) {
+            if (now >= frameDue(dev))
+                break;
+            wake = frameDue(dev);
+        } else if (now >= giveUp) {
+            errno = EIO;
+            return -1;
+        }
+        mCond.waitRelative(mLock, wake - now);
+    }
+
+    int index = dev->fifo[dev->fifoHead];
+    dev->fifoHead = (dev->fifoHead + 1) % MAX_BUFFERS;
+    dev->fifoCount--;
+
+    uint32_t sequence = dev->sequence++;
+    uint8_t *dst = dev->memory == V4L2_MEMORY_USERPTR ?
+                   (uint8_t *)dev->userptr[index] : dev->mem + index * dev->length;
+
+    /* stamped at "exposure" like the driver, not when the fill is done */
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    /* nobody else can touch a dequeued buffer, fill it unlocked */
+    mLock.unlock();
+    if (dev->pixfmt == V4L2_PIX_FMT_JPEG && dev->node == 0)
+        dev->jpegSize = fillInterleaved(dev, dst, sequence);
+    else
+        fillFrame(dev, dst, sequence);
+    mLock.lock();
+
+    buf->index = index;
+    buf->bytesused = dev->sizeimage;
+    buf->sequence = sequence;
+    buf->timestamp = tv;
+    buf->field = V4L2_FIELD_NONE;
+    buf->length = dev->length;
+    if (dev->memory == V4L2_MEMORY_USERPTR)
+        buf->m.userptr = dev->userptr[index];
+    else
+        buf->m.offset = index * dev->length;
+
+    return 0;
+}
+
+int32_t *SecCameraFakeFimc::findCtrl(Device *dev, uint32_t id, bool create)
+{
+    for (int i = 0; i < dev->ctrlCount; i++) {
+        if (dev->ctrlId[i] == id)
+            return &dev->ctrlValue[i];
+    }
+
+    if (!create || dev->ctrlCount == FAKE_FIMC_MAX_CTRLS)
+        return NULL;
+
+    dev->ctrlId[dev->ctrlCount] = id;
+    dev->ctrlValue[dev->ctrlCount] = 0;
+    return &dev->ctrlValue[dev->ctrlCount++];
+}
+
+int SecCameraFakeFimc::gCtrl(Device *dev, struct v4l2_control *ctrl)
+{
+    switch (ctrl->id) {
+    case V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_FIRST:
+        ctrl->value = systemTime(SYSTEM_TIME_MONOTONIC) - dev->afStart < FAKE_FIMC_AF_TIME ?
+                      AF_PROGRESS : AF_SUCCESS;
+        return 0;
+
+    case V4L2_CID_CAMERA_AUTO_FOCUS_RESULT_SECOND:
+        ctrl->value = 0;
+        return 0;
+
+    case V4L2_CID_CAM_JPEG_MAIN_SIZE:
+        ctrl->value = dev->jpegSize;
+        return 0;
+
+    case V4L2_CID_CAM_JPEG_MAIN_OFFSET:
+        ctrl->value = 0;
+        return 0;
+
+    case V4L2_CID_CAM_JPEG_POSTVIEW_OFFSET:
+        ctrl->value = dev->jpegSize;
+        return 0;
+    }
+
+    int32_t *value = findCtrl(dev, ctrl->id, false);
+    if (value) {
+        ctrl->value = *value;
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(fake_ctrl_defaults) / sizeof(fake_ctrl_defaults[0]); i++) {
+        if (fake_ctrl_defaults[i].id == ctrl->id) {
+            ctrl->value = fake_ctrl_defaults[i].value;
+            return 0;
+        }
+    }
+
+    ctrl->value = 0;
+    return 0;
+}
+
+int SecCameraFakeFimc::sCtrl(Device *dev, struct v4l2_control *ctrl)
+{
+    uint32_t base = FAKE_FIMC_PHYS_BASE + dev->node * FAKE_FIMC_MEM_SIZE;
+    uint32_t index = ctrl->value;
+
+    switch (ctrl->id) {
+    /* the physical address controls answer through the value */
+    case V4L2_CID_PADDR_Y:
+        ctrl->value = base + index * dev->length;
+        return 0;
+
+    case V4L2_CID_PADDR_CBCR:
+        ctrl->value = base + index * dev->length + dev->width * dev->height;
+        return 0;
+
+    case V4L2_CID_CAMERA_SET_AUTO_FOCUS:
+        if (ctrl->value == AUTO_FOCUS_ON)
+            dev->afStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        break;
+    }
+
+    int32_t *value = findCtrl(dev, ctrl->id, true);
+    if (value)
+        *value = ctrl->value;
+    return 0;
+}
+
+int SecCameraFakeFimc::ioctl(int fd, unsigned long request, void *arg)
+{
+    Mutex::Autolock lock(mLock);
+
+    Device *dev = lookup(fd);
+    if (!dev)
+        return ::ioctl(fd, request, arg);
+
+    switch (request) {
+    case VIDIOC_QUERYCAP: {
+        struct v4l2_capability *cap = (struct v4l2_capability *)arg;
+        memset(cap, 0, sizeof(*cap));
+        strcpy((char *)cap->driver, "fake-fimc");
+        strcpy((char *)cap->card, dev->node ? "fake-fimc2" : "fake-fimc0");
+        cap->capabilities = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+        return 0;
+    }
+
+    case VIDIOC_ENUMINPUT: {
+        struct v4l2_input *input = (struct v4l2_input *)arg;
+        if (input->index > SecCamera::CAMERA_ID_FRONT) {
+            errno = EINVAL;
+            return -1;
+        }
+        strncpy((char *)input->name,
+                input->index == SecCamera::CAMERA_ID_BACK ? mSensorName : "S5KA3DFX",
+                sizeof(input->name) - 1);
+        input->type = V4L2_INPUT_TYPE_CAMERA;
+        return 0;
+    }
+
+    case VIDIOC_S_INPUT: {
+        struct v4l2_input *input = (struct v4l2_input *)arg;
+        dev->input = input->index;
+        return 0;
+    }
+
+    case VIDIOC_ENUM_FMT: {
+        struct v4l2_fmtdesc *desc = (struct v4l2_fmtdesc *)arg;
+        if (desc->index >= sizeof(fake_formats) / sizeof(fake_formats[0])) {
+            errno = EINVAL;
+            return -1;
+        }
+        desc->pixelformat = fake_formats[desc->index];
+        return 0;
+    }
+
+    case VIDIOC_S_FMT:
+        return setFmt(dev, (struct v4l2_format *)arg);
+
+    case VIDIOC_REQBUFS:
+        return reqbufs(dev, (struct v4l2_requestbuffers *)arg);
+
+    case VIDIOC_QUERYBUF: {
+        struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+        if (buf->index >= (uint32_t)dev->count) {
+            errno = EINVAL;
+            return -1;
+        }
+        buf->length = dev->length;
+        buf->m.offset = buf->index * dev->length;
+        return 0;
+    }
+
+    case VIDIOC_QBUF:
+        return qbuf(dev, (struct v4l2_buffer *)arg);
+
+    case VIDIOC_DQBUF:
+        return dqbuf(dev, (struct v4l2_buffer *)arg);
+
+    case VIDIOC_STREAMON:
+        dev->streaming = true;
+        dev->streamStart = systemTime(SYSTEM_TIME_MONOTONIC);
+        dev->sequence = 0;
+        mCond.broadcast();
+        return 0;
+
+    case VIDIOC_STREAMOFF:
+        /* like the driver, every queued buffer comes back to userspace */
+        dev->streaming = false;
+        dev->fifoHead = 0;
+        dev->fifoCount = 0;
+        mCond.broadcast();
+        return 0;
+
+    case VIDIOC_G_CTRL:
+        return gCtrl(dev, (struct v4l2_control *)arg);
+
+    case VIDIOC_S_CTRL:
+        return sCtrl(dev, (struct v4l2_control *)arg);
+
+    case VIDIOC_G_PARM:
+        memcpy(arg, &dev->parm, sizeof(dev->parm));
+        return 0;
+
+    case VIDIOC_S_PARM:
+        memcpy(&dev->parm, arg, sizeof(dev->parm));
+        return 0;
+    }
+
+    ALOGW("%s: unhandled request 0x%lx on fd %d", __func__, request, fd);
+    errno = ENOTTY;
+    return -1;
+}
+
+int SecCameraFakeFimc::poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    Mutex::Autolock lock(mLock);
+
+    Device *dev = nfds == 1 ? lookup(fds[0].fd) : NULL;
+    if (!dev) {
+        mLock.unlock();
+        int ret = ::poll(fds, nfds, timeout);
+        mLock.lock();
+        return ret;
+    }
+
+    /* a negative timeout waits forever, as for poll(2) */
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+                       (timeout < 0 ? s2ns(3600) : ms2ns(timeout));
+
+    fds[0].revents = 0;
+    for (;;) {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t wake = deadline;
+
+        if (dev->fd < 0) {
+            fds[0].revents = POLLERR;
+            return 1;
+        }
+
+        if (dev->streaming && dev->fifoCount > 0) {
+            if (now >= frameDue(dev)) {
+                fds[0].revents = POLLIN;
+                return 1;
+            }
+            if (frameDue(dev) < wake)
+                wake = frameDue(dev);
+        }
+
+        if (now >= deadline)
+            return 0;
+
+        mCond.waitRelative(mLock, wake - now);
+    }
+}
+
+/*
+ * Preview and record frames: one luma value per row, scrolling with the
+ * frame sequence, and neutral chroma.
+ */
+void SecCameraFakeFimc::fillFrame(Device *dev, uint8_t *dst, uint32_t sequence)
+{
+    const uint32_t width = dev->width;
+    const uint32_t height = dev->height;
+
+    switch (dev->pixfmt) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY: {
+        const int lumaFirst = dev->pixfmt == V4L2_PIX_FMT_YUYV;
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t luma = (y + sequence * 2) & 0xff;
+            uint8_t *p = dst + y * width * 2;
+            for (uint32_t x = 0; x < width; x++) {
+                p[lumaFirst ? 0 : 1] = luma;
+                p[lumaFirst ? 1 : 0] = 0x80;
+                p += 2;
+            }
+        }
+        break;
+    }
+
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_YUV422P:
+        for (uint32_t y = 0; y < height; y++)
+            memset(dst + y * width * 2, (y + sequence * 2) & 0xff, width * 2);
+        break;
+
+    default: {
+        uint32_t stride = dev->pixfmt == V4L2_PIX_FMT_NV12T ? FAKE_ALIGN_W(width) : width;
+        uint32_t lumaSize = dev->pixfmt == V4L2_PIX_FMT_NV12T ?
+                            FAKE_ALIGN_BUF(stride * FAKE_ALIGN_H(height)) : stride * height;
+        for (uint32_t y = 0; y < height; y++)
+            memset(dst + y * stride, (y + sequence * 2) & 0xff, stride);
+        memset(dst + lumaSize, 0x80, dev->sizeimage - lumaSize);
+        break;
+    }
+    }
+}
+
+/*
+ * Snapshot stream of the back sensor: a JPEG with postview lines woven in.
+ * The JPEG payload never contains 0xFF, so the only markers a demuxer can
+ * see are SOI, EOI and the framing written here. Returns the JPEG size.
+ */
+int32_t SecCameraFakeFimc::fillInterleaved(Device *dev, uint8_t *dst, uint32_t sequence)
+{
+    const bool lsi = !strncmp(mSensorName, "S5K4ECGX", 8);
+    const uint32_t total = SecCamera::getInterleaveDataSize();
+    const uint32_t jpegLine = SecCamera::getJpegLineLength();
+    const uint32_t pvWidth = dev->previewWidth == 1024 ?
+                             BACK_CAMERA_POSTVIEW_WIDE_WIDTH : BACK_CAMERA_POSTVIEW_WIDTH;
+    const uint32_t pvHeight = BACK_CAMERA_POSTVIEW_HEIGHT;
+    const uint32_t pvLine = pvWidth * 2;
+
+    /* each postview line costs 4 bytes of framing on either sensor */
+    uint32_t jpegSize = dev->width * dev->height / 4;
+    uint32_t minJpeg = (pvHeight + 1) * jpegLine + 4;
+    uint32_t maxJpeg = total - pvHeight * (pvLine + 4);
+    if (jpegSize < minJpeg)
+        jpegSize = minJpeg;
+    if (jpegSize > maxJpeg)
+        jpegSize = maxJpeg;
+    jpegSize &= ~3;
+
+    uint8_t *p = dst;
+    uint32_t written = 0;
+    uint32_t line = 0;
+
+    /* JPEG bytes are generated on the fly: SOI, payload, EOI */
+#define FAKE_JPEG_BYTE(i) \
+    ((i) == 0 ? 0xFF : (i) == 1 ? 0xD8 : \
+     (i) == jpegSize - 2 ? 0xFF : (i) == jpegSize - 1 ? 0xD9 : \
+     (uint8_t)(((i) * 7 + sequence) % 0xFF))
+
+    if (lsi) {
+        /* [JPEG chunk][FFBE FFBF + postview line] ... remaining JPEG */
+        while (written < jpegSize) {
+            uint32_t n = jpegSize - written < jpegLine ? jpegSize - written : jpegLine;
+            for (uint32_t i = 0; i < n; i++)
+                *p++ = FAKE_JPEG_BYTE(written + i);
+            written += n;
+
+            if (line < pvHeight && n == jpegLine) {
+                *p++ = 0xFF; *p++ = 0xBE; *p++ = 0xFF; *p++ = 0xBF;
+                for (uint32_t x = 0; x < pvLine; x += 2) {
+                    *p++ = (line + sequence * 2) & 0xff;
+                    *p++ = 0x80;
+                }
+                line++;
+            }
+        }
+        memset(p, 0, dst + total - p);
+    } else {
+        /* word aligned: FF 05 + postview line + FF 06 between JPEG words,
+         * 0xFFFFFFFF padding to the end */
+        uint32_t wordsPerLine = (jpegSize / 4) / (pvHeight + 1);
+        while (written < jpegSize) {
+            uint32_t n = jpegSize - written < wordsPerLine * 4 ?
+                         jpegSize - written : wordsPerLine * 4;
+            for (uint32_t i = 0; i < n; i++)
+                *p++ = FAKE_JPEG_BYTE(written + i);
+            written += n;
+
+            if (line < pvHeight) {
+                *p++ = 0xFF; *p++ = 0x05;
+                for (uint32_t x = 0; x < pvLine; x += 2) {
+                    *p++ = (line + sequence * 2) & 0xff;
+                    *p++ = 0x80;
+                }
+                *p++ = 0xFF; *p++ = 0x06;
+                line++;
+            }
+        }
+        memset(p, 0xFF, dst + total - p);
+    }
+
+#undef FAKE_JPEG_BYTE
+
+    return jpegSize;
+}
+
+}; // namespace android
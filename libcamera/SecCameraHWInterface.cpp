@@ -22,9 +22,14 @@
 
 #include "SecCameraHWInterface.h"
 #include "SecCameraUtils.h"
+#include "SecCameraImage.h"
+#include "SecCameraJpeg.h"
 
 #include <utils/threads.h>
+#include <cutils/properties.h>
 #include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
 #include <sys/mman.h>
 #include <camera/Camera.h>
 #include <MetadataBufferType.h>
@@ -78,6 +83,8 @@ gralloc_module_t const* CameraHardwareSec::mGrallocHal;
 CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
         :
           mCaptureInProgress(false),
+          mCaptureStart(0),
+          mBurstCount(1),
           mParameters(),
           mCameraSensorName(NULL),
           mSkipFrame(0),
@@ -96,10 +103,18 @@ CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
     int ret = 0;
 
     mPreviewWindow = NULL;
+    mPreviewZeroCopy = false;
+    mPreviewDirect = false;
+    mPreviewBuffersOwed = 0;
+    mPreviewDirectWindow = NULL;
+    memset(mPreviewBuffers, 0, sizeof(mPreviewBuffers));
     mSecCamera = SecCamera::createInstance();
 
     mRawHeap = NULL;
     mPreviewHeap = NULL;
+    mPreviewCbHeap = NULL;
+    memset((void *)mPreviewCbBusy, 0, sizeof(mPreviewCbBusy));
+    mPreviewCbNext = 0;
     mRecordHeap = NULL;
 
     if (!mGrallocHal) {
@@ -117,18 +132,75 @@ CameraHardwareSec::CameraHardwareSec(int cameraId, camera_device_t *dev)
     ALOGV("mPostViewWidth = %d mPostViewHeight = %d mPostViewSize = %d",
             mPostViewWidth,mPostViewHeight,mPostViewSize);
 
+    mParamCalls = 0;
+    mParamUnchanged = 0;
+    mParamIoctls = 0;
+    mFlat = NULL;
+    mParamGeneration = 0;
+    mFlatServed = 0;
     initDefaultParameters(cameraId);
 
     mExitAutoFocusThread = false;
+    mFocusRequested = false;
     mExitPreviewThread = false;
     /* whether the PreviewThread is active in preview or stopped.  we
      * create the thread but it is initially in stopped state.
      */
     mPreviewRunning = false;
     mPreviewStartDeferred = false;
+    mPreviewCaptured = 0;
+    mPreviewSkipped = 0;
+    for (int id = 0; id < PREVIEW_STAGE_COUNT; id++) {
+        PreviewStage &stage = mPreviewStages[id];
+        stage.busy = false;
+        stage.flush = false;
+        stage.exit = false;
+        stage.queued = 0;
+        stage.delivered = 0;
+        stage.dropped = 0;
+    }
+    /* the display only wants the newest frame, the client every frame it can take */
+    mPreviewStages[PREVIEW_STAGE_DISPLAY].dropPolicy = PREVIEW_DROP_OLDEST;
+    mPreviewStages[PREVIEW_STAGE_DISPLAY].thread =
+        new PreviewStageThread(this, PREVIEW_STAGE_DISPLAY,
+                               "CameraPreviewDisplayThread", PRIORITY_URGENT_DISPLAY);
+    mPreviewStages[PREVIEW_STAGE_CALLBACK].dropPolicy = PREVIEW_DROP_NEWEST;
+    mPreviewStages[PREVIEW_STAGE_CALLBACK].thread =
+        new PreviewStageThread(this, PREVIEW_STAGE_CALLBACK,
+                               "CameraPreviewCallbackThread", PRIORITY_DEFAULT);
+    /* the encoder wants every frame in order unless told otherwise */
+    char value[PROPERTY_VALUE_MAX];
+    property_get("camera.record.drop", value, "newest");
+    mPreviewStages[PREVIEW_STAGE_RECORD].dropPolicy =
+        strcmp(value, "oldest") ? PREVIEW_DROP_NEWEST : PREVIEW_DROP_OLDEST;
+    mPreviewStages[PREVIEW_STAGE_RECORD].thread =
+        new PreviewStageThread(this, PREVIEW_STAGE_RECORD,
+                               "CameraRecordThread", PRIORITY_DEFAULT);
+    for (int i = 0; i < kBufferCountForRecord; i++)
+        mRecordHeld[i] = 0;
+    mRecordInFlight = 0;
+    mRecordInFlightPeak = 0;
+    mRecordStrayReleases = 0;
+    mRecordLastTimestamp = 0;
+    mRecordIntervals = 0;
+    mRecordIntervalMean = 0;
+    mRecordIntervalM2 = 0;
+    mRecordIntervalMax = 0;
     mPreviewThread = new PreviewThread(this);
     mAutoFocusThread = new AutoFocusThread(this);
     mPictureThread = new PictureThread(this);
+    mExifThread = new ExifThread(this);
+    mExifPostview = NULL;
+    mExifDst = NULL;
+    mExifSize = -1;
+    mBurstHead = 0;
+    mBurstQueued = 0;
+    mBurstInFlight = 0;
+    mBurstError = NO_ERROR;
+    mBurstDone = false;
+    mBurstShots = 0;
+    mBurstDelivered = 0;
+    mBurstElapsed = 0;
 }
 
 int CameraHardwareSec::getCameraId() const
@@ -342,6 +414,11 @@ void CameraHardwareSec::initDefaultParameters(int cameraId)
     p.set(CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION, "-4");
     p.set(CameraParameters::KEY_EXPOSURE_COMPENSATION_STEP, "0.5");
 
+    if (cameraId == SecCamera::CAMERA_ID_BACK) {
+        p.set("burst-count", 1);
+        p.set("max-burst-count", kBurstCountMax);
+    }
+
     mParameters = p;
     mInternalParameters = ip;
 
@@ -365,6 +442,12 @@ CameraHardwareSec::~CameraHardwareSec()
 {
     ALOGV("%s", __func__);
     mSecCamera->DeinitCamera();
+
+    mFlatLock.lock();
+    if (mFlat)
+        putFlattenedParameters(mFlat->str);
+    mFlat = NULL;
+    mFlatLock.unlock();
 }
 
 status_t CameraHardwareSec::setPreviewWindow(preview_stream_ops *w)
@@ -410,7 +493,18 @@ status_t CameraHardwareSec::setPreviewWindow(preview_stream_ops *w)
     const char *str_preview_format = mParameters.getPreviewFormat();
     ALOGV("%s: preview format %s", __func__, str_preview_format);
 
-    if (w->set_usage(w, GRALLOC_USAGE_SW_WRITE_OFTEN)) {
+    /* zero-copy preview lets FIMC write into the window buffers, the
+     * copy path stays available as a fallback so keep SW write usage.
+     */
+    char value[PROPERTY_VALUE_MAX];
+    property_get("camera.preview.zerocopy", value, "0");
+    mPreviewZeroCopy = atoi(value) != 0;
+
+    int usage = GRALLOC_USAGE_SW_WRITE_OFTEN;
+    if (mPreviewZeroCopy)
+        usage |= GRALLOC_USAGE_HW_CAMERA_WRITE | GRALLOC_USAGE_SW_READ_OFTEN;
+
+    if (w->set_usage(w, usage)) {
         ALOGE("%s: could not set usage on gralloc buffer", __func__);
         return INVALID_OPERATION;
     }
@@ -488,6 +582,7 @@ int CameraHardwareSec::previewThreadWrapper()
         mPreviewLock.lock();
         while (!mPreviewRunning) {
             ALOGI("%s: calling mSecCamera->stopPreview() and waiting", __func__);
+            flushPreviewStages();
             mSecCamera->stopPreview();
             /* signal that we're stopping */
             mPreviewStoppedCondition.signal();
@@ -498,6 +593,7 @@ int CameraHardwareSec::previewThreadWrapper()
 
         if (mExitPreviewThread) {
             ALOGI("%s: exiting", __func__);
+            flushPreviewStages();
             mSecCamera->stopPreview();
             return 0;
         }
@@ -505,15 +601,220 @@ int CameraHardwareSec::previewThreadWrapper()
     }
 }
 
+void CameraHardwareSec::queuePreviewFrame(int id, SecPreviewFrame frame, int owner)
+{
+    PreviewStage &stage = mPreviewStages[id];
+
+    frame.owner = owner;
+    if (owner)
+        mSecCamera->acquirePreviewFrame(frame.index, owner);
+
+    if (!stage.queue.push(frame)) {
+        dropPreviewFrame(id, frame);
+        return;
+    }
+    android_atomic_inc(&stage.queued);
+
+    /* the ring itself is lock free, the lock only orders the wakeup */
+    stage.lock.lock();
+    stage.cond.signal();
+    stage.lock.unlock();
+}
+
+void CameraHardwareSec::dropPreviewFrame(int id, const SecPreviewFrame &frame)
+{
+    android_atomic_inc(&mPreviewStages[id].dropped);
+
+    if (id == PREVIEW_STAGE_RECORD)
+        mSecCamera->releaseRecordFrame(frame.index);
+    else if (frame.owner)
+        mSecCamera->releasePreviewFrame(frame.index, frame.owner);
+    releasePreviewCbSlot(frame.cbSlot);
+}
+
+void CameraHardwareSec::flushPreviewStage(int id)
+{
+    PreviewStage &stage = mPreviewStages[id];
+
+    stage.lock.lock();
+    stage.flush = true;
+    stage.cond.signal();
+    while (stage.busy || !stage.queue.empty())
+        stage.idleCond.wait(stage.lock);
+    stage.flush = false;
+    stage.lock.unlock();
+}
+
+void CameraHardwareSec::flushPreviewStages()
+{
+    for (int id = 0; id < PREVIEW_STAGE_COUNT; id++)
+        flushPreviewStage(id);
+}
+
+int CameraHardwareSec::previewStageThread(int id)
+{
+    PreviewStage &stage = mPreviewStages[id];
+    SecPreviewFrame frame, newer;
+
+    stage.lock.lock();
+    while (!stage.exit) {
+        if (stage.queue.empty()) {
+            stage.idleCond.broadcast();
+            stage.cond.wait(stage.lock);
+            continue;
+        }
+
+        bool flush = stage.flush;
+        stage.busy = true;
+        stage.lock.unlock();
+
+        stage.queue.pop(&frame);
+
+        /* a stage that only cares about the latest frame skips the rest */
+        if (stage.dropPolicy == PREVIEW_DROP_OLDEST) {
+            while (stage.queue.pop(&newer)) {
+                dropPreviewFrame(id, frame);
+                frame = newer;
+            }
+        }
+
+        if (flush) {
+            dropPreviewFrame(id, frame);
+        } else {
+            if (id == PREVIEW_STAGE_DISPLAY)
+                displayPreviewFrame(frame);
+            else if (id == PREVIEW_STAGE_RECORD)
+                deliverRecordFrame(frame);
+            else
+                deliverPreviewFrame(frame);
+            android_atomic_inc(&stage.delivered);
+        }
+
+        stage.lock.lock();
+        stage.busy = false;
+    }
+    stage.lock.unlock();
+
+    return 0;
+}
+
+void CameraHardwareSec::displayPreviewFrame(const SecPreviewFrame &frame)
+{
+    SecTraceScope trace(&mTrace, SEC_TRACE_PREVIEW_DISPLAY);
+    int width, height, frame_size;
+
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+
+    if (mPreviewDirect) {
+        /* the window buffer is the frame, take the client's copy before
+         * the display owns it again.
+         */
+        if (frame.callback) {
+            SecPreviewFrame copy = frame;
+            copy.cbSlot = acquirePreviewCbSlot();
+            if (copy.cbSlot >= 0 &&
+                    convertPreviewFrame(copy.cbSlot, mPreviewBuffers[frame.index].vaddr, true))
+                queuePreviewFrame(PREVIEW_STAGE_CALLBACK, copy, 0);
+            else
+                dropPreviewFrame(PREVIEW_STAGE_CALLBACK, copy);
+        }
+        /* DISPLAY is dropped once the window hands the buffer back */
+        displayPreviewWindowBuffer(frame.index);
+        return;
+    }
+
+    if (!mPreviewWindow || !mGrallocHal) {
+        mSecCamera->releasePreviewFrame(frame.index, frame.owner);
+        return;
+    }
+
+    buffer_handle_t *buf_handle;
+    int stride;
+    if (0 != mPreviewWindow->dequeue_buffer(mPreviewWindow, &buf_handle, &stride)) {
+        ALOGE("Could not dequeue gralloc buffer!\n");
+        mSecCamera->releasePreviewFrame(frame.index, frame.owner);
+        return;
+    }
+
+    void *vaddr;
+    if (!mGrallocHal->lock(mGrallocHal,
+                           *buf_handle,
+                           GRALLOC_USAGE_SW_WRITE_OFTEN,
+                           0, 0, width, height, &vaddr)) {
+        char *src = ((char *)mPreviewHeap->data) + frame_size * frame.index;
+
+        // the code below assumes YUV, not RGB
+        secCopyYuv420ToYv12(src, vaddr, width, height, stride);
+
+        mGrallocHal->unlock(mGrallocHal, *buf_handle);
+    }
+    else
+        ALOGE("%s: could not obtain gralloc buffer", __func__);
+
+    mSecCamera->releasePreviewFrame(frame.index, frame.owner);
+
+    if (0 != mPreviewWindow->enqueue_buffer(mPreviewWindow, buf_handle))
+        ALOGE("Could not enqueue gralloc buffer!\n");
+}
+
+void CameraHardwareSec::deliverPreviewFrame(const SecPreviewFrame &frame)
+{
+    camera_memory_t *heap = mPreviewHeap;
+    int owner = frame.owner;
+    int index = frame.index;
+    int slot = frame.cbSlot;
+
+    if (mPreviewDirect) {
+        heap = mPreviewCbHeap;
+        index = slot;
+    } else if (!strcmp(mParameters.getPreviewFormat(),
+                       CameraParameters::PIXEL_FORMAT_YUV420SP)) {
+        int width, height, frame_size;
+        mSecCamera->getPreviewSize(&width, &height, &frame_size);
+
+        // Color conversion from YUV420 to NV21, the driver frame is left alone
+        slot = acquirePreviewCbSlot();
+        heap = NULL;
+        if (slot >= 0 && convertPreviewFrame(slot,
+                ((char *)mPreviewHeap->data) + frame_size * frame.index, false))
+            heap = mPreviewCbHeap;
+        index = slot;
+
+        /* the client only sees the converted copy */
+        if (owner)
+            mSecCamera->releasePreviewFrame(frame.index, owner);
+        owner = 0;
+    }
+
+    // Notify the client of a new frame.
+    if (heap && (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME)) {
+        SecTraceScope trace(&mTrace, SEC_TRACE_PREVIEW_CALLBACK);
+        mDataCb(CAMERA_MSG_PREVIEW_FRAME, heap, index, NULL, mCallbackCookie);
+    }
+
+    if (owner)
+        mSecCamera->releasePreviewFrame(frame.index, owner);
+    releasePreviewCbSlot(slot);
+}
+
 int CameraHardwareSec::previewThread()
 {
     int index;
     nsecs_t timestamp;
     unsigned int phyYAddr;
     unsigned int phyCAddr;
-    struct addrs *addrs;
 
-    index = mSecCamera->getPreview();
+    index = mSecCamera->getPreview(&timestamp);
+    if (index == SecCamera::PREVIEW_STALLED) {
+        /* nothing may queue a frame back while the stream restarts */
+        flushPreviewStage(PREVIEW_STAGE_DISPLAY);
+        flushPreviewStage(PREVIEW_STAGE_CALLBACK);
+        if (mSecCamera->resetPreview() < 0) {
+            ALOGE("ERR(%s):Fail on SecCamera->resetPreview()", __func__);
+            return UNKNOWN_ERROR;
+        }
+        return NO_ERROR;
+    }
     if (index < 0) {
         ALOGE("ERR(%s):Fail on SecCamera->getPreview()", __func__);
         return UNKNOWN_ERROR;
@@ -526,142 +827,209 @@ int CameraHardwareSec::previewThread()
         mSkipFrame--;
         mSkipFrameLock.unlock();
         ALOGV("%s: index %d skipping frame", __func__, index);
+        android_atomic_inc(&mPreviewSkipped);
+        mSecCamera->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL);
         return NO_ERROR;
     }
     mSkipFrameLock.unlock();
 
-    timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+    android_atomic_inc(&mPreviewCaptured);
+
+    if (!mPreviewDirect) {
+        phyYAddr = mSecCamera->getPhyAddrY(index);
+        phyCAddr = mSecCamera->getPhyAddrC(index);
+
+        if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
+            ALOGE("ERR(%s):Fail on SecCamera getPhyAddr Y addr = %0x C addr = %0x",
+                 __func__, phyYAddr, phyCAddr);
+            mSecCamera->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL);
+            return UNKNOWN_ERROR;
+        }
+    }
 
-    phyYAddr = mSecCamera->getPhyAddrY(index);
-    phyCAddr = mSecCamera->getPhyAddrC(index);
+    SecPreviewFrame frame;
+    frame.index = index;
+    frame.timestamp = timestamp;
+    frame.callback = mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME;
+    frame.cbSlot = -1;
+
+    /* in zero-copy mode the display stage owns the buffer, so it takes
+     * the client's copy and passes the frame on to the callback stage.
+     */
+    if (mPreviewDirect || (mPreviewWindow && mGrallocHal))
+        queuePreviewFrame(PREVIEW_STAGE_DISPLAY, frame, SecCamera::PREVIEW_OWNER_DISPLAY);
+    if (frame.callback && !mPreviewDirect)
+        queuePreviewFrame(PREVIEW_STAGE_CALLBACK, frame, SecCamera::PREVIEW_OWNER_CLIENT);
+
+    /* the stages hold the buffer now, FIMC gets it back after the last one */
+    mSecCamera->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL);
+
+    Mutex::Autolock lock(mRecordLock);
+    if (mRecordRunning == true)
+        queueRecordFrame();
+
+    return NO_ERROR;
+}
+
+/*
+ * Dequeue the record frame that goes with the current preview frame and
+ * hand it to the record dispatch thread; called with mRecordLock held so
+ * it cannot race stopRecording(). The encoder callback itself never runs
+ * here, a slow encoder only costs it record frames.
+ */
+void CameraHardwareSec::queueRecordFrame()
+{
+    PreviewStage &stage = mPreviewStages[PREVIEW_STAGE_RECORD];
+    unsigned int phyYAddr;
+    unsigned int phyCAddr;
+    struct addrs *addrs;
+    nsecs_t timestamp;
+    int index;
+
+    /* the encoder PTS is the capture time of the record buffer itself */
+    index = mSecCamera->getRecordFrame(&timestamp);
+    if (index < 0) {
+        ALOGE("ERR(%s):Fail on SecCamera->getRecord()", __func__);
+        return;
+    }
+
+    phyYAddr = mSecCamera->getRecPhyAddrY(index);
+    phyCAddr = mSecCamera->getRecPhyAddrC(index);
 
     if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
-        ALOGE("ERR(%s):Fail on SecCamera getPhyAddr Y addr = %0x C addr = %0x",
-             __func__, phyYAddr, phyCAddr);
-        return UNKNOWN_ERROR;
-     }
+        ALOGE("ERR(%s):Fail on SecCamera getRectPhyAddr Y addr = %0x C addr = %0x", __func__,
+             phyYAddr, phyCAddr);
+        mSecCamera->releaseRecordFrame(index);
+        return;
+    }
 
-    int width, height, frame_size, offset;
+    if (!(mMsgEnabled & CAMERA_MSG_VIDEO_FRAME)) {
+        mSecCamera->releaseRecordFrame(index);
+        return;
+    }
 
-    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+    /* FIMC owns the slot until now, the encoder cannot be reading it */
+    addrs = (struct addrs *)mRecordHeap->data;
 
-    offset = frame_size * index;
+    addrs[index].type   = kMetadataBufferTypeCameraSource;
+    addrs[index].addr_y = phyYAddr;
+    addrs[index].addr_cbcr = phyCAddr;
+    addrs[index].buf_index = index;
 
-    if (mPreviewWindow && mGrallocHal) {
-        buffer_handle_t *buf_handle;
-        int stride;
-        if (0 != mPreviewWindow->dequeue_buffer(mPreviewWindow, &buf_handle, &stride)) {
-            ALOGE("Could not dequeue gralloc buffer!\n");
-            goto callbacks;
-        }
-
-        void *vaddr;
-        if (!mGrallocHal->lock(mGrallocHal,
-                               *buf_handle,
-                               GRALLOC_USAGE_SW_WRITE_OFTEN,
-                               0, 0, width, height, &vaddr)) {
-            char *frame = ((char *)mPreviewHeap->data) + offset;
-
-            // the code below assumes YUV, not RGB
-            {
-                int h;
-                char *src = frame;
-                char *ptr = (char *)vaddr;
-
-                // Copy the Y plane, while observing the stride
-                for (h = 0; h < height; h++) {
-                    memcpy(ptr, src, width);
-                    ptr += stride;
-                    src += width;
-                }
+    SecPreviewFrame frame;
+    frame.index = index;
+    frame.timestamp = timestamp;
+    frame.callback = true;
+    frame.owner = 0;
+    frame.cbSlot = -1;
 
-                {
-                    // U
-                    char *v = ptr;
-                    ptr += stride * height / 4;
-                    for (h = 0; h < height / 2; h++) {
-                        memcpy(ptr, src, width / 2);
-                        ptr += stride / 2;
-                        src += width / 2;
-                    }
-                    // V
-                    ptr = v;
-                    for (h = 0; h < height / 2; h++) {
-                        memcpy(ptr, src, width / 2);
-                        ptr += stride / 2;
-                        src += width / 2;
-                    }
-                }
-            }
+    /* backpressure: the newest frame goes back to FIMC rather than
+     * leaving the driver without buffers to capture into.
+     */
+    if (android_atomic_acquire_load(&mRecordInFlight) + stage.queue.size() >=
+            kRecordInFlightMax) {
+        dropPreviewFrame(PREVIEW_STAGE_RECORD, frame);
+        return;
+    }
 
-            mGrallocHal->unlock(mGrallocHal, *buf_handle);
-        }
-        else
-            ALOGE("%s: could not obtain gralloc buffer", __func__);
+    queuePreviewFrame(PREVIEW_STAGE_RECORD, frame, 0);
+}
 
-        if (0 != mPreviewWindow->enqueue_buffer(mPreviewWindow, buf_handle)) {
-            ALOGE("Could not enqueue gralloc buffer!\n");
-            goto callbacks;
-        }
+void CameraHardwareSec::deliverRecordFrame(const SecPreviewFrame &frame)
+{
+    if (!(mMsgEnabled & CAMERA_MSG_VIDEO_FRAME)) {
+        mSecCamera->releaseRecordFrame(frame.index);
+        return;
     }
 
-callbacks:
-    // Notify the client of a new frame.
-    if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
-        const char * preview_format = mParameters.getPreviewFormat();
-        if (!strcmp(preview_format, CameraParameters::PIXEL_FORMAT_YUV420SP)) {
-            // Color conversion from YUV420 to NV21
-            char *vu = ((char *)mPreviewHeap->data) + offset + width * height;
-            const int uv_size = (width * height) >> 1;
-            char saved_uv[uv_size];
-            memcpy(saved_uv, vu, uv_size);
-            char *u = saved_uv;
-            char *v = u + (uv_size >> 1);
-
-            int h = 0;
-            while (h < width * height / 4) {
-                *vu++ = *v++;
-                *vu++ = *u++;
-                ++h;
-            }
-        }
-        mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, index, NULL, mCallbackCookie);
+    if (mRecordLastTimestamp) {
+        /* Welford's running mean and variance of the frame interval */
+        nsecs_t interval = frame.timestamp - mRecordLastTimestamp;
+        double delta = interval - mRecordIntervalMean;
+        mRecordIntervals++;
+        mRecordIntervalMean += delta / mRecordIntervals;
+        mRecordIntervalM2 += delta * (interval - mRecordIntervalMean);
+        if (interval > mRecordIntervalMax)
+            mRecordIntervalMax = interval;
     }
+    mRecordLastTimestamp = frame.timestamp;
 
-    Mutex::Autolock lock(mRecordLock);
-    if (mRecordRunning == true) {
-        index = mSecCamera->getRecordFrame();
-        if (index < 0) {
-            ALOGE("ERR(%s):Fail on SecCamera->getRecord()", __func__);
-            return UNKNOWN_ERROR;
-        }
+    /* the encoder may release the buffer before the callback returns */
+    android_atomic_release_store(1, &mRecordHeld[frame.index]);
+    int32_t held = android_atomic_inc(&mRecordInFlight) + 1;
+    if (held > mRecordInFlightPeak)
+        android_atomic_release_store(held, &mRecordInFlightPeak);
 
-        phyYAddr = mSecCamera->getRecPhyAddrY(index);
-        phyCAddr = mSecCamera->getRecPhyAddrC(index);
+    SecTraceScope trace(&mTrace, SEC_TRACE_RECORD_CALLBACK);
+    mDataCbTimestamp(frame.timestamp, CAMERA_MSG_VIDEO_FRAME,
+                     mRecordHeap, frame.index, mCallbackCookie);
+}
 
-        if (phyYAddr == 0xffffffff || phyCAddr == 0xffffffff) {
-            ALOGE("ERR(%s):Fail on SecCamera getRectPhyAddr Y addr = %0x C addr = %0x", __func__,
-                 phyYAddr, phyCAddr);
-            return UNKNOWN_ERROR;
+/*
+ * A free mPreviewCbHeap slot, -1 when the callback stage still holds them
+ * all. Only ever called from one stage at a time: the display stage in
+ * zero-copy mode, the callback stage otherwise.
+ */
+int CameraHardwareSec::acquirePreviewCbSlot(void)
+{
+    for (int i = 0; i < kBufferCount; i++) {
+        int slot = (mPreviewCbNext + i) % kBufferCount;
+        if (!android_atomic_acquire_load(&mPreviewCbBusy[slot])) {
+            android_atomic_release_store(1, &mPreviewCbBusy[slot]);
+            mPreviewCbNext = (slot + 1) % kBufferCount;
+            return slot;
         }
+    }
+    return -1;
+}
+
+void CameraHardwareSec::releasePreviewCbSlot(int slot)
+{
+    if (slot >= 0)
+        android_atomic_release_store(0, &mPreviewCbBusy[slot]);
+}
 
-        addrs = (struct addrs *)mRecordHeap->data;
+/* the client's copy of a frame in mPreviewCbHeap slot slot */
+bool CameraHardwareSec::convertPreviewFrame(int slot, const void *frame, bool yv12)
+{
+    int width, height, frame_size;
 
-        addrs[index].type   = kMetadataBufferTypeCameraSource;
-        addrs[index].addr_y = phyYAddr;
-        addrs[index].addr_cbcr = phyCAddr;
-        addrs[index].buf_index = index;
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
 
-        // Notify the client of a new frame.
-        if (mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-            mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME,
-                             mRecordHeap, index, mCallbackCookie);
-        } else {
-            mSecCamera->releaseRecordFrame(index);
+    /* one slot per driver buffer, allocated once per preview session */
+    if (!mPreviewCbHeap) {
+        mPreviewCbHeap = mGetMemoryCb(-1, frame_size, kBufferCount, 0);
+        if (!mPreviewCbHeap || !mPreviewCbHeap->data) {
+            ALOGE("ERR(%s):Fail on allocating preview callback heap", __func__);
+            if (mPreviewCbHeap) {
+                mPreviewCbHeap->release(mPreviewCbHeap);
+                mPreviewCbHeap = NULL;
+            }
+            return false;
         }
     }
 
-    return NO_ERROR;
+    SecTraceScope trace(&mTrace, SEC_TRACE_PREVIEW_CONVERT);
+    char *dst = ((char *)mPreviewCbHeap->data) + frame_size * slot;
+    const char *y = (const char *)frame;
+    const int c_size = (width / 2) * (height / 2);
+    const char *u, *v;
+
+    if (yv12) {
+        v = y + width * height;
+        u = v + c_size;
+    } else {
+        u = y + width * height;
+        v = u + c_size;
+    }
+
+    if (!strcmp(mParameters.getPreviewFormat(), CameraParameters::PIXEL_FORMAT_YUV420SP))
+        secConvertPlanarToNv21(y, u, v, width, width / 2, dst, width, height);
+    else if (yv12)
+        secCopyYv12ToYuv420(frame, dst, width, height, width);
+    else
+        memcpy(dst, frame, frame_size);
+    return true;
 }
 
 status_t CameraHardwareSec::startPreview()
@@ -704,9 +1072,23 @@ status_t CameraHardwareSec::startPreviewInternal()
 {
     ALOGV("%s", __func__);
 
+    int width, height, frame_size;
+
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+
+    mPreviewDirect = false;
+    if (mPreviewZeroCopy && mPreviewWindow && mGrallocHal)
+        mPreviewDirect = initPreviewWindowBuffers(width, height, frame_size);
+
     int ret  = mSecCamera->startPreview();
     ALOGV("%s : mSecCamera->startPreview() returned %d", __func__, ret);
 
+    if (ret < 0 && mPreviewDirect) {
+        ALOGW("%s: zero-copy preview not supported, falling back to copy", __func__);
+        releasePreviewWindowBuffers();
+        ret = mSecCamera->startPreview();
+    }
+
     if (ret < 0) {
         ALOGE("ERR(%s):Fail on mSecCamera->startPreview()", __func__);
         return UNKNOWN_ERROR;
@@ -714,21 +1096,31 @@ status_t CameraHardwareSec::startPreviewInternal()
 
     setSkipFrame(INITIAL_SKIP_FRAME);
 
-    int width, height, frame_size;
-
-    mSecCamera->getPreviewSize(&width, &height, &frame_size);
-
-    ALOGD("mPreviewHeap(fd(%d), size(%d), width(%d), height(%d))",
-         mSecCamera->getCameraFd(), frame_size, width, height);
-    if (mPreviewHeap) {
+    ALOGD("mPreviewHeap(fd(%d), size(%d), width(%d), height(%d), direct(%d))",
+         mSecCamera->getCameraFd(), frame_size, width, height, mPreviewDirect);
+    /* a warm start kept the driver buffers, and so the mapping of them */
+    bool keepHeap = mPreviewHeap && !mPreviewDirect && mSecCamera->isPreviewWarmStart() &&
+                    mPreviewHeap->size == (size_t)frame_size * kBufferCount;
+    if (mPreviewHeap && !keepHeap) {
         mPreviewHeap->release(mPreviewHeap);
         mPreviewHeap = 0;
     }
+    if (mPreviewCbHeap) {
+        mPreviewCbHeap->release(mPreviewCbHeap);
+        mPreviewCbHeap = 0;
+    }
+    /* the stages are flushed, no slot is queued anywhere */
+    memset((void *)mPreviewCbBusy, 0, sizeof(mPreviewCbBusy));
+    mPreviewCbNext = 0;
 
-    mPreviewHeap = mGetMemoryCb((int)mSecCamera->getCameraFd(),
-                                frame_size,
-                                kBufferCount,
-                                0); // no cookie
+    /* in zero-copy mode the driver buffers belong to the window and
+     * callbacks are served from mPreviewCbHeap alone.
+     */
+    if (!mPreviewDirect && !mPreviewHeap)
+        mPreviewHeap = mGetMemoryCb((int)mSecCamera->getCameraFd(),
+                                    frame_size,
+                                    kBufferCount,
+                                    0); // no cookie
 
     mSecCamera->getPostViewConfig(&mPostViewWidth, &mPostViewHeight, &mPostViewSize);
     ALOGV("CameraHardwareSec: mPostViewWidth = %d mPostViewHeight = %d mPostViewSize = %d",
@@ -748,6 +1140,8 @@ void CameraHardwareSec::stopPreviewInternal()
             mPreviewCondition.signal();
             /* wait until preview thread is stopped */
             mPreviewStoppedCondition.wait(mPreviewLock);
+            if (mPreviewDirect)
+                releasePreviewWindowBuffers();
         }
         else
             ALOGV("%s : preview running but deferred, doing nothing", __func__);
@@ -755,6 +1149,222 @@ void CameraHardwareSec::stopPreviewInternal()
         ALOGI("%s : preview not running, doing nothing", __func__);
 }
 
+int CameraHardwareSec::importPreviewWindowBuffer(buffer_handle_t *handle, int stride,
+                                                 int width, int height, int frame_size)
+{
+    int index;
+
+    /* FIMC writes packed planes, a padded window buffer can't take them.
+     * YV12 pads the chroma stride to ALIGN(stride / 2, 16) as well.
+     */
+    if (stride != width || (width / 2) % 16) {
+        ALOGW("%s: window stride %d does not match width %d", __func__, stride, width);
+        return -1;
+    }
+    /* the buffer was dequeued for width x height, the frame must fit it */
+    if ((height & 1) || frame_size > stride * height * 3 / 2) {
+        ALOGW("%s: %d byte frame does not fit a %dx%d window buffer",
+              __func__, frame_size, stride, height);
+        return -1;
+    }
+
+    for (index = 0; index < kBufferCount; index++) {
+        if (!mPreviewBuffers[index].handle)
+            break;
+    }
+    if (index == kBufferCount) {
+        ALOGE("ERR(%s):no free preview slot", __func__);
+        return -1;
+    }
+
+    mPreviewBuffers[index].handle = handle;
+    mPreviewBuffers[index].vaddr = NULL;
+    mPreviewBuffers[index].inWindow = false;
+    mPreviewBuffers[index].locked = false;
+
+    /* held by the HAL, the caller hands it to FIMC with releasePreviewFrame() */
+    if (lockPreviewWindowBuffer(index, frame_size) < 0) {
+        memset(&mPreviewBuffers[index], 0, sizeof(mPreviewBuffers[index]));
+        return -1;
+    }
+
+    return index;
+}
+
+/*
+ * A window buffer stays locked for as long as FIMC or the HAL owns it, the
+ * mapping is only guaranteed between lock and unlock. Returns 1 when the
+ * buffer came back at another address and was registered again, in which
+ * case it is held by the HAL like a freshly imported one.
+ */
+int CameraHardwareSec::lockPreviewWindowBuffer(int index, int frame_size)
+{
+    PreviewBuffer *buf = &mPreviewBuffers[index];
+    int width, height, size;
+    void *vaddr;
+
+    mSecCamera->getPreviewSize(&width, &height, &size);
+    if (mGrallocHal->lock(mGrallocHal, *buf->handle,
+                          GRALLOC_USAGE_HW_CAMERA_WRITE | GRALLOC_USAGE_SW_READ_OFTEN,
+                          0, 0, width, height, &vaddr)) {
+        ALOGE("ERR(%s):could not lock gralloc buffer", __func__);
+        return -1;
+    }
+    buf->locked = true;
+
+    if (vaddr == buf->vaddr)
+        return 0;
+
+    if (mSecCamera->setPreviewUserBuffer(index, vaddr, frame_size) < 0) {
+        unlockPreviewWindowBuffer(index);
+        return -1;
+    }
+    buf->vaddr = vaddr;
+    return 1;
+}
+
+void CameraHardwareSec::unlockPreviewWindowBuffer(int index)
+{
+    PreviewBuffer *buf = &mPreviewBuffers[index];
+
+    if (buf->locked) {
+        mGrallocHal->unlock(mGrallocHal, *buf->handle);
+        buf->locked = false;
+    }
+}
+
+bool CameraHardwareSec::initPreviewWindowBuffers(int width, int height, int frame_size)
+{
+    int min_bufs;
+    int count = 0;
+
+    if (mPreviewWindow->get_min_undequeued_buffer_count(mPreviewWindow, &min_bufs)) {
+        ALOGE("%s: could not retrieve min undequeued buffer count", __func__);
+        return false;
+    }
+
+    mPreviewDirectWindow = mPreviewWindow;
+    mPreviewBuffersOwed = 0;
+    memset(mPreviewBuffers, 0, sizeof(mPreviewBuffers));
+
+    for (int i = 0; i < kBufferCount - min_bufs; i++) {
+        buffer_handle_t *handle;
+        int stride;
+
+        if (mPreviewWindow->dequeue_buffer(mPreviewWindow, &handle, &stride)) {
+            ALOGE("%s: could not dequeue gralloc buffer", __func__);
+            break;
+        }
+
+        int index = importPreviewWindowBuffer(handle, stride, width, height, frame_size);
+        if (index < 0) {
+            mPreviewWindow->cancel_buffer(mPreviewWindow, handle);
+            count = 0;
+            break;
+        }
+        mSecCamera->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL);
+        count++;
+    }
+
+    /* streaming needs one buffer being filled and one being shown */
+    if (count < 2) {
+        releasePreviewWindowBuffers();
+        return false;
+    }
+
+    ALOGI("%s: %d window buffers imported", __func__, count);
+    return true;
+}
+
+void CameraHardwareSec::releasePreviewWindowBuffers()
+{
+    for (int i = 0; i < kBufferCount; i++) {
+        PreviewBuffer *buf = &mPreviewBuffers[i];
+        if (buf->handle && !buf->inWindow) {
+            unlockPreviewWindowBuffer(i);
+            mPreviewDirectWindow->cancel_buffer(mPreviewDirectWindow, buf->handle);
+        }
+    }
+
+    memset(mPreviewBuffers, 0, sizeof(mPreviewBuffers));
+    mPreviewBuffersOwed = 0;
+    mPreviewDirectWindow = NULL;
+    mPreviewDirect = false;
+    mSecCamera->clearPreviewUserBuffers();
+}
+
+void CameraHardwareSec::displayPreviewWindowBuffer(int index)
+{
+    preview_stream_ops *w = mPreviewDirectWindow;
+    int width, height, frame_size;
+
+    mSecCamera->getPreviewSize(&width, &height, &frame_size);
+
+    unlockPreviewWindowBuffer(index);
+    if (w->enqueue_buffer(w, mPreviewBuffers[index].handle)) {
+        ALOGE("Could not enqueue gralloc buffer!\n");
+        int owner = SecCamera::PREVIEW_OWNER_DISPLAY;
+        int ret = lockPreviewWindowBuffer(index, frame_size);
+        if (ret < 0) {
+            /* FIMC can't have it unmapped, the window gets it back */
+            w->cancel_buffer(w, mPreviewBuffers[index].handle);
+            mPreviewBuffers[index].inWindow = true;
+            return;
+        }
+        if (ret > 0)
+            owner = SecCamera::PREVIEW_OWNER_HAL;
+        mSecCamera->releasePreviewFrame(index, owner);
+        return;
+    }
+    mPreviewBuffers[index].inWindow = true;
+    mPreviewBuffersOwed++;
+
+    /* give FIMC back whatever the window has let go of. we never hold
+     * more than the window allows, so this only waits on the display.
+     */
+    while (mPreviewBuffersOwed > 0) {
+        buffer_handle_t *handle;
+        int stride;
+        int i;
+
+        if (w->dequeue_buffer(w, &handle, &stride)) {
+            ALOGE("Could not dequeue gralloc buffer!\n");
+            return;
+        }
+        mPreviewBuffersOwed--;
+
+        for (i = 0; i < kBufferCount; i++) {
+            if (mPreviewBuffers[i].handle &&
+                *mPreviewBuffers[i].handle == *handle)
+                break;
+        }
+
+        int owner = SecCamera::PREVIEW_OWNER_DISPLAY;
+
+        /* first time this buffer leaves the window */
+        if (i == kBufferCount) {
+            i = importPreviewWindowBuffer(handle, stride, width, height, frame_size);
+            if (i < 0) {
+                w->cancel_buffer(w, handle);
+                continue;
+            }
+            owner = SecCamera::PREVIEW_OWNER_HAL;
+        } else {
+            int ret = lockPreviewWindowBuffer(i, frame_size);
+            if (ret < 0) {
+                /* FIMC can't have it unmapped, the window keeps it */
+                w->cancel_buffer(w, handle);
+                continue;
+            }
+            if (ret > 0)
+                owner = SecCamera::PREVIEW_OWNER_HAL;
+        }
+
+        mPreviewBuffers[i].inWindow = false;
+        mSecCamera->releasePreviewFrame(i, owner);
+    }
+}
+
 void CameraHardwareSec::stopPreview()
 {
     ALOGV("%s :", __func__);
@@ -791,6 +1401,17 @@ status_t CameraHardwareSec::startRecording()
     }
 
     if (mRecordRunning == false) {
+        /* releases still outstanding from the last session are stray now */
+        for (int i = 0; i < kBufferCountForRecord; i++)
+            android_atomic_release_store(0, &mRecordHeld[i]);
+        android_atomic_release_store(0, &mRecordInFlight);
+        mRecordInFlightPeak = 0;
+        mRecordLastTimestamp = 0;
+        mRecordIntervals = 0;
+        mRecordIntervalMean = 0;
+        mRecordIntervalM2 = 0;
+        mRecordIntervalMax = 0;
+
         if (mSecCamera->startRecord() < 0) {
             ALOGE("ERR(%s):Fail on mSecCamera->startRecord()", __func__);
             return UNKNOWN_ERROR;
@@ -807,6 +1428,13 @@ void CameraHardwareSec::stopRecording()
     Mutex::Autolock lock(mRecordLock);
 
     if (mRecordRunning == true) {
+        /* queued frames go back to FIMC while it still takes them */
+        flushPreviewStage(PREVIEW_STAGE_RECORD);
+        if (mRecordIntervals > 1)
+            ALOGI("%s: %d frame intervals, mean %.2fms stddev %.2fms max %.2fms",
+                  __func__, mRecordIntervals, mRecordIntervalMean / 1000000,
+                  sqrt(mRecordIntervalM2 / (mRecordIntervals - 1)) / 1000000,
+                  mRecordIntervalMax / 1000000.0);
         if (mSecCamera->stopRecord() < 0) {
             ALOGE("ERR(%s):Fail on mSecCamera->stopRecord()", __func__);
             return;
@@ -825,7 +1453,20 @@ bool CameraHardwareSec::recordingEnabled()
 void CameraHardwareSec::releaseRecordingFrame(const void *opaque)
 {
     struct addrs *addrs = (struct addrs *)opaque;
-    mSecCamera->releaseRecordFrame(addrs->buf_index);
+    int index = addrs->buf_index;
+
+    /* only queue back what the ledger says the encoder holds: a late or
+     * repeated release would otherwise qbuf a buffer FIMC already owns.
+     */
+    if (index < 0 || index >= kBufferCountForRecord ||
+        android_atomic_cmpxchg(1, 0, &mRecordHeld[index])) {
+        ALOGW("%s: buffer %d is not held by the encoder", __func__, index);
+        android_atomic_inc(&mRecordStrayReleases);
+        return;
+    }
+    android_atomic_dec(&mRecordInFlight);
+
+    mSecCamera->releaseRecordFrame(index);
 }
 
 // ---------------------------------------------------------------------------
@@ -850,15 +1491,22 @@ int CameraHardwareSec::autoFocusThread()
         ALOGV("%s : exiting on request0", __func__);
         return NO_ERROR;
     }
-    mFocusCondition.wait(mFocusLock);
+    if (!mFocusRequested)
+        mFocusCondition.wait(mFocusLock);
     /* check early exit request */
     if (mExitAutoFocusThread) {
         mFocusLock.unlock();
         ALOGV("%s : exiting on request1", __func__);
         return NO_ERROR;
     }
+    bool requested = mFocusRequested;
+    mFocusRequested = false;
     mFocusLock.unlock();
 
+    /* woken without an autoFocus() call */
+    if (!requested)
+        return NO_ERROR;
+
     ALOGV("%s : calling setAutoFocus", __func__);
     if (mSecCamera->setAutofocus() < 0) {
         ALOGE("ERR(%s):Fail on mSecCamera->setAutofocus()", __func__);
@@ -895,7 +1543,10 @@ status_t CameraHardwareSec::autoFocus()
 {
     ALOGV("%s :", __func__);
     /* signal autoFocusThread to run once */
+    mFocusLock.lock();
+    mFocusRequested = true;
     mFocusCondition.signal();
+    mFocusLock.unlock();
     return NO_ERROR;
 }
 
@@ -988,66 +1639,9 @@ void CameraHardwareSec::save_postview(const char *fname, uint8_t *buf, uint32_t
     ::close(fd);
 }
 
-bool CameraHardwareSec::scaleDownYuv422(char *srcBuf, uint32_t srcWidth, uint32_t srcHeight,
-                                        char *dstBuf, uint32_t dstWidth, uint32_t dstHeight)
-{
-    int32_t step_x, step_y;
-    int32_t iXsrc, iXdst;
-    int32_t x, y, src_y_start_pos, dst_pos, src_pos;
-
-    if (dstWidth % 2 != 0 || dstHeight % 2 != 0){
-        ALOGE("scale_down_yuv422: invalid width, height for scaling");
-        return false;
-    }
-
-    step_x = srcWidth / dstWidth;
-    step_y = srcHeight / dstHeight;
-
-    dst_pos = 0;
-    for (uint32_t y = 0; y < dstHeight; y++) {
-        src_y_start_pos = (y * step_y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < dstWidth; x += 2) {
-            src_pos = src_y_start_pos + (x * (step_x * 2));
-
-            dstBuf[dst_pos++] = srcBuf[src_pos    ];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 1];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 2];
-            dstBuf[dst_pos++] = srcBuf[src_pos + 3];
-        }
-    }
-
-    return true;
-}
-
 bool CameraHardwareSec::YUY2toNV21(void *srcBuf, void *dstBuf, uint32_t srcWidth, uint32_t srcHeight)
 {
-    int32_t        x, y, src_y_start_pos, dst_cbcr_pos, dst_pos, src_pos;
-    unsigned char *srcBufPointer = (unsigned char *)srcBuf;
-    unsigned char *dstBufPointer = (unsigned char *)dstBuf;
-
-    dst_pos = 0;
-    dst_cbcr_pos = srcWidth*srcHeight;
-    for (uint32_t y = 0; y < srcHeight; y++) {
-        src_y_start_pos = (y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < (srcWidth * 2); x += 2) {
-            src_pos = src_y_start_pos + x;
-
-            dstBufPointer[dst_pos++] = srcBufPointer[src_pos];
-        }
-    }
-    for (uint32_t y = 0; y < srcHeight; y += 2) {
-        src_y_start_pos = (y * (srcWidth * 2));
-
-        for (uint32_t x = 0; x < (srcWidth * 2); x += 4) {
-            src_pos = src_y_start_pos + x;
-
-            dstBufPointer[dst_cbcr_pos++] = srcBufPointer[src_pos + 3];
-            dstBufPointer[dst_cbcr_pos++] = srcBufPointer[src_pos + 1];
-        }
-    }
-
+    secConvertYuyvToNv21(srcBuf, srcWidth * 2, dstBuf, srcWidth, srcWidth, srcHeight);
     return true;
 }
 
@@ -1055,6 +1649,9 @@ int CameraHardwareSec::pictureThread()
 {
     ALOGV("%s :", __func__);
 
+    if (mBurstCount > 1 && mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK)
+        return burstCapture();
+
     int jpeg_size = 0;
     int ret = NO_ERROR;
     unsigned char *jpeg_data = NULL;
@@ -1063,22 +1660,20 @@ int CameraHardwareSec::pictureThread()
 
     unsigned char *addr = NULL;
     int mPostViewWidth, mPostViewHeight, mPostViewSize;
-    int mThumbWidth, mThumbHeight, mThumbSize;
     int cap_width, cap_height, cap_frame_size;
-    int JpegImageSize, JpegExifSize;
-    bool isLSISensor = false;
+    int JpegImageSize = 0;
 
     unsigned int output_size = 0;
 
     mSecCamera->getPostViewConfig(&mPostViewWidth, &mPostViewHeight, &mPostViewSize);
-    mSecCamera->getThumbnailConfig(&mThumbWidth, &mThumbHeight, &mThumbSize);
     int postviewHeapSize = mPostViewSize;
     mSecCamera->getSnapshotSize(&cap_width, &cap_height, &cap_frame_size);
-    int mJpegHeapSize;
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK)
-        mJpegHeapSize = cap_frame_size * SecCamera::getJpegRatio();
-    else
-        mJpegHeapSize = cap_frame_size;
+    bool back = mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK;
+    /* the front camera's YUV snapshot is its postview */
+    if (!back && postviewHeapSize < cap_width * cap_height * 2)
+        postviewHeapSize = cap_width * cap_height * 2;
+    /* the back sensor's JPEG cannot outgrow the capture it is demuxed from */
+    int jpegMax = back ? SecCamera::getInterleaveDataSize() : cap_width * cap_height * 2;
 
     LOG_TIME_DEFINE(0)
     LOG_TIME_START(0)
@@ -1090,9 +1685,31 @@ int CameraHardwareSec::pictureThread()
     addrs[0].height = mPostViewHeight;
     ALOGV("[5B] mPostViewWidth = %d mPostViewHeight = %d\n",mPostViewWidth,mPostViewHeight);
 
-    camera_memory_t *JpegHeap = mGetMemoryCb(-1, mJpegHeapSize, 1, 0);
-    sp<MemoryHeapBase> PostviewHeap = new MemoryHeapBase(mPostViewSize);
-    sp<MemoryHeapBase> ThumbnailHeap = new MemoryHeapBase(mThumbSize);
+    /* the picture is put together in a pooled heap: the back sensor's
+     * JPEG is demuxed and the front camera's encoder output copied
+     * kJpegHeadroom bytes in, the EXIF is written in front of it.
+     */
+    camera_memory_t *JpegHeap = NULL;
+    uint8_t *jpeg = NULL;
+    if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+        JpegHeap = mCapturePool.get(mGetMemoryCb, kJpegHeadroom + jpegMax);
+        if (JpegHeap)
+            jpeg = (uint8_t *)JpegHeap->data;
+    }
+    bool exifRunning = false;
+
+    /* the postview is demuxed or captured straight into the raw heap the
+     * client gets, unless that heap is too small for it.
+     */
+    camera_memory_t *PostviewHeap = NULL;
+    void *postview;
+    bool directPostview = mRawHeap->size >= (size_t)postviewHeapSize;
+    if (directPostview) {
+        postview = mRawHeap->data;
+    } else {
+        PostviewHeap = mCapturePool.get(mGetMemoryCb, postviewHeapSize);
+        postview = PostviewHeap ? PostviewHeap->data : NULL;
+    }
 
     LOG_TIME_DEFINE(1)
     LOG_TIME_START(1)
@@ -1103,14 +1720,20 @@ int CameraHardwareSec::pictureThread()
 
     unsigned int phyAddr;
 
+    if (((mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) && !jpeg) || !postview) {
+        ALOGE("ERR(%s):Fail on allocating capture heaps", __func__);
+        ret = NO_MEMORY;
+        goto out;
+    }
+
     // Modified the shutter sound timing for Jpeg capture
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK)
+    if (back)
         mSecCamera->setSnapshotCmd();
     if (mMsgEnabled & CAMERA_MSG_SHUTTER) {
         mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
     }
 
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK){
+    if (back) {
         jpeg_data = mSecCamera->getJpeg(&jpeg_size, &phyAddr);
         if (jpeg_data == NULL) {
             ALOGE("ERR(%s):Fail on SecCamera->getSnapshot()", __func__);
@@ -1118,44 +1741,45 @@ int CameraHardwareSec::pictureThread()
             goto out;
         }
     } else {
-        if (mSecCamera->getSnapshotAndJpeg((unsigned char*)PostviewHeap->base(),
-                (unsigned char*)JpegHeap->data, &output_size) < 0) {
+        if (mSecCamera->getSnapshot((unsigned char*)postview) < 0) {
             ret = UNKNOWN_ERROR;
             goto out;
         }
-        ALOGI("snapshotandjpeg done\n");
+        ALOGI("snapshot done\n");
     }
 
     LOG_TIME_END(1)
     LOG_CAMERA("getSnapshotAndJpeg interval: %lu us", LOG_TIME(1));
 
-    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK) {
-        isLSISensor = !strncmp((const char*)mCameraSensorName, "S5K4ECGX", 8);
-        if(isLSISensor) {
-            ALOGI("== Camera Sensor Detect %s - Samsung LSI SOC 5M ==\n", mCameraSensorName);
-            // LSI 5M SOC
-            if (!SplitFrame(jpeg_data, SecCamera::getInterleaveDataSize(),
-                            SecCamera::getJpegLineLength(),
-                            mPostViewWidth * 2, mPostViewWidth,
-                            JpegHeap->data, &JpegImageSize,
-                            PostviewHeap->base(), &mPostViewSize)) {
-                ret = UNKNOWN_ERROR;
-                goto out;
-            }
-        } else {
-            ALOGI("== Camera Sensor Detect %s Sony SOC 5M ==\n", mCameraSensorName);
-            decodeInterleaveData(jpeg_data,
-                                 SecCamera::getInterleaveDataSize(),
-                                 mPostViewWidth, mPostViewHeight,
-                                 &JpegImageSize, JpegHeap->data, PostviewHeap->base());
+    if (back) {
+        // one pass: the postview out, the JPEG straight into its place
+        if (!splitCapture(jpeg_data, jpeg ? jpeg + kJpegHeadroom : NULL, jpegMax,
+                          &JpegImageSize, postview, &mPostViewSize,
+                          mPostViewWidth, mPostViewHeight)) {
+            ret = UNKNOWN_ERROR;
+            goto out;
         }
-    } else {
-        JpegImageSize = static_cast<int>(output_size);
+        mTrace.record(SEC_TRACE_CAPTURE_TO_JPEG, systemTime(SYSTEM_TIME_MONOTONIC) - mCaptureStart);
+    }
+
+    if (jpeg) {
+        /* the thumbnail and EXIF only need the postview: build them in
+         * front of the JPEG while the raw image is delivered.
+         */
+        mExifPostview = postview;
+        mExifDst = jpeg + 2;
+        mExifSize = -1;
+        /* the front camera's thumbnail goes through the same encoder as
+         * its picture, so they cannot overlap.
+         */
+        if (back)
+            exifRunning = mExifThread->run("CameraExifThread", PRIORITY_DEFAULT) == NO_ERROR;
+        if (!exifRunning)
+            exifThread();
     }
-    scaleDownYuv422((char *)PostviewHeap->base(), mPostViewWidth, mPostViewHeight,
-                    (char *)ThumbnailHeap->base(), mThumbWidth, mThumbHeight);
 
-    memcpy(mRawHeap->data, PostviewHeap->base(), postviewHeapSize);
+    if (!directPostview)
+        memcpy(mRawHeap->data, postview, mRawHeap->size);
 
     if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
         mDataCb(CAMERA_MSG_RAW_IMAGE, mRawHeap, 0, NULL, mCallbackCookie);
@@ -1163,28 +1787,30 @@ int CameraHardwareSec::pictureThread()
         mNotifyCb(CAMERA_MSG_RAW_IMAGE_NOTIFY, 0, 0, mCallbackCookie);
     }
 
-    if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
-        camera_memory_t *ExifHeap =
-            mGetMemoryCb(-1, EXIF_FILE_SIZE + JPG_STREAM_BUF_SIZE, 1, 0);
-        JpegExifSize = mSecCamera->getExif((unsigned char *)ExifHeap->data,
-                                           (unsigned char *)ThumbnailHeap->base());
+    if (jpeg) {
+        if (exifRunning) {
+            mExifThread->join();
+            exifRunning = false;
+        }
 
-        ALOGV("JpegExifSize=%d", JpegExifSize);
+        ALOGV("exif size=%d", mExifSize);
 
-        if (JpegExifSize < 0) {
-            ret = UNKNOWN_ERROR;
-            ExifHeap->release(ExifHeap);
-            goto out;
+        if (!back) {
+            const unsigned char *encoded =
+                mSecCamera->encodeSnapshot((const unsigned char *)postview, &output_size);
+            if (!encoded || output_size > (unsigned int)jpegMax) {
+                ret = UNKNOWN_ERROR;
+                goto out;
+            }
+            memcpy(jpeg + kJpegHeadroom, encoded, output_size);
+            JpegImageSize = static_cast<int>(output_size);
+            mTrace.record(SEC_TRACE_CAPTURE_TO_JPEG,
+                          systemTime(SYSTEM_TIME_MONOTONIC) - mCaptureStart);
         }
 
-        camera_memory_t *mem = mGetMemoryCb(-1, JpegImageSize + JpegExifSize, 1, 0);
-        uint8_t *ptr = (uint8_t *) mem->data;
-        memcpy(ptr, JpegHeap->data, 2); ptr += 2;
-        memcpy(ptr, ExifHeap->data, JpegExifSize); ptr += JpegExifSize;
-        memcpy(ptr, (uint8_t *) JpegHeap->data + 2, JpegImageSize - 2);
-        mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, mCallbackCookie);
-        mem->release(mem);
-        ExifHeap->release(ExifHeap);
+        ret = deliverJpeg(jpeg, mExifSize, JpegImageSize);
+        if (ret != NO_ERROR)
+            goto out;
     }
 
     LOG_TIME_END(0)
@@ -1193,7 +1819,10 @@ int CameraHardwareSec::pictureThread()
     ALOGV("%s : pictureThread end", __func__);
 
 out:
-    JpegHeap->release(JpegHeap);
+    if (exifRunning)
+        mExifThread->join();
+    mCapturePool.put(JpegHeap);
+    mCapturePool.put(PostviewHeap);
     mSecCamera->endSnapshot();
     mCaptureLock.lock();
     mCaptureInProgress = false;
@@ -1203,6 +1832,231 @@ out:
     return ret;
 }
 
+int CameraHardwareSec::exifThread()
+{
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int postviewWidth, postviewHeight, postviewSize;
+
+    mSecCamera->getPostViewConfig(&postviewWidth, &postviewHeight, &postviewSize);
+    mExifSize = mSecCamera->getExif(mExifDst, mExifPostview, postviewWidth, postviewHeight,
+                                    kJpegHeadroom - 2);
+    mTrace.record(SEC_TRACE_EXIF, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    return mExifSize;
+}
+
+/*
+ * Hand the client a picture assembled at base: SOI, the APP1 segment of
+ * exifSize bytes at base + 2 and the JPEG at base + kJpegHeadroom. base
+ * is pooled, so the picture is copied out at its exact size into a heap
+ * of its own; the client may still map the previous one.
+ */
+status_t CameraHardwareSec::deliverJpeg(uint8_t *base, int exifSize, int jpegSize)
+{
+    const uint8_t *jpeg = base + kJpegHeadroom;
+
+    if (exifSize < 0 || exifSize > kJpegHeadroom - 2 ||
+            jpegSize < 2 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        ALOGE("ERR(%s):can't assemble JPEG (exif %d, jpeg %d)", __func__, exifSize, jpegSize);
+        return UNKNOWN_ERROR;
+    }
+
+    camera_memory_t *mem = mGetMemoryCb(-1, exifSize + jpegSize, 1, 0);
+    if (!mem || !mem->data) {
+        ALOGE("ERR(%s):Fail on allocating %d bytes", __func__, exifSize + jpegSize);
+        if (mem)
+            mem->release(mem);
+        return NO_MEMORY;
+    }
+
+    /* the JPEG's own SOI is replaced by the one in front of the APP1 */
+    uint8_t *dst = (uint8_t *)mem->data;
+    base[0] = 0xFF;
+    base[1] = 0xD8;
+    memcpy(dst, base, 2 + exifSize);
+    memcpy(dst + 2 + exifSize, jpeg + 2, jpegSize - 2);
+
+    mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, mCallbackCookie);
+    mem->release(mem);
+    return NO_ERROR;
+}
+
+/*
+ * Burst capture keeps the JPEG capture stream armed for mBurstCount shots
+ * with SecCamera::CAPTURE_BUFFERS buffers. Each filled buffer is handed to
+ * burstThread() as is for demuxing, EXIF and delivery and queued back to
+ * the driver from there, so frame N is encoded straight out of its capture
+ * buffer while the sensor exposes frame N + 1 into another one. At most
+ * kBurstSlots buffers are held, one always stays with the sensor.
+ */
+int CameraHardwareSec::burstCapture()
+{
+    const int count = mBurstCount;
+    int ret = NO_ERROR;
+    int shots = 0;
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    ALOGV("%s : %d shots", __func__, count);
+
+    mBurstLock.lock();
+    mBurstHead = 0;
+    mBurstQueued = 0;
+    mBurstInFlight = 0;
+    mBurstError = NO_ERROR;
+    mBurstDone = false;
+    mBurstDelivered = 0;
+    mBurstLock.unlock();
+
+    mBurstThread = new BurstThread(this);
+    if (mBurstThread->run("CameraBurstThread", PRIORITY_DEFAULT) != NO_ERROR) {
+        ALOGE("%s : couldn't run burst thread", __func__);
+        mBurstThread.clear();
+        ret = INVALID_OPERATION;
+        goto out;
+    }
+
+    if (mSecCamera->startBurstCapture() < 0) {
+        ALOGE("ERR(%s):Fail on SecCamera->startBurstCapture()", __func__);
+        ret = UNKNOWN_ERROR;
+        goto drain;
+    }
+
+    while (shots < count) {
+        /* every held buffer is still being encoded, let the sensor wait */
+        mBurstLock.lock();
+        while (mBurstInFlight == kBurstSlots && mBurstError == NO_ERROR)
+            mBurstCondition.wait(mBurstLock);
+        ret = mBurstError;
+        mBurstLock.unlock();
+        if (ret != NO_ERROR)
+            break;
+
+        if (mMsgEnabled & CAMERA_MSG_SHUTTER)
+            mNotifyCb(CAMERA_MSG_SHUTTER, 0, 0, mCallbackCookie);
+
+        BurstFrame frame;
+        frame.data = mSecCamera->getBurstJpeg(&frame.size, &frame.index, &frame.shot);
+        if (frame.data == NULL) {
+            ALOGE("ERR(%s):Fail on SecCamera->getBurstJpeg()", __func__);
+            ret = UNKNOWN_ERROR;
+            break;
+        }
+
+        mBurstLock.lock();
+        mBurstQueue[(mBurstHead + mBurstQueued) % kBurstSlots] = frame;
+        mBurstQueued++;
+        mBurstInFlight++;
+        mBurstCondition.broadcast();
+        mBurstLock.unlock();
+        shots++;
+    }
+
+drain:
+    /* let the encoder drain what was captured, it still reads the buffers */
+    mBurstLock.lock();
+    mBurstDone = true;
+    mBurstCondition.broadcast();
+    mBurstLock.unlock();
+    mBurstThread->join();
+    mBurstThread.clear();
+
+    /* also unmaps the capture buffers when startBurstCapture() failed */
+    mSecCamera->stopBurstCapture();
+
+out:
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+    mBurstLock.lock();
+    mBurstShots = shots;
+    mBurstElapsed = elapsed;
+    ALOGI("%s : %d/%d shots, %d delivered in %lld ms", __func__,
+          shots, count, mBurstDelivered, (long long)ns2ms(elapsed));
+    mBurstLock.unlock();
+
+    mCaptureLock.lock();
+    mCaptureInProgress = false;
+    mCaptureCondition.broadcast();
+    mCaptureLock.unlock();
+
+    return ret;
+}
+
+int CameraHardwareSec::burstThread()
+{
+    for (;;) {
+        mBurstLock.lock();
+        while (!mBurstQueued && !mBurstDone)
+            mBurstCondition.wait(mBurstLock);
+        if (!mBurstQueued) {
+            mBurstLock.unlock();
+            break;
+        }
+        BurstFrame frame = mBurstQueue[mBurstHead];
+        mBurstHead = (mBurstHead + 1) % kBurstSlots;
+        mBurstQueued--;
+        mBurstLock.unlock();
+
+        int ret = deliverBurstFrame(frame.data, frame.shot);
+
+        /* hand the buffer back to the sensor for the next shot */
+        int err = NO_ERROR;
+        if (mSecCamera->releaseBurstJpeg(frame.index) < 0) {
+            ALOGE("ERR(%s):Fail on SecCamera->releaseBurstJpeg(%d)", __func__, frame.index);
+            err = UNKNOWN_ERROR;
+        }
+
+        mBurstLock.lock();
+        mBurstInFlight--;
+        if (ret == NO_ERROR)
+            mBurstDelivered++;
+        if (err != NO_ERROR)
+            mBurstError = err;
+        mBurstCondition.broadcast();
+        mBurstLock.unlock();
+    }
+
+    return NO_ERROR;
+}
+
+/* the same assembly as pictureThread(), from the capture buffer */
+int CameraHardwareSec::deliverBurstFrame(unsigned char *data,
+                                         const SecCamera::ShotInfo &shot)
+{
+    const int jpegMax = SecCamera::getInterleaveDataSize();
+    int postviewWidth, postviewHeight, postviewSize;
+    int jpegSize = 0, exifSize;
+    int ret = UNKNOWN_ERROR;
+    uint8_t *jpeg;
+    camera_memory_t *postview = NULL;
+    camera_memory_t *heap = NULL;
+
+    if (!(mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE))
+        return NO_ERROR;
+
+    mSecCamera->getPostViewConfig(&postviewWidth, &postviewHeight, &postviewSize);
+
+    postview = mCapturePool.get(mGetMemoryCb, postviewSize);
+    heap = mCapturePool.get(mGetMemoryCb, kJpegHeadroom + jpegMax);
+    if (!postview || !heap) {
+        ret = NO_MEMORY;
+        goto out;
+    }
+    jpeg = (uint8_t *)heap->data;
+
+    if (!splitCapture(data, jpeg + kJpegHeadroom, jpegMax, &jpegSize,
+                      postview->data, &postviewSize, postviewWidth, postviewHeight))
+        goto out;
+
+    exifSize = mSecCamera->getExif(jpeg + 2, postview->data, postviewWidth, postviewHeight,
+                                   kJpegHeadroom - 2, &shot);
+    ret = deliverJpeg(jpeg, exifSize, jpegSize);
+
+out:
+    mCapturePool.put(heap);
+    mCapturePool.put(postview);
+    return ret;
+}
+
 status_t CameraHardwareSec::waitCaptureCompletion() {
     // 5 seconds timeout
     nsecs_t endTime = 5000000000LL + systemTime(SYSTEM_TIME_MONOTONIC);
@@ -1223,6 +2077,8 @@ status_t CameraHardwareSec::takePicture()
 {
     ALOGV("%s :", __func__);
 
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
     stopPreview();
 
     if (!mRawHeap) {
@@ -1238,6 +2094,7 @@ status_t CameraHardwareSec::takePicture()
         return TIMED_OUT;
     }
 
+    mCaptureStart = start;
     if (mPictureThread->run("CameraPictureThread", PRIORITY_DEFAULT) != NO_ERROR) {
         ALOGE("%s : couldn't run picture thread", __func__);
         return INVALID_OPERATION;
@@ -1297,16 +2154,14 @@ bool CameraHardwareSec::FindEOIMarkerInJPEG(unsigned char *pBuf, int dwBufSize,
         return false;
     }
 
-    unsigned char *pBufEnd = pBuf + dwBufSize;
-
-    while (pBuf < pBufEnd) {
-        if (CheckEOIMarker(pBuf++))
-            return true;
-
-        (*pnJPEGsize)++;
+    int offset = secJpegFindEOI(pBuf, dwBufSize);
+    if (offset < 0) {
+        *pnJPEGsize += dwBufSize;
+        return false;
     }
 
-    return false;
+    *pnJPEGsize += offset;
+    return true;
 }
 
 bool CameraHardwareSec::SplitFrame(unsigned char *pFrame, int dwSize,
@@ -1333,6 +2188,8 @@ bool CameraHardwareSec::SplitFrame(unsigned char *pFrame, int dwSize,
     int dwJSize = 0;
     unsigned char *pV = (unsigned char *)pVideo;
     int dwVSize = 0;
+    // last JPEG byte seen, pJPEG may be NULL to only count the JPEG size
+    unsigned char lastJ = 0;
 
     bool bRet = false;
     bool isFinishJpeg = false;
@@ -1364,8 +2221,8 @@ bool CameraHardwareSec::SplitFrame(unsigned char *pFrame, int dwSize,
                 isFinishJpeg = true;
                 size += 2;  // to count EOF marker size
             } else {
-                if ((dwCopyBufLen == 1) && (pJPEG < pJ)) {
-                    unsigned char checkBuf[2] = { *(pJ - 1), *pSrc };
+                if ((dwCopyBufLen == 1) && (0 < dwJSize)) {
+                    unsigned char checkBuf[2] = { lastJ, *pSrc };
 
                     if (CheckEOIMarker(checkBuf))
                         isFinishJpeg = true;
@@ -1373,11 +2230,14 @@ bool CameraHardwareSec::SplitFrame(unsigned char *pFrame, int dwSize,
                 size = dwCopyBufLen;
             }
 
-            memcpy(pJ, pSrc, size);
+            if (pJ) {
+                memcpy(pJ, pSrc, size);
+                pJ += dwCopyBufLen;
+            }
 
             dwJSize += size;
+            lastJ = pSrc[size - 1];
 
-            pJ += dwCopyBufLen;
             pSrc += dwCopyBufLen;
         }
         if (isFinishJpeg)
@@ -1414,82 +2274,40 @@ int CameraHardwareSec::decodeInterleaveData(unsigned char *pInterleaveData,
     if (pInterleaveData == NULL)
         return false;
 
-    bool ret = true;
-    unsigned int *interleave_ptr = (unsigned int *)pInterleaveData;
-    unsigned char *jpeg_ptr = (unsigned char *)pJpegData;
-    unsigned char *yuv_ptr = (unsigned char *)pYuvData;
-    unsigned char *p;
-    int jpeg_size = 0;
-    int yuv_size = 0;
-
-    int i = 0;
-
     ALOGV("decodeInterleaveData Start~~~");
-    while (i < interleaveDataSize) {
-        if ((*interleave_ptr == 0xFFFFFFFF) || (*interleave_ptr == 0x02FFFFFF) ||
-                (*interleave_ptr == 0xFF02FFFF)) {
-            // Padding Data
-//            ALOGE("%d(%x) padding data\n", i, *interleave_ptr);
-            interleave_ptr++;
-            i += 4;
-        }
-        else if ((*interleave_ptr & 0xFFFF) == 0x05FF) {
-            // Start-code of YUV Data
-//            ALOGE("%d(%x) yuv data\n", i, *interleave_ptr);
-            p = (unsigned char *)interleave_ptr;
-            p += 2;
-            i += 2;
-
-            // Extract YUV Data
-            if (pYuvData != NULL) {
-                memcpy(yuv_ptr, p, yuvWidth * 2);
-                yuv_ptr += yuvWidth * 2;
-                yuv_size += yuvWidth * 2;
-            }
-            p += yuvWidth * 2;
-            i += yuvWidth * 2;
+    bool ret = secJpegDemuxSony(pInterleaveData, interleaveDataSize,
+                                yuvWidth, yuvHeight,
+                                pJpegData, interleaveDataSize, pJpegSize, pYuvData);
+    ALOGV("decodeInterleaveData End~~~");
+    return ret;
+}
 
-            // Check End-code of YUV Data
-            if ((*p == 0xFF) && (*(p + 1) == 0x06)) {
-                interleave_ptr = (unsigned int *)(p + 2);
-                i += 2;
-            } else {
-                ret = false;
-                break;
-            }
-        } else {
-            // Extract JPEG Data
-//            ALOGE("%d(%x) jpg data, jpeg_size = %d bytes\n", i, *interleave_ptr, jpeg_size);
-            if (pJpegData != NULL) {
-                memcpy(jpeg_ptr, interleave_ptr, 4);
-                jpeg_ptr += 4;
-                jpeg_size += 4;
-            }
-            interleave_ptr++;
-            i += 4;
-        }
-    }
-    if (ret) {
-        if (pJpegData != NULL) {
-            // Remove Padding after EOI
-            for (i = 0; i < 3; i++) {
-                if (*(--jpeg_ptr) != 0xFF) {
-                    break;
-                }
-                jpeg_size--;
-            }
-            *pJpegSize = jpeg_size;
+/*
+ * Demux the back sensor's interleaved capture, the JPEG to jpeg and the
+ * postview to postview. With jpeg NULL the JPEG is only measured.
+ */
+bool CameraHardwareSec::splitCapture(unsigned char *data, void *jpeg, int jpegMax,
+                                     int *jpegSize, void *postview, int *postviewSize,
+                                     int postviewWidth, int postviewHeight)
+{
+    *jpegSize = 0;
 
-        }
-        // Check YUV Data Size
-        if (pYuvData != NULL) {
-            if (yuv_size != (yuvWidth * yuvHeight * 2)) {
-                ret = false;
-            }
-        }
+    if (!strncmp((const char*)mCameraSensorName, "S5K4ECGX", 8)) {
+        ALOGI("== Camera Sensor Detect %s - Samsung LSI SOC 5M ==\n", mCameraSensorName);
+        // LSI 5M SOC
+        return SplitFrame(data, SecCamera::getInterleaveDataSize(),
+                          SecCamera::getJpegLineLength(),
+                          postviewWidth * 2, postviewWidth,
+                          jpeg, jpegSize, postview, postviewSize);
     }
-    ALOGV("decodeInterleaveData End~~~");
-    return ret;
+
+    ALOGI("== Camera Sensor Detect %s Sony SOC 5M ==\n", mCameraSensorName);
+    if (!secJpegDemuxSony(data, SecCamera::getInterleaveDataSize(),
+                          postviewWidth, postviewHeight,
+                          jpeg, jpegMax, jpegSize, postview))
+        ALOGW("%s: interleaved data did not decode cleanly", __func__);
+
+    return *jpegSize > 0;
 }
 
 status_t CameraHardwareSec::dump(int fd) const
@@ -1505,6 +2323,45 @@ status_t CameraHardwareSec::dump(int fd) const
         mInternalParameters.dump(fd, args);
         snprintf(buffer, 255, " preview running(%s)\n", mPreviewRunning?"true": "false");
         result.append(buffer);
+        snprintf(buffer, 255, " preview captured(%d) skipped(%d) direct(%s)\n",
+                 mPreviewCaptured, mPreviewSkipped, mPreviewDirect ? "true" : "false");
+        result.append(buffer);
+        for (int id = 0; id < PREVIEW_STAGE_COUNT; id++) {
+            const PreviewStage &stage = mPreviewStages[id];
+            snprintf(buffer, 255, " preview %s stage: queued(%d) delivered(%d) dropped(%d) depth(%d)\n",
+                     id == PREVIEW_STAGE_DISPLAY ? "display" :
+                     id == PREVIEW_STAGE_CALLBACK ? "callback" : "record",
+                     stage.queued, stage.delivered, stage.dropped, stage.queue.size());
+            result.append(buffer);
+        }
+        if (mRecordIntervals) {
+            double stddev = mRecordIntervals > 1 ?
+                            sqrt(mRecordIntervalM2 / (mRecordIntervals - 1)) : 0;
+            snprintf(buffer, 255, " record: in flight(%d) peak(%d) stray releases(%d)"
+                     " interval mean(%.2fms) stddev(%.2fms) max(%.2fms)\n",
+                     mRecordInFlight, mRecordInFlightPeak, mRecordStrayReleases,
+                     mRecordIntervalMean / 1000000, stddev / 1000000,
+                     mRecordIntervalMax / 1000000.0);
+            result.append(buffer);
+        }
+        mCapturePool.dump(result);
+        snprintf(buffer, 255, " setParameters: calls(%d) unchanged(%d) ctrl ioctls(%d)\n",
+                 mParamCalls, mParamUnchanged, mParamIoctls);
+        result.append(buffer);
+        snprintf(buffer, 255, " getParameters: generation(%d) served(%d)\n",
+                 mParamGeneration, android_atomic_acquire_load(&mFlatServed));
+        result.append(buffer);
+        mBurstLock.lock();
+        if (mBurstShots) {
+            int64_t rate = mBurstElapsed > 0 ?
+                           (int64_t)mBurstShots * 100 * 1000000000LL / mBurstElapsed : 0;
+            snprintf(buffer, 255, " last burst: shots(%d) delivered(%d) %lld.%02lld shots/s\n",
+                     mBurstShots, mBurstDelivered, (long long)(rate / 100), (long long)(rate % 100));
+            result.append(buffer);
+        }
+        mBurstLock.unlock();
+        result.append(" latency:\n");
+        mTrace.dump(result);
     } else {
         result.append("No camera client yet.\n");
     }
@@ -1557,7 +2414,15 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
 {
     ALOGV("%s :", __func__);
 
-    status_t ret = NO_ERROR;
+    /* apps resend unchanged parameters all the time: once a set has been
+     * applied cleanly, the same set again is a no-op.
+     */
+    String8 flattened = params.flatten();
+    mParamCalls++;
+    if (flattened == mAppliedParameters) {
+        mParamUnchanged++;
+        return NO_ERROR;
+    }
 
     /* if someone calls us while picture thread is running, it could screw
      * up the sensor quite a bit so return error.
@@ -1566,6 +2431,25 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
         return TIMED_OUT;
     }
 
+    // the SecCamera setters only touch ctrls whose value changed
+    int ioctls = mSecCamera->getCtrlIoctlCount();
+    status_t ret = applyParameters(params);
+    mParamIoctls += mSecCamera->getCtrlIoctlCount() - ioctls;
+
+    if (ret == NO_ERROR)
+        mAppliedParameters = flattened;
+    else
+        mAppliedParameters = String8();
+
+    updateFlattenedParameters();
+
+    return ret;
+}
+
+status_t CameraHardwareSec::applyParameters(const CameraParameters& params)
+{
+    status_t ret = NO_ERROR;
+
     // preview size
     int new_preview_width  = 0;
     int new_preview_height = 0;
@@ -1618,6 +2502,9 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
 
                 mParameters.setPreviewSize(new_preview_width, new_preview_height);
                 mParameters.setPreviewFormat(new_str_preview_format);
+                /* the pooled postview heaps are sized for the old preview */
+                if (current_preview_width != new_preview_width)
+                    mCapturePool.clear();
             }
         }
         else ALOGV("%s: preview size and format has not changed", __func__);
@@ -1640,10 +2527,31 @@ status_t CameraHardwareSec::setParameters(const CameraParameters& params)
                     __func__, new_picture_width, new_picture_height);
             ret = UNKNOWN_ERROR;
         } else {
+            int cur_picture_width, cur_picture_height;
+            mParameters.getPictureSize(&cur_picture_width, &cur_picture_height);
+            /* the front camera sizes its pooled JPEG assembly and
+             * postview heaps by the picture
+             */
+            if (cur_picture_width != new_picture_width ||
+                    cur_picture_height != new_picture_height)
+                mCapturePool.clear();
             mParameters.setPictureSize(new_picture_width, new_picture_height);
         }
     }
 
+    // burst count, back camera only
+    if (mSecCamera->getCameraId() == SecCamera::CAMERA_ID_BACK &&
+            params.get("burst-count") != NULL) {
+        int new_burst_count = params.getInt("burst-count");
+        if (new_burst_count < 1 || kBurstCountMax < new_burst_count) {
+            ALOGE("%s: Invalid burst count(%d)", __func__, new_burst_count);
+            ret = INVALID_OPERATION;
+        } else {
+            mBurstCount = new_burst_count;
+            mParameters.set("burst-count", new_burst_count);
+        }
+    }
+
     // picture format
     const char *new_str_picture_format = params.getPictureFormat();
     ALOGV("%s : new_str_picture_format %s", __func__, new_str_picture_format);
@@ -2259,8 +3167,78 @@ CameraParameters CameraHardwareSec::getParameters() const
     return mParameters;
 }
 
+CameraHardwareSec::FlatParameters *CameraHardwareSec::flatOf(char *parms)
+{
+    return (FlatParameters *)(parms - offsetof(FlatParameters, str));
+}
+
+CameraHardwareSec::FlatParameters *CameraHardwareSec::newFlat(const String8 &str)
+{
+    FlatParameters *flat = (FlatParameters *)malloc(offsetof(FlatParameters, str) +
+                                                    str.length() + 1);
+    if (!flat) {
+        ALOGE("ERR(%s):could not allocate %zu bytes", __func__, str.length());
+        return NULL;
+    }
+    flat->refs = 1;
+    memcpy(flat->str, str.string(), str.length() + 1);
+    return flat;
+}
+
+/* swap in a new flattened copy, and a new generation, if mParameters changed */
+void CameraHardwareSec::updateFlattenedParameters(void)
+{
+    String8 str = mParameters.flatten();
+    Mutex::Autolock lock(mFlatLock);
+
+    if (mFlat && !strcmp(mFlat->str, str.string()))
+        return;
+
+    FlatParameters *flat = newFlat(str);
+    if (!flat)
+        return;
+
+    if (mFlat)
+        putFlattenedParameters(mFlat->str);
+    mFlat = flat;
+    mParamGeneration++;
+}
+
+char *CameraHardwareSec::getFlattenedParameters() const
+{
+    Mutex::Autolock lock(mFlatLock);
+
+    android_atomic_inc(&mFlatServed);
+    if (!mFlat) {
+        // nothing cached, hand out a private copy
+        FlatParameters *flat = newFlat(mParameters.flatten());
+        return flat ? flat->str : NULL;
+    }
+
+    android_atomic_inc(&mFlat->refs);
+    return mFlat->str;
+}
+
+void CameraHardwareSec::putFlattenedParameters(char *parms)
+{
+    if (!parms)
+        return;
+
+    FlatParameters *flat = flatOf(parms);
+    if (android_atomic_dec(&flat->refs) == 1)
+        free(flat);
+}
+
 status_t CameraHardwareSec::sendCommand(int32_t command, int32_t arg1, int32_t arg2)
 {
+    switch (command) {
+    case CAMERA_CMD_SEC_RESET_TRACE:
+        mTrace.reset();
+        if (mSecCamera != 0)
+            mSecCamera->resetTrace();
+        return NO_ERROR;
+    }
+
     return BAD_VALUE;
 }
 
@@ -2286,6 +3264,18 @@ void CameraHardwareSec::release()
         mPreviewThread->requestExitAndWait();
         mPreviewThread.clear();
     }
+    for (int id = 0; id < PREVIEW_STAGE_COUNT; id++) {
+        PreviewStage &stage = mPreviewStages[id];
+        if (stage.thread == NULL)
+            continue;
+        stage.lock.lock();
+        stage.thread->requestExit();
+        stage.exit = true;
+        stage.cond.signal();
+        stage.lock.unlock();
+        stage.thread->requestExitAndWait();
+        stage.thread.clear();
+    }
     if (mAutoFocusThread != NULL) {
         /* this thread is normally already in it's threadLoop but blocked
          * on the condition variable.  signal it so it wakes up and can exit.
@@ -2302,15 +3292,24 @@ void CameraHardwareSec::release()
         mPictureThread->requestExitAndWait();
         mPictureThread.clear();
     }
+    if (mExifThread != NULL) {
+        mExifThread->requestExitAndWait();
+        mExifThread.clear();
+    }
 
     if (mRawHeap) {
         mRawHeap->release(mRawHeap);
         mRawHeap = 0;
     }
+    mCapturePool.clear();
     if (mPreviewHeap) {
         mPreviewHeap->release(mPreviewHeap);
         mPreviewHeap = 0;
     }
+    if (mPreviewCbHeap) {
+        mPreviewCbHeap->release(mPreviewCbHeap);
+        mPreviewCbHeap = 0;
+    }
     if (mRecordHeap) {
         mRecordHeap->release(mRecordHeap);
         mRecordHeap = 0;
@@ -2601,16 +3600,13 @@ static int HAL_camera_device_set_parameters(struct camera_device *dev,
 char *HAL_camera_device_get_parameters(struct camera_device *dev)
 {
     ALOGV("%s", __func__);
-    String8 str;
-    CameraParameters parms = obj(dev)->getParameters();
-    str = parms.flatten();
-    return strdup(str.string());
+    return obj(dev)->getFlattenedParameters();
 }
 
 void HAL_camera_device_put_parameters(struct camera_device *dev, char *parms)
 {
     ALOGV("%s", __func__);
-    free(parms);
+    CameraHardwareSec::putFlattenedParameters(parms);
 }
 
 /**
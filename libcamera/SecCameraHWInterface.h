@@ -20,6 +20,9 @@
 #define ANDROID_HARDWARE_CAMERA_HARDWARE_SEC_H
 
 #include "SecCamera.h"
+#include "SecCameraQueue.h"
+#include "SecCameraTrace.h"
+#include "SecCameraHeapPool.h"
 #include <utils/threads.h>
 #include <utils/RefBase.h>
 #include <binder/MemoryBase.h>
@@ -57,6 +60,9 @@ public:
     virtual status_t    dump(int fd) const;
     virtual status_t    setParameters(const CameraParameters& params);
     virtual CameraParameters  getParameters() const;
+    /* mParameters flattened; hand back with putFlattenedParameters() */
+            char        *getFlattenedParameters() const;
+    static  void        putFlattenedParameters(char *parms);
     virtual status_t    sendCommand(int32_t command, int32_t arg1, int32_t arg2);
     virtual status_t    setPreviewWindow(preview_stream_ops *w);
     virtual status_t    storeMetaDataInBuffers(bool enable);
@@ -64,14 +70,43 @@ public:
 
     inline  int         getCameraId() const;
 
+    /* private sendCommand(): clears the latency histograms shown by dump() */
+    enum { CAMERA_CMD_SEC_RESET_TRACE = 0x5300 };
+
     CameraHardwareSec(int cameraId, camera_device_t *dev);
     virtual             ~CameraHardwareSec();
 private:
     status_t    startPreviewInternal();
     void stopPreviewInternal();
 
+    struct PreviewBuffer {
+        buffer_handle_t *handle;
+        void            *vaddr;
+        bool            inWindow;
+        bool            locked;     /* while FIMC or the HAL may touch it */
+    };
+
+            bool        initPreviewWindowBuffers(int width, int height, int frame_size);
+            void        releasePreviewWindowBuffers();
+            int         importPreviewWindowBuffer(buffer_handle_t *handle, int stride,
+                                                  int width, int height, int frame_size);
+            void        displayPreviewWindowBuffer(int index);
+            int         lockPreviewWindowBuffer(int index, int frame_size);
+            void        unlockPreviewWindowBuffer(int index);
+            bool        convertPreviewFrame(int slot, const void *frame, bool yv12);
+            int         acquirePreviewCbSlot(void);
+            void        releasePreviewCbSlot(int slot);
+
     static  const int   kBufferCount = MAX_BUFFERS;
     static  const int   kBufferCountForRecord = MAX_BUFFERS;
+    /* record buffers the encoder and the dispatch queue may hold between
+     * them; the rest stay queued in FIMC so capture never starves.
+     */
+    static  const int   kRecordInFlightMax = kBufferCountForRecord - 2;
+    /* room in front of a picture's JPEG for SOI and APP1 */
+    static  const int   kJpegHeadroom = EXIF_FILE_SIZE;
+    static  const int   kBurstCountMax = 8;
+    static  const int   kBurstSlots = SecCamera::CAPTURE_BUFFERS - 1;
 
     class PreviewThread : public Thread {
         CameraHardwareSec *mHardware;
@@ -88,6 +123,58 @@ private:
         }
     };
 
+    /* the preview pipeline: PreviewThread captures and hands frame
+     * descriptors to one consumer thread per stage. Recording frames go
+     * through the same machinery to their own dispatch thread.
+     */
+    enum {
+        PREVIEW_STAGE_DISPLAY = 0,
+        PREVIEW_STAGE_CALLBACK,
+        PREVIEW_STAGE_RECORD,
+        PREVIEW_STAGE_COUNT,
+    };
+
+    enum {
+        PREVIEW_DROP_OLDEST,
+        PREVIEW_DROP_NEWEST,
+    };
+
+    class PreviewStageThread : public Thread {
+        CameraHardwareSec *mHardware;
+        int mStage;
+        const char *mName;
+        int mPriority;
+    public:
+        PreviewStageThread(CameraHardwareSec *hw, int stage, const char *name, int priority):
+        Thread(false),
+        mHardware(hw),
+        mStage(stage),
+        mName(name),
+        mPriority(priority) { }
+        virtual void onFirstRef() {
+            run(mName, mPriority);
+        }
+        virtual bool threadLoop() {
+            mHardware->previewStageThread(mStage);
+            return false;
+        }
+    };
+
+    struct PreviewStage {
+        SecFrameQueue       queue;
+        int                 dropPolicy;
+        mutable Mutex       lock;
+        Condition           cond;
+        Condition           idleCond;
+        bool                busy;
+        bool                flush;
+        bool                exit;
+        volatile int32_t    queued;
+        volatile int32_t    delivered;
+        volatile int32_t    dropped;
+        sp<PreviewStageThread> thread;
+    };
+
     class PictureThread : public Thread {
         CameraHardwareSec *mHardware;
     public:
@@ -100,6 +187,30 @@ private:
         }
     };
 
+    class BurstThread : public Thread {
+        CameraHardwareSec *mHardware;
+    public:
+        BurstThread(CameraHardwareSec *hw):
+        Thread(false),
+        mHardware(hw) { }
+        virtual bool threadLoop() {
+            mHardware->burstThread();
+            return false;
+        }
+    };
+
+    class ExifThread : public Thread {
+        CameraHardwareSec *mHardware;
+    public:
+        ExifThread(CameraHardwareSec *hw):
+        Thread(false),
+        mHardware(hw) { }
+        virtual bool threadLoop() {
+            mHardware->exifThread();
+            return false;
+        }
+    };
+
     class AutoFocusThread : public Thread {
         CameraHardwareSec *mHardware;
     public:
@@ -114,18 +225,95 @@ private:
     };
 
             void        initDefaultParameters(int cameraId);
+            status_t    applyParameters(const CameraParameters& params);
             void        initHeapLocked();
 
     sp<PreviewThread>   mPreviewThread;
             int         previewThread();
             int         previewThreadWrapper();
 
+    PreviewStage        mPreviewStages[PREVIEW_STAGE_COUNT];
+            int         previewStageThread(int id);
+            void        queuePreviewFrame(int id, SecPreviewFrame frame, int owner);
+            void        dropPreviewFrame(int id, const SecPreviewFrame &frame);
+            void        flushPreviewStages();
+            void        displayPreviewFrame(const SecPreviewFrame &frame);
+            void        deliverPreviewFrame(const SecPreviewFrame &frame);
+            void        flushPreviewStage(int id);
+            void        queueRecordFrame();
+            void        deliverRecordFrame(const SecPreviewFrame &frame);
+    volatile int32_t    mPreviewCaptured;
+    volatile int32_t    mPreviewSkipped;
+
     sp<AutoFocusThread> mAutoFocusThread;
             int         autoFocusThread();
 
     sp<PictureThread>   mPictureThread;
             int         pictureThread();
             bool        mCaptureInProgress;
+            nsecs_t     mCaptureStart;
+    SecCameraHeapPool   mCapturePool;
+
+    /* last parameter set applied without error, flattened */
+    String8             mAppliedParameters;
+            int         mParamCalls;
+            int         mParamUnchanged;
+            int         mParamIoctls;
+
+    /* mParameters flattened once per change and shared with every
+     * get_parameters caller, freed when the last reference goes
+     */
+    struct FlatParameters {
+        volatile int32_t refs;
+        char        str[1];
+    };
+    static  FlatParameters *flatOf(char *parms);
+    static  FlatParameters *newFlat(const String8 &str);
+            void        updateFlattenedParameters(void);
+    mutable Mutex       mFlatLock;
+    FlatParameters      *mFlat;
+            int         mParamGeneration;
+    mutable volatile int32_t mFlatServed;
+
+    /* burst capture: pictureThread() captures, burstThread() encodes */
+    sp<BurstThread>     mBurstThread;
+            int         burstCapture();
+            int         burstThread();
+            int         deliverBurstFrame(unsigned char *data,
+                                          const SecCamera::ShotInfo &shot);
+            int         mBurstCount;
+    mutable Mutex       mBurstLock;
+    Condition           mBurstCondition;
+    /* a filled capture buffer on its way to burstThread(), with the
+     * sensor state read when it was dequeued
+     */
+    struct BurstFrame {
+        unsigned char   *data;
+        int             size;
+        int             index;
+        SecCamera::ShotInfo shot;
+    };
+    BurstFrame          mBurstQueue[kBurstSlots];
+            int         mBurstHead;
+            int         mBurstQueued;
+            int         mBurstInFlight;
+            status_t    mBurstError;
+            bool        mBurstDone;
+            int         mBurstShots;
+            int         mBurstDelivered;
+            nsecs_t     mBurstElapsed;
+
+    /* thumbnail + EXIF of a shot, built while its raw image is delivered */
+    sp<ExifThread>      mExifThread;
+            int         exifThread();
+            void        *mExifPostview;
+            uint8_t     *mExifDst;
+            int         mExifSize;
+
+    /* a picture is assembled in a pooled heap, see deliverJpeg() */
+            status_t    deliverJpeg(uint8_t *base, int exifSize, int jpegSize);
+
+    SecCameraTrace      mTrace;
 
             int         save_jpeg(unsigned char *real_jpeg, int jpeg_size);
             void        save_postview(const char *fname, uint8_t *buf,
@@ -138,14 +326,14 @@ private:
                                                 void *pJpegData,
                                                 void *pYuvData);
             bool        YUY2toNV21(void *srcBuf, void *dstBuf, uint32_t srcWidth, uint32_t srcHeight);
-            bool        scaleDownYuv422(char *srcBuf, uint32_t srcWidth,
-                                        uint32_t srcHight, char *dstBuf,
-                                        uint32_t dstWidth, uint32_t dstHight);
 
             bool        CheckVideoStartMarker(unsigned char *pBuf);
             bool        CheckEOIMarker(unsigned char *pBuf);
             bool        FindEOIMarkerInJPEG(unsigned char *pBuf,
                                             int dwBufSize, int *pnJPEGsize);
+            bool        splitCapture(unsigned char *data, void *jpeg, int jpegMax,
+                                     int *jpegSize, void *postview, int *postviewSize,
+                                     int postviewWidth, int postviewHeight);
             bool        SplitFrame(unsigned char *pFrame, int dwSize,
                                    int dwJPEGLineLength, int dwVideoLineLength,
                                    int dwVideoHeight, void *pJPEG,
@@ -161,6 +349,7 @@ private:
     mutable Mutex       mFocusLock;
     mutable Condition   mFocusCondition;
             bool        mExitAutoFocusThread;
+            bool        mFocusRequested;
 
     /* used by preview thread to block until it's told to run */
     mutable Mutex       mPreviewLock;
@@ -172,6 +361,13 @@ private:
 
             preview_stream_ops *mPreviewWindow;
 
+    /* zero-copy preview: FIMC writes straight into the window buffers */
+            bool        mPreviewZeroCopy;
+            bool        mPreviewDirect;
+            int         mPreviewBuffersOwed;
+            preview_stream_ops *mPreviewDirectWindow;
+            PreviewBuffer mPreviewBuffers[kBufferCount];
+
     /* used to guard mCaptureInProgress */
     mutable Mutex       mCaptureLock;
     mutable Condition   mCaptureCondition;
@@ -180,6 +376,12 @@ private:
     CameraParameters    mInternalParameters;
 
     camera_memory_t     *mPreviewHeap;
+    camera_memory_t     *mPreviewCbHeap;
+    /* mPreviewCbHeap slots go round independently of the driver index, a
+     * slot is busy from its conversion until the callback stage is done
+     */
+    volatile int32_t    mPreviewCbBusy[kBufferCount];
+            int         mPreviewCbNext;
     camera_memory_t     *mRawHeap;
     camera_memory_t     *mRecordHeap;
 
@@ -199,6 +401,17 @@ private:
 
             bool        mRecordRunning;
     mutable Mutex       mRecordLock;
+    /* in-flight ledger: buffers handed to the encoder and not released yet */
+    volatile int32_t    mRecordHeld[kBufferCountForRecord];
+    volatile int32_t    mRecordInFlight;
+    volatile int32_t    mRecordInFlightPeak;
+    volatile int32_t    mRecordStrayReleases;
+    /* frame interval statistics, written by the record dispatch thread only */
+            nsecs_t     mRecordLastTimestamp;
+            int         mRecordIntervals;
+            double      mRecordIntervalMean;
+            double      mRecordIntervalM2;
+            nsecs_t     mRecordIntervalMax;
             int         mPostViewWidth;
             int         mPostViewHeight;
             int         mPostViewSize;
@@ -0,0 +1,155 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SecCameraHeapPool"
+#include <utils/Log.h>
+
+#include "SecCameraHeapPool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace android {
+
+SecCameraHeapPool::SecCameraHeapPool()
+    : mHits(0),
+      mMisses(0),
+      mEvictions(0)
+{
+    memset(mEntries, 0, sizeof(mEntries));
+}
+
+SecCameraHeapPool::~SecCameraHeapPool()
+{
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < MAX_HEAPS; i++) {
+        if (mEntries[i].mem) {
+            if (mEntries[i].busy)
+                ALOGW("%s: heap %p still in use", __func__, mEntries[i].mem);
+            mEntries[i].mem->release(mEntries[i].mem);
+        }
+    }
+}
+
+camera_memory_t *SecCameraHeapPool::get(camera_request_memory getMemory, size_t size)
+{
+    Mutex::Autolock lock(mLock);
+    int slot = -1;
+
+    for (int i = 0; i < MAX_HEAPS; i++) {
+        Entry &e = mEntries[i];
+        if (e.mem && !e.busy && e.mem->size == size) {
+            e.busy = true;
+            mHits++;
+            return e.mem;
+        }
+        if (!e.mem && slot < 0)
+            slot = i;
+    }
+
+    /* no room: make some by dropping an idle heap of another size */
+    for (int i = 0; slot < 0 && i < MAX_HEAPS; i++) {
+        Entry &e = mEntries[i];
+        if (!e.busy) {
+            e.mem->release(e.mem);
+            e.mem = NULL;
+            mEvictions++;
+            slot = i;
+        }
+    }
+
+    mMisses++;
+    camera_memory_t *mem = getMemory(-1, size, 1, 0);
+    if (!mem || !mem->data) {
+        ALOGE("ERR(%s):could not allocate %zu bytes", __func__, size);
+        if (mem)
+            mem->release(mem);
+        return NULL;
+    }
+
+    /* everything busy, hand out a heap put() will simply release */
+    if (slot < 0)
+        return mem;
+
+    mEntries[slot].mem = mem;
+    mEntries[slot].busy = true;
+    mEntries[slot].stale = false;
+    return mem;
+}
+
+void SecCameraHeapPool::put(camera_memory_t *mem)
+{
+    if (!mem)
+        return;
+
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < MAX_HEAPS; i++) {
+        Entry &e = mEntries[i];
+        if (e.mem == mem) {
+            e.busy = false;
+            if (e.stale) {
+                e.mem->release(e.mem);
+                e.mem = NULL;
+            }
+            return;
+        }
+    }
+
+    mem->release(mem);
+}
+
+void SecCameraHeapPool::clear(void)
+{
+    Mutex::Autolock lock(mLock);
+
+    for (int i = 0; i < MAX_HEAPS; i++) {
+        Entry &e = mEntries[i];
+        if (!e.mem)
+            continue;
+        if (e.busy) {
+            e.stale = true;
+        } else {
+            e.mem->release(e.mem);
+            e.mem = NULL;
+        }
+    }
+}
+
+void SecCameraHeapPool::dump(String8 &result) const
+{
+    Mutex::Autolock lock(mLock);
+    char buffer[256];
+    size_t bytes = 0;
+    int heaps = 0;
+
+    for (int i = 0; i < MAX_HEAPS; i++) {
+        if (mEntries[i].mem) {
+            bytes += mEntries[i].mem->size;
+            heaps++;
+        }
+    }
+
+    snprintf(buffer, sizeof(buffer),
+             " capture heaps(%d, %zu bytes) hits(%d) misses(%d) evictions(%d)\n",
+             heaps, bytes, mHits, mMisses, mEvictions);
+    result.append(buffer);
+}
+
+}; // namespace android
@@ -0,0 +1,69 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_HEAP_POOL_H
+#define ANDROID_HARDWARE_CAMERA_SEC_HEAP_POOL_H
+
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <hardware/camera.h>
+
+namespace android {
+
+/*
+ * Keeps the scratch heaps of a capture (the JPEG assembly heap and the
+ * postview) mapped between shots and burst frames. Heaps are matched on
+ * their exact size, so a pool serves one capture configuration at a time;
+ * clear() drops everything when the picture or preview size changes, the
+ * postview follows the latter. Only heaps that never leave the HAL may be
+ * pooled: the service can hold on to anything passed to a callback.
+ */
+class SecCameraHeapPool {
+public:
+    enum { MAX_HEAPS = 8 };
+
+                        SecCameraHeapPool();
+                        ~SecCameraHeapPool();
+
+    /* a heap of exactly size bytes, NULL if the allocation failed */
+    camera_memory_t     *get(camera_request_memory getMemory, size_t size);
+
+    /* give a heap from get() back, NULL is ignored */
+    void                put(camera_memory_t *mem);
+
+    /* release every idle heap, busy ones go when they are put back */
+    void                clear(void);
+
+    void                dump(String8 &result) const;
+
+private:
+    struct Entry {
+        camera_memory_t *mem;
+        bool            busy;
+        bool            stale;
+    };
+
+    mutable Mutex       mLock;
+    Entry               mEntries[MAX_HEAPS];
+    int                 mHits;
+    int                 mMisses;
+    int                 mEvictions;
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_HEAP_POOL_H
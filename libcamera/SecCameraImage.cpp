@@ -0,0 +1,483 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "SecCameraImage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace android {
+
+/*
+ * Copy one row of n bytes. The destination is never read back by the HAL,
+ * so where the ISA has non-temporal stores we use them to keep the preview
+ * frame from evicting the rest of the cache.
+ */
+static inline void copyRow(uint8_t *dst, const uint8_t *src, int n)
+{
+#if defined(__ARM_NEON__)
+    while (n >= 64) {
+        __builtin_prefetch(src + 256);
+        uint8x16_t a = vld1q_u8(src);
+        uint8x16_t b = vld1q_u8(src + 16);
+        uint8x16_t c = vld1q_u8(src + 32);
+        uint8x16_t d = vld1q_u8(src + 48);
+        vst1q_u8(dst, a);
+        vst1q_u8(dst + 16, b);
+        vst1q_u8(dst + 32, c);
+        vst1q_u8(dst + 48, d);
+        src += 64;
+        dst += 64;
+        n -= 64;
+    }
+    while (n >= 16) {
+        vst1q_u8(dst, vld1q_u8(src));
+        src += 16;
+        dst += 16;
+        n -= 16;
+    }
+#elif defined(__SSE2__)
+    /*
+     * Stream whole cache lines only: a line partly written with streaming
+     * stores and partly with plain ones is flushed twice, which costs more
+     * than the plain copy. Rows too short to hold a full line go to memcpy.
+     */
+    int head = (64 - ((uintptr_t)dst & 63)) & 63;
+    if (n >= head + 64) {
+        memcpy(dst, src, head);
+        src += head;
+        dst += head;
+        n -= head;
+        while (n >= 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *)src);
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+            _mm_stream_si128((__m128i *)dst, a);
+            _mm_stream_si128((__m128i *)(dst + 16), b);
+            _mm_stream_si128((__m128i *)(dst + 32), c);
+            _mm_stream_si128((__m128i *)(dst + 48), d);
+            src += 64;
+            dst += 64;
+            n -= 64;
+        }
+    }
+#endif
+    if (n > 0)
+        memcpy(dst, src, n);
+}
+
+static inline void copyDone(void)
+{
+#if !defined(__ARM_NEON__) && defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+void secCopyYuv420ToYv12(const void *src, void *dst,
+                         int width, int height, int dstStride)
+{
+    const int cWidth  = width / 2;
+    const int cHeight = height / 2;
+    const int cStride = dstStride / 2;
+
+    const uint8_t *srcY = (const uint8_t *)src;
+    const uint8_t *srcU = srcY + width * height;
+    const uint8_t *srcV = srcU + cWidth * cHeight;
+
+    uint8_t *dstY = (uint8_t *)dst;
+    uint8_t *dstV = dstY + dstStride * height;
+    uint8_t *dstU = dstV + cStride * cHeight;
+
+    if (dstStride == width) {
+        // no padding, every plane is one contiguous run
+        copyRow(dstY, srcY, width * height);
+        copyRow(dstV, srcV, cWidth * cHeight);
+        copyRow(dstU, srcU, cWidth * cHeight);
+        copyDone();
+        return;
+    }
+
+    // two luma rows share one row of each chroma plane
+    for (int h = 0; h < cHeight; h++) {
+        copyRow(dstY, srcY, width);
+        copyRow(dstY + dstStride, srcY + width, width);
+        copyRow(dstV, srcV, cWidth);
+        copyRow(dstU, srcU, cWidth);
+
+        srcY += width * 2;
+        dstY += dstStride * 2;
+        srcV += cWidth;
+        dstV += cStride;
+        srcU += cWidth;
+        dstU += cStride;
+    }
+
+    if (height & 1)
+        copyRow(dstY, srcY, width);
+
+    copyDone();
+}
+
+void secCopyYv12ToYuv420(const void *src, void *dst,
+                         int width, int height, int srcStride)
+{
+    const int cWidth  = width / 2;
+    const int cHeight = height / 2;
+    const int cStride = srcStride / 2;
+
+    const uint8_t *srcY = (const uint8_t *)src;
+    const uint8_t *srcV = srcY + srcStride * height;
+    const uint8_t *srcU = srcV + cStride * cHeight;
+
+    uint8_t *dstY = (uint8_t *)dst;
+    uint8_t *dstU = dstY + width * height;
+    uint8_t *dstV = dstU + cWidth * cHeight;
+
+    if (srcStride == width) {
+        copyRow(dstY, srcY, width * height);
+        copyRow(dstU, srcU, cWidth * cHeight);
+        copyRow(dstV, srcV, cWidth * cHeight);
+        copyDone();
+        return;
+    }
+
+    for (int h = 0; h < cHeight; h++) {
+        copyRow(dstY, srcY, width);
+        copyRow(dstY + width, srcY + srcStride, width);
+        copyRow(dstU, srcU, cWidth);
+        copyRow(dstV, srcV, cWidth);
+
+        srcY += srcStride * 2;
+        dstY += width * 2;
+        srcU += cStride;
+        dstU += cWidth;
+        srcV += cStride;
+        dstV += cWidth;
+    }
+
+    if (height & 1)
+        copyRow(dstY, srcY, width);
+
+    copyDone();
+}
+
+/*
+ * Interleave n bytes of each of V and U into 2 * n bytes of VU.
+ */
+static inline void interleaveRow(uint8_t *vu, const uint8_t *v, const uint8_t *u, int n)
+{
+#if defined(__ARM_NEON__)
+    while (n >= 16) {
+        uint8x16x2_t pair;
+        pair.val[0] = vld1q_u8(v);
+        pair.val[1] = vld1q_u8(u);
+        vst2q_u8(vu, pair);
+        v += 16;
+        u += 16;
+        vu += 32;
+        n -= 16;
+    }
+#elif defined(__SSE2__)
+    while (n >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)v);
+        __m128i b = _mm_loadu_si128((const __m128i *)u);
+        _mm_storeu_si128((__m128i *)vu, _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(vu + 16), _mm_unpackhi_epi8(a, b));
+        v += 16;
+        u += 16;
+        vu += 32;
+        n -= 16;
+    }
+#endif
+    while (n-- > 0) {
+        *vu++ = *v++;
+        *vu++ = *u++;
+    }
+}
+
+void secConvertPlanarToNv21(const void *srcY, const void *srcU, const void *srcV,
+                            int yStride, int cStride,
+                            void *dst, int width, int height)
+{
+    const int cWidth  = width / 2;
+    const int cHeight = height / 2;
+
+    const uint8_t *y = (const uint8_t *)srcY;
+    const uint8_t *u = (const uint8_t *)srcU;
+    const uint8_t *v = (const uint8_t *)srcV;
+
+    uint8_t *dstY = (uint8_t *)dst;
+    uint8_t *dstVU = dstY + width * height;
+
+    if (yStride == width) {
+        copyRow(dstY, y, width * height);
+    } else {
+        for (int h = 0; h < height; h++) {
+            copyRow(dstY, y, width);
+            y += yStride;
+            dstY += width;
+        }
+    }
+    copyDone();
+
+    if (cStride == cWidth) {
+        interleaveRow(dstVU, v, u, cWidth * cHeight);
+        return;
+    }
+
+    for (int h = 0; h < cHeight; h++) {
+        interleaveRow(dstVU, v, u, cWidth);
+        v += cStride;
+        u += cStride;
+        dstVU += width;
+    }
+}
+
+/*
+ * Split n YUYV pixels (n even) into n luma bytes and, when vu is not NULL,
+ * n / 2 V/U pairs.
+ */
+static inline void yuyvRow(uint8_t *y, uint8_t *vu, const uint8_t *src, int n)
+{
+#if defined(__ARM_NEON__)
+    while (n >= 16) {
+        uint8x8x4_t p = vld4_u8(src);   // Y0, U, Y1, V of 8 pixel pairs
+        uint8x8x2_t luma;
+        luma.val[0] = p.val[0];
+        luma.val[1] = p.val[2];
+        vst2_u8(y, luma);
+        if (vu) {
+            uint8x8x2_t chroma;
+            chroma.val[0] = p.val[3];
+            chroma.val[1] = p.val[1];
+            vst2_u8(vu, chroma);
+            vu += 16;
+        }
+        src += 32;
+        y += 16;
+        n -= 16;
+    }
+#elif defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi16(0x00FF);
+    while (n >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)src);
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+        _mm_storeu_si128((__m128i *)y,
+                         _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+        if (vu) {
+            // U V U V ... then swap the bytes of every pair
+            __m128i c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+            _mm_storeu_si128((__m128i *)vu, c);
+            vu += 16;
+        }
+        src += 32;
+        y += 16;
+        n -= 16;
+    }
+#endif
+    for (; n >= 2; n -= 2) {
+        y[0] = src[0];
+        y[1] = src[2];
+        if (vu) {
+            vu[0] = src[3];
+            vu[1] = src[1];
+            vu += 2;
+        }
+        src += 4;
+        y += 2;
+    }
+}
+
+void secConvertYuyvToNv21(const void *src, int srcStride,
+                          void *dst, int dstStride, int width, int height)
+{
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *dstY = (uint8_t *)dst;
+    uint8_t *dstVU = dstY + dstStride * height;
+
+    // a row pair at a time: both luma rows and the VU row of the first
+    for (int h = 0; h + 1 < height; h += 2) {
+        yuyvRow(dstY, dstVU, in, width);
+        yuyvRow(dstY + dstStride, NULL, in + srcStride, width);
+        in += srcStride * 2;
+        dstY += dstStride * 2;
+        dstVU += dstStride;
+    }
+
+    if (height & 1)
+        yuyvRow(dstY, dstVU, in, width);
+}
+
+/*
+ * Add n bytes of a source row to the 32-bit column sums in acc.
+ */
+static inline void accumulateRow(uint32_t *acc, const uint8_t *src, int n)
+{
+#if defined(__ARM_NEON__)
+    while (n >= 16) {
+        uint8x16_t s = vld1q_u8(src);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(s));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(s));
+        vst1q_u32(acc,      vaddw_u16(vld1q_u32(acc),      vget_low_u16(lo)));
+        vst1q_u32(acc + 4,  vaddw_u16(vld1q_u32(acc + 4),  vget_high_u16(lo)));
+        vst1q_u32(acc + 8,  vaddw_u16(vld1q_u32(acc + 8),  vget_low_u16(hi)));
+        vst1q_u32(acc + 12, vaddw_u16(vld1q_u32(acc + 12), vget_high_u16(hi)));
+        src += 16;
+        acc += 16;
+        n -= 16;
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    while (n >= 16) {
+        __m128i s = _mm_loadu_si128((const __m128i *)src);
+        __m128i lo = _mm_unpacklo_epi8(s, zero);
+        __m128i hi = _mm_unpackhi_epi8(s, zero);
+        __m128i *a = (__m128i *)acc;
+        _mm_storeu_si128(a,     _mm_add_epi32(_mm_loadu_si128(a),     _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(a + 2, _mm_add_epi32(_mm_loadu_si128(a + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(a + 3, _mm_add_epi32(_mm_loadu_si128(a + 3), _mm_unpackhi_epi16(hi, zero)));
+        src += 16;
+        acc += 16;
+        n -= 16;
+    }
+#endif
+    while (n-- > 0)
+        *acc++ += *src++;
+}
+
+/* the source range [*start, *start + *count) behind output sample i of n */
+static inline void boxRange(int i, int n, int srcN, int *start, int *count)
+{
+    int s = i * srcN / n;
+    int e = (i + 1) * srcN / n;
+
+    *start = s;
+    *count = e > s ? e - s : 1;
+}
+
+/* sum * recip >> 31 divides by the box area the recip was made for */
+static inline uint8_t boxAverage(uint32_t sum, uint32_t area, uint32_t recip)
+{
+    return (uint8_t)(((uint64_t)(sum + area / 2) * recip) >> 31);
+}
+
+size_t secScaleYuyvScratchSize(int srcWidth, int dstWidth)
+{
+    if (srcWidth < 2 || dstWidth < 2 || ((srcWidth | dstWidth) & 1))
+        return 0;
+
+    const int maxCols = (srcWidth + dstWidth - 1) / dstWidth;
+
+    return sizeof(int32_t) *
+           (4 + srcWidth * 2 + dstWidth * 2 + dstWidth + maxCols + 1);
+}
+
+bool secScaleYuyv(const void *src, int srcWidth, int srcHeight,
+                  void *dst, int dstWidth, int dstHeight, void *scratchBuf)
+{
+    if (srcWidth < 2 || srcHeight < 1 || dstWidth < 2 || dstHeight < 1 ||
+            ((srcWidth | dstWidth) & 1) || !scratchBuf)
+        return false;
+
+    if (srcWidth == dstWidth && srcHeight == dstHeight) {
+        copyRow((uint8_t *)dst, (const uint8_t *)src, srcWidth * srcHeight * 2);
+        copyDone();
+        return true;
+    }
+
+    const int rowBytes = srcWidth * 2;
+    const int srcPairs = srcWidth / 2;
+    const int dstPairs = dstWidth / 2;
+    const int maxCols = (srcWidth + dstWidth - 1) / dstWidth;
+
+    /*
+     * Column sums of the rows behind one output row, turned into running
+     * sums along each of Y, U and V so any box is the difference of two
+     * entries. Four zero words in front of them stand in for "before the
+     * first column". Then the box ends and widths, then 1 / area per width.
+     */
+    int32_t *scratch = (int32_t *)scratchBuf;
+
+    memset(scratch, 0, sizeof(int32_t) * 4);
+    uint32_t *acc = (uint32_t *)scratch + 4;
+    int32_t *yLast = scratch + 4 + rowBytes;
+    int32_t *yCount = yLast + dstWidth;
+    int32_t *cLast = yCount + dstWidth;
+    int32_t *cCount = cLast + dstPairs;
+    uint32_t *recip = (uint32_t *)(cCount + dstPairs);
+    int start;
+
+    for (int x = 0; x < dstWidth; x++) {
+        boxRange(x, dstWidth, srcWidth, &start, &yCount[x]);
+        yLast[x] = (start + yCount[x] - 1) * 2;
+    }
+    for (int p = 0; p < dstPairs; p++) {
+        boxRange(p, dstPairs, srcPairs, &start, &cCount[p]);
+        cLast[p] = (start + cCount[p] - 1) * 4;
+    }
+
+    const uint8_t *in = (const uint8_t *)src;
+    uint8_t *out = (uint8_t *)dst;
+
+    for (int dy = 0; dy < dstHeight; dy++) {
+        int y0, rows;
+        boxRange(dy, dstHeight, srcHeight, &y0, &rows);
+
+        memset(acc, 0, sizeof(uint32_t) * rowBytes);
+        for (int y = y0; y < y0 + rows; y++)
+            accumulateRow(acc, in + y * rowBytes, rowBytes);
+
+        for (int i = 2; i < rowBytes; i += 2)
+            acc[i] += acc[i - 2];
+        for (int i = 5; i < rowBytes; i += 4) {
+            acc[i] += acc[i - 4];
+            acc[i + 2] += acc[i - 2];
+        }
+
+        for (int c = 1; c <= maxCols; c++)
+            recip[c] = (uint32_t)((0x80000000ULL + rows * c - 1) / (rows * c));
+
+        for (int p = 0; p < dstPairs; p++) {
+            const int x = p * 2;
+            const int c = cLast[p];
+            const int cw = cCount[p] * 4;
+
+            out[0] = boxAverage(acc[yLast[x]] - acc[yLast[x] - yCount[x] * 2],
+                                rows * yCount[x], recip[yCount[x]]);
+            out[1] = boxAverage(acc[c + 1] - acc[c + 1 - cw],
+                                rows * cCount[p], recip[cCount[p]]);
+            out[2] = boxAverage(acc[yLast[x + 1]] - acc[yLast[x + 1] - yCount[x + 1] * 2],
+                                rows * yCount[x + 1], recip[yCount[x + 1]]);
+            out[3] = boxAverage(acc[c + 3] - acc[c + 3 - cw],
+                                rows * cCount[p], recip[cCount[p]]);
+            out += 4;
+        }
+    }
+
+    return true;
+}
+
+}; // namespace android
@@ -0,0 +1,80 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
+#define ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Copy a packed YUV420 planar (Y, U, V) frame into a YV12 gralloc buffer
+ * (Y, V, U) whose luma rows are dstStride bytes apart and chroma rows
+ * dstStride / 2 bytes apart. All three planes are written in one pass.
+ */
+void secCopyYuv420ToYv12(const void *src, void *dst,
+                         int width, int height, int dstStride);
+
+/*
+ * The reverse of secCopyYuv420ToYv12(): copy a YV12 buffer whose luma rows
+ * are srcStride bytes apart back into a packed YUV420 planar frame.
+ */
+void secCopyYv12ToYuv420(const void *src, void *dst,
+                         int width, int height, int srcStride);
+
+/*
+ * Convert a planar YUV420 frame into NV21 (Y plane followed by interleaved
+ * V/U) in dst. The planes are passed separately so both YUV420P and YV12
+ * sources can be converted; yStride and cStride are the source row pitches.
+ * The source is only read.
+ */
+void secConvertPlanarToNv21(const void *srcY, const void *srcU, const void *srcV,
+                            int yStride, int cStride,
+                            void *dst, int width, int height);
+
+/*
+ * Convert a packed YUYV (YUV422) frame into NV21 in one pass over the
+ * source: each pair of rows gives two luma rows and one V/U row, chroma
+ * taken from the first row of the pair. srcStride is the source row pitch
+ * in bytes; dst may be a heap or a gralloc buffer with dstStride byte
+ * rows, its VU plane starting dstStride * height bytes in.
+ */
+void secConvertYuyvToNv21(const void *src, int srcStride,
+                          void *dst, int dstStride, int width, int height);
+
+/*
+ * Bytes of row scratch secScaleYuyv() needs for these widths, or 0 when
+ * they are not a valid pair.
+ */
+size_t secScaleYuyvScratchSize(int srcWidth, int dstWidth);
+
+/*
+ * Scale a packed YUYV (YUV422) frame to dstWidth x dstHeight with a box
+ * filter: every output sample is the average of the source area it covers,
+ * so any ratio works without the aliasing of point sampling. Upscaling
+ * degrades to nearest neighbour. Both widths must be even. scratch is
+ * caller-owned, 4-byte aligned and secScaleYuyvScratchSize() bytes long,
+ * so repeated calls allocate nothing. Returns false on bad geometry.
+ */
+bool secScaleYuyv(const void *src, int srcWidth, int srcHeight,
+                  void *dst, int dstWidth, int dstHeight, void *scratch);
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_IMAGE_H
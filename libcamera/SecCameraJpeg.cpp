@@ -0,0 +1,226 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "SecCameraJpeg.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace android {
+
+/*
+ * Entropy coded data only holds 0xFF as FF 00 stuffing or a marker, so
+ * 0xFF bytes are sparse; let the (vectorized) libc memchr skip between
+ * them and only look at the byte that follows.
+ */
+int secJpegFindEOI(const uint8_t *buf, int len)
+{
+    const uint8_t *p = buf;
+    const uint8_t *end = buf + len;
+
+    while (p < end) {
+        p = (const uint8_t *)memchr(p, 0xFF, end - p);
+        if (!p)
+            return -1;
+        if (p[1] == 0xD9)
+            return p - buf;
+        p++;
+    }
+
+    return -1;
+}
+
+/*
+ * Four words per step: pick the leading byte of each little-endian word
+ * and stop at the first block where one of them is 0xFF. The exact word is
+ * then found with the scalar loop.
+ */
+int secJpegWordRun(const uint8_t *buf, int len)
+{
+    const int words = len / 4;
+    int i = 0;
+
+#if defined(__ARM_NEON__)
+    const uint32x4_t lead = vdupq_n_u32(0xFF);
+    for (; i + 4 <= words; i += 4) {
+        uint32x4_t w = vreinterpretq_u32_u8(vld1q_u8(buf + i * 4));
+        uint32x4_t m = vceqq_u32(vandq_u32(w, lead), lead);
+        uint32x2_t r = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+        if (vget_lane_u32(r, 0) | vget_lane_u32(r, 1))
+            break;
+    }
+#elif defined(__SSE2__)
+    const __m128i ff = _mm_set1_epi8((char)0xFF);
+    for (; i + 4 <= words; i += 4) {
+        __m128i w = _mm_loadu_si128((const __m128i *)(buf + i * 4));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(w, ff)) & 0x1111)
+            break;
+    }
+#endif
+
+    for (; i < words; i++) {
+        if (buf[i * 4] == 0xFF)
+            break;
+    }
+
+    return i * 4;
+}
+
+enum {
+    SONY_DEMUX_RUN,     /* copying JPEG words up to the next 0xFF-led word */
+    SONY_DEMUX_CODE,    /* classifying a 0xFF-led word */
+    SONY_DEMUX_LINE     /* copying a YUV line and checking its end code */
+};
+
+enum {
+    SONY_CODE_JPEG,
+    SONY_CODE_PAD,
+    SONY_CODE_YUV_START
+};
+
+/* 0xFF-led words with a meaning of their own, as little-endian words */
+static const struct {
+    uint32_t    mask;
+    uint32_t    value;
+    int         code;
+} sony_codes[] = {
+    { 0xFFFFFFFF, 0xFFFFFFFF, SONY_CODE_PAD },
+    { 0xFFFFFFFF, 0x02FFFFFF, SONY_CODE_PAD },
+    { 0xFFFFFFFF, 0xFF02FFFF, SONY_CODE_PAD },
+    { 0x0000FFFF, 0x000005FF, SONY_CODE_YUV_START },    /* FF 05 */
+};
+
+#define SONY_YUV_END_0  0xFF
+#define SONY_YUV_END_1  0x06                            /* FF 06 */
+
+static inline int sonyCode(const uint8_t *p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+
+    for (size_t i = 0; i < sizeof(sony_codes) / sizeof(sony_codes[0]); i++) {
+        if ((word & sony_codes[i].mask) == sony_codes[i].value)
+            return sony_codes[i].code;
+    }
+
+    /* anything else, the EOI included, is JPEG */
+    return SONY_CODE_JPEG;
+}
+
+/* copy n JPEG bytes, clipped to what is left of the destination */
+static inline void sonyCopyJpeg(uint8_t *jpeg, int jpegMax, int jsize,
+                                const uint8_t *src, int n)
+{
+    if (jsize + n > jpegMax)
+        n = jpegMax - jsize;
+    if (n > 0)
+        memcpy(jpeg + jsize, src, n);
+}
+
+bool secJpegDemuxSony(const uint8_t *src, int size,
+                      int yuvWidth, int yuvHeight,
+                      void *jpeg, int jpegMax, int *jpegSize, void *yuv)
+{
+    const int line = yuvWidth * 2;
+    const uint8_t *p = src;
+    const uint8_t *last = NULL;     /* source of the last JPEG word */
+    uint8_t *j = (uint8_t *)jpeg;
+    uint8_t *y = (uint8_t *)yuv;
+    int jsize = 0;
+    int ysize = 0;
+    int n;
+    int i = 0;
+    int state = SONY_DEMUX_RUN;
+
+    /* a started YUV line is always finished, even at the end of the data */
+    while (i < size || state == SONY_DEMUX_LINE) {
+        switch (state) {
+        case SONY_DEMUX_RUN:
+            n = secJpegWordRun(p, size - i);
+            if (n) {
+                if (j)
+                    sonyCopyJpeg(j, jpegMax, jsize, p, n);
+                jsize += n;
+                last = p + n - 4;
+            }
+            p += n;
+            i += n;
+            state = SONY_DEMUX_CODE;
+            break;
+
+        case SONY_DEMUX_CODE:
+            switch (sonyCode(p)) {
+            case SONY_CODE_PAD:
+                p += 4;
+                i += 4;
+                break;
+            case SONY_CODE_YUV_START:
+                p += 2;
+                i += 2;
+                state = SONY_DEMUX_LINE;
+                continue;
+            default:
+                if (j)
+                    sonyCopyJpeg(j, jpegMax, jsize, p, 4);
+                jsize += 4;
+                last = p;
+                p += 4;
+                i += 4;
+                break;
+            }
+            state = SONY_DEMUX_RUN;
+            break;
+
+        case SONY_DEMUX_LINE:
+            if (y) {
+                memcpy(y, p, line);
+                y += line;
+                ysize += line;
+            }
+            p += line;
+            i += line;
+
+            if (p[0] != SONY_YUV_END_0 || p[1] != SONY_YUV_END_1)
+                return false;
+            p += 2;
+            i += 2;
+            state = SONY_DEMUX_RUN;
+            break;
+        }
+    }
+
+    // Remove Padding after EOI, the output always ends on the last word
+    for (n = 3; n > 0 && last; n--) {
+        if (last[n] != 0xFF)
+            break;
+        jsize--;
+    }
+    if (jpegSize)
+        *jpegSize = jsize;
+
+    if (y && ysize != line * yuvHeight)
+        return false;
+
+    return true;
+}
+
+}; // namespace android
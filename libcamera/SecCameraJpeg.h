@@ -0,0 +1,60 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_JPEG_H
+#define ANDROID_HARDWARE_CAMERA_SEC_JPEG_H
+
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Offset of the first JPEG EOI marker (FF D9) that starts inside
+ * [buf, buf + len), or -1 when there is none. Like the byte-wise check it
+ * replaces, a 0xFF in the last byte is matched against buf[len], so one
+ * byte past the range must be readable.
+ */
+int secJpegFindEOI(const uint8_t *buf, int len);
+
+/*
+ * Number of bytes, a multiple of 4, that can be taken from buf as pure
+ * JPEG words in the Sony interleaved format: the length of the run before
+ * the first 4-byte word whose leading byte is 0xFF. Padding, YUV start
+ * codes and the EOI all begin with 0xFF, so such a word has to be looked
+ * at on its own. len is rounded down to whole words.
+ */
+int secJpegWordRun(const uint8_t *buf, int len);
+
+/*
+ * Split a Sony interleaved capture into the JPEG stream and the YUV422
+ * postview in one pass. JPEG words are copied in runs; words starting with
+ * 0xFF are classified against a small code table and drive the parser
+ * between the JPEG, YUV line and end-code states. Either destination may
+ * be NULL to drop that stream; at most jpegMax bytes are written to jpeg.
+ * *jpegSize, when given, gets the JPEG length with up to three 0xFF bytes
+ * of word padding after the EOI trimmed, also when jpeg is NULL.
+ *
+ * Returns false on a YUV line without its end code or, when yuv is given,
+ * when the postview is not exactly yuvWidth * yuvHeight * 2 bytes.
+ */
+bool secJpegDemuxSony(const uint8_t *src, int size,
+                      int yuvWidth, int yuvHeight,
+                      void *jpeg, int jpegMax, int *jpegSize, void *yuv);
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_JPEG_H
@@ -0,0 +1,86 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_QUEUE_H
+#define ANDROID_HARDWARE_CAMERA_SEC_QUEUE_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+struct SecPreviewFrame {
+    int         index;
+    nsecs_t     timestamp;
+    bool        callback;
+    int         owner;      /* SecCamera::PREVIEW_OWNER_* held for the stage */
+    int         cbSlot;     /* mPreviewCbHeap slot with the client's copy, or -1 */
+};
+
+/*
+ * Bounded single producer / single consumer ring of preview frame
+ * descriptors. The producer only writes m_tail and the consumer only
+ * writes m_head, so neither side takes a lock; the release store of one
+ * index publishes the slot contents to the acquire load on the other side.
+ */
+class SecFrameQueue {
+public:
+    enum { CAPACITY = 4 };
+
+    SecFrameQueue() : m_head(0), m_tail(0) {}
+
+    /* producer side, false when the ring is full */
+    bool push(const SecPreviewFrame &frame)
+    {
+        int32_t tail = m_tail;
+        if (tail - android_atomic_acquire_load(&m_head) >= CAPACITY)
+            return false;
+
+        m_frames[tail & (CAPACITY - 1)] = frame;
+        android_atomic_release_store(tail + 1, &m_tail);
+        return true;
+    }
+
+    /* consumer side, false when the ring is empty */
+    bool pop(SecPreviewFrame *frame)
+    {
+        int32_t head = m_head;
+        if (head == android_atomic_acquire_load(&m_tail))
+            return false;
+
+        *frame = m_frames[head & (CAPACITY - 1)];
+        android_atomic_release_store(head + 1, &m_head);
+        return true;
+    }
+
+    int size() const
+    {
+        return android_atomic_acquire_load(&m_tail) - android_atomic_acquire_load(&m_head);
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    SecPreviewFrame m_frames[CAPACITY];
+    volatile int32_t m_head;
+    volatile int32_t m_tail;
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_QUEUE_H
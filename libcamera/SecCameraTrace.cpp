@@ -0,0 +1,155 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "SecCameraTrace"
+#include <utils/Log.h>
+
+#include "SecCameraTrace.h"
+
+#include <stdio.h>
+
+namespace android {
+
+#define SEC_TRACE_US_MAX    0x7FFFFFFF
+
+static const char *trace_point_names[SEC_TRACE_POINT_COUNT] = {
+    "preview dqbuf",
+    "preview display",
+    "preview convert",
+    "preview callback",
+    "record dqbuf",
+    "record callback",
+    "snapshot",
+    "capture to jpeg",
+    "exif",
+    "autofocus",
+    "preview start",
+    "first frame",
+    "open first frame",
+    "record open wait",
+};
+
+/*
+ * Below 4us every value has its own bucket; above, bucket 4 * (msb - 1) +
+ * the two bits under the most significant one.
+ */
+int SecLatencyHistogram::bucketOf(uint32_t us)
+{
+    if (us < 4)
+        return us;
+
+    int msb = 31 - __builtin_clz(us);
+    return (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+}
+
+/* largest value that falls into the bucket */
+int32_t SecLatencyHistogram::bucketLimit(int bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    int msb = bucket / 4 + 1;
+    int64_t limit = ((int64_t)(5 + bucket % 4) << (msb - 2)) - 1;
+    return limit > SEC_TRACE_US_MAX ? SEC_TRACE_US_MAX : (int32_t)limit;
+}
+
+void SecLatencyHistogram::record(nsecs_t duration)
+{
+    int64_t us = ns2us(duration);
+    if (us < 0)
+        us = 0;
+    if (us > SEC_TRACE_US_MAX)
+        us = SEC_TRACE_US_MAX;
+
+    android_atomic_inc(&m_buckets[bucketOf((uint32_t)us)]);
+    android_atomic_inc(&m_count);
+
+    int32_t max;
+    do {
+        max = android_atomic_acquire_load(&m_max);
+        if (max >= us)
+            break;
+    } while (android_atomic_cmpxchg(max, (int32_t)us, &m_max));
+}
+
+void SecLatencyHistogram::reset(void)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        android_atomic_release_store(0, &m_buckets[i]);
+    android_atomic_release_store(0, &m_count);
+    android_atomic_release_store(0, &m_max);
+}
+
+int32_t SecLatencyHistogram::percentile(int pct) const
+{
+    int32_t snapshot[BUCKETS];
+    int64_t total = 0;
+
+    /* count the buckets rather than m_count so the walk always ends */
+    for (int i = 0; i < BUCKETS; i++) {
+        snapshot[i] = android_atomic_acquire_load(&m_buckets[i]);
+        total += snapshot[i];
+    }
+    if (!total)
+        return 0;
+
+    int64_t rank = (total * pct + 99) / 100;
+    int64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += snapshot[i];
+        if (seen >= rank) {
+            int32_t limit = bucketLimit(i);
+            int32_t max = this->max();
+            return limit < max ? limit : max;
+        }
+    }
+
+    return max();
+}
+
+void SecCameraTrace::reset(void)
+{
+    for (int i = 0; i < SEC_TRACE_POINT_COUNT; i++)
+        m_points[i].reset();
+}
+
+void SecCameraTrace::dump(String8 &result) const
+{
+    char buffer[256];
+
+    for (int i = 0; i < SEC_TRACE_POINT_COUNT; i++) {
+        const SecLatencyHistogram &h = m_points[i];
+        if (!h.count())
+            continue;
+
+        snprintf(buffer, sizeof(buffer),
+                 "  %-16s n(%d) p50(%dus) p95(%dus) p99(%dus) max(%dus)\n",
+                 name(i), h.count(), h.percentile(50), h.percentile(95),
+                 h.percentile(99), h.max());
+        result.append(buffer);
+    }
+}
+
+const char *SecCameraTrace::name(int point)
+{
+    if (0 <= point && point < SEC_TRACE_POINT_COUNT)
+        return trace_point_names[point];
+    return "unknown";
+}
+
+}; // namespace android
@@ -0,0 +1,114 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef ANDROID_HARDWARE_CAMERA_SEC_TRACE_H
+#define ANDROID_HARDWARE_CAMERA_SEC_TRACE_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+enum SEC_TRACE_POINT {
+    SEC_TRACE_PREVIEW_DQBUF,    /* poll + dqbuf of a preview frame */
+    SEC_TRACE_PREVIEW_DISPLAY,  /* frame handed to the preview window */
+    SEC_TRACE_PREVIEW_CONVERT,  /* NV21 / YV12 callback conversion */
+    SEC_TRACE_PREVIEW_CALLBACK, /* CAMERA_MSG_PREVIEW_FRAME data callback */
+    SEC_TRACE_RECORD_DQBUF,     /* poll + dqbuf of a record frame */
+    SEC_TRACE_RECORD_CALLBACK,  /* CAMERA_MSG_VIDEO_FRAME data callback */
+    SEC_TRACE_SNAPSHOT,         /* sensor capture until the frame is dequeued */
+    SEC_TRACE_CAPTURE_TO_JPEG,  /* takePicture until the JPEG stream is split out */
+    SEC_TRACE_EXIF,             /* EXIF and thumbnail build */
+    SEC_TRACE_AUTOFOCUS,        /* AF start until the sensor reports a result */
+    SEC_TRACE_PREVIEW_START,    /* SecCamera::startPreview() call */
+    SEC_TRACE_PREVIEW_FIRST,    /* startPreview() until the first frame is dequeued */
+    SEC_TRACE_OPEN_FIRST,       /* initCamera() until the first preview frame */
+    SEC_TRACE_RECORD_OPEN,      /* startRecord() waiting for the record node */
+    SEC_TRACE_POINT_COUNT
+};
+
+/*
+ * Fixed size latency histogram in microseconds. Buckets split every power
+ * of two into four, so a percentile is reported within 25% of the real
+ * value. record() only does atomic increments and a cmpxchg for the max,
+ * so it can be called from any thread without a lock; readers may see a
+ * sample counted in m_count before it shows up in its bucket.
+ */
+class SecLatencyHistogram {
+public:
+    enum { BUCKETS = 124 };
+
+    SecLatencyHistogram() { reset(); }
+
+    void        record(nsecs_t duration);
+    void        reset(void);
+
+    int32_t     count(void) const { return android_atomic_acquire_load(&m_count); }
+    int32_t     max(void) const { return android_atomic_acquire_load(&m_max); }
+    int32_t     percentile(int pct) const;
+
+private:
+    static int      bucketOf(uint32_t us);
+    static int32_t  bucketLimit(int bucket);
+
+    volatile int32_t m_buckets[BUCKETS];
+    volatile int32_t m_count;
+    volatile int32_t m_max;
+};
+
+class SecCameraTrace {
+public:
+    void        record(int point, nsecs_t duration)
+    {
+        if (0 <= point && point < SEC_TRACE_POINT_COUNT)
+            m_points[point].record(duration);
+    }
+
+    void        reset(void);
+
+    /* one line per trace point that has samples */
+    void        dump(String8 &result) const;
+
+    static const char *name(int point);
+
+private:
+    SecLatencyHistogram m_points[SEC_TRACE_POINT_COUNT];
+};
+
+/* records the lifetime of the scope into a trace point */
+class SecTraceScope {
+public:
+    SecTraceScope(SecCameraTrace *trace, int point)
+        : m_trace(trace), m_point(point),
+          m_start(systemTime(SYSTEM_TIME_MONOTONIC)) {}
+
+    ~SecTraceScope()
+    {
+        m_trace->record(m_point, systemTime(SYSTEM_TIME_MONOTONIC) - m_start);
+    }
+
+private:
+    SecCameraTrace  *m_trace;
+    int             m_point;
+    nsecs_t         m_start;
+};
+
+}; // namespace android
+
+#endif // ANDROID_HARDWARE_CAMERA_SEC_TRACE_H
@@ -0,0 +1,98 @@
+LOCAL_PATH:= $(call my-dir)
+
+# SecCamera on the in-process fake FIMC device: preview, preview buffer
+# ownership, sensor ctrl, record and JPEG capture checks and timings. The
+# fake is only ever linked in here, the HAL always talks to the real nodes.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_C_INCLUDES += hardware/samsung/exynos3/s5pc110/include
+LOCAL_C_INCLUDES += hardware/samsung/exynos3/s5pc110/libs3cjpeg
+
+LOCAL_SRC_FILES:= \
+	SecCameraFakeFimcTest.cpp \
+	../SecCamera.cpp \
+	../SecCameraBackend.cpp \
+	../SecCameraFakeFimc.cpp \
+	../SecCameraImage.cpp \
+	../SecCameraTrace.cpp \
+	../SecCameraExif.cpp \
+
+LOCAL_SHARED_LIBRARIES:= libutils libcutils liblog libs3cjpeg
+
+LOCAL_MODULE := camera_fake_fimc_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_EXECUTABLE)
+
+# The YV12 plane copiers, the planar and YUYV to NV21 converters and
+# secScaleYuyv() against plain reference implementations, plus timings.
+# Plain C on plain buffers, so it runs on the build host.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+
+LOCAL_SRC_FILES:= \
+	SecCameraImageTest.cpp \
+	../SecCameraImage.cpp \
+
+LOCAL_MODULE := camera_image_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# SecExifWriter output walked tag by tag, with GPS and thumbnail on and
+# off. Only needs the EXIF types from the encoder's header, so it also
+# runs on the build host.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+LOCAL_C_INCLUDES += hardware/samsung/exynos3/s5pc110/libs3cjpeg
+
+LOCAL_SRC_FILES:= \
+	SecCameraExifTest.cpp \
+	../SecCameraExif.cpp \
+
+LOCAL_MODULE := camera_exif_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# SecFrameQueue ordering, full and empty rings and index wrap, then a
+# producer and a consumer thread against each other. Header only, so it
+# runs on the build host.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+
+LOCAL_SRC_FILES:= \
+	SecCameraQueueTest.cpp \
+
+LOCAL_STATIC_LIBRARIES := libcutils
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE := camera_queue_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# The JPEG marker scanners and the Sony demuxer against the loops they
+# replaced, plus timings on capture-sized streams. Plain C on plain
+# buffers, so it runs on the build host.
+include $(CLEAR_VARS)
+
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/..
+
+LOCAL_SRC_FILES:= \
+	SecCameraJpegTest.cpp \
+	../SecCameraJpeg.cpp \
+
+LOCAL_MODULE := camera_jpeg_test
+
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_HOST_EXECUTABLE)
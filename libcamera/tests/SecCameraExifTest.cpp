@@ -0,0 +1,371 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Feeds a fixed exif_attribute_t through SecExifWriter::write() with GPS
+ * and thumbnail each on and off, walks the APP1 segment that comes out
+ * and checks its length, the tags and their order in every IFD, that every
+ * value lies inside the segment and that IFD1 points at the thumbnail.
+ * Exits non-zero on the first failure.
+ *
+ * usage: camera_exif_test
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "SecCameraExif.h"
+
+using namespace android;
+
+static int failures;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+#define ARRAY_SIZE(a)   ((int)(sizeof(a) / sizeof((a)[0])))
+
+#define APP1_HEADER     10      /* FF E1, length, "Exif\0\0" */
+#define THUMB_SIZE      200
+#define SEGMENT_MAX     (0xFFFF + 2)
+
+static const unsigned short ifd0Tags[] = {
+    0x0100, 0x0101, 0x010F, 0x0110, 0x0112, 0x0131, 0x0132, 0x0213, 0x8769, 0x8825
+};
+static const unsigned short exifTags[] = {
+    0x829A, 0x829D, 0x8822, 0x8827, 0x9000, 0x9003, 0x9004, 0x9201,
+    0x9202, 0x9203, 0x9204, 0x9205, 0x9207, 0x9209, 0x920A, 0x9286,
+    0xA001, 0xA002, 0xA003, 0xA402, 0xA403, 0xA406
+};
+static const unsigned short gpsTags[] = {
+    0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007, 0x001B, 0x001D
+};
+static const unsigned short ifd1Tags[] = {
+    0x0100, 0x0101, 0x0103, 0x0112, 0x011A, 0x011B, 0x0128, 0x0201, 0x0202
+};
+
+static unsigned get16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* what the camera fills in once, plus one shot's worth of changing fields */
+static void fixedAttributes(exif_attribute_t *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    strcpy((char *)info->maker, "SAMSUNG");
+    strcpy((char *)info->model, "Nexus S");
+    strcpy((char *)info->software, "GINGERBREAD");
+    memcpy(info->exif_version, "0220", 4);
+    strcpy((char *)info->user_comment, "User comments");
+    info->ycbcr_positioning = 1;
+    info->fnumber.num = 26;
+    info->fnumber.den = 10;
+    info->exposure_program = 3;
+    info->aperture.num = 28;
+    info->aperture.den = 10;
+    info->max_aperture = info->aperture;
+    info->focal_length.num = 343;
+    info->focal_length.den = 100;
+    info->color_space = 1;
+    info->exposure_mode = 0;
+    info->gps_version_id[0] = 2;
+    info->gps_version_id[1] = 2;
+    info->compression_scheme = 6;
+    info->x_resolution.num = 72;
+    info->x_resolution.den = 1;
+    info->y_resolution = info->x_resolution;
+    info->resolution_unit = 2;
+
+    info->width = 2560;
+    info->height = 1920;
+    info->orientation = 6;
+    strcpy((char *)info->date_time, "2013:01:02 03:04:05");
+    info->exposure_time.num = 1;
+    info->exposure_time.den = 30;
+    info->iso_speed_rating = 200;
+    info->shutter_speed.num = 49;
+    info->shutter_speed.den = 10;
+    info->brightness.num = -20;
+    info->brightness.den = 10;
+    info->metering_mode = 2;
+    info->flash = 1;
+    info->white_balance = 0;
+    info->scene_capture_type = 2;
+    info->widthThumb = 320;
+    info->heightThumb = 240;
+
+    strcpy((char *)info->gps_latitude_ref, "N");
+    info->gps_latitude[0].num = 37;
+    info->gps_latitude[0].den = 1;
+    info->gps_latitude[1].num = 46;
+    info->gps_latitude[1].den = 1;
+    info->gps_latitude[2].num = 2940;
+    info->gps_latitude[2].den = 100;
+    strcpy((char *)info->gps_longitude_ref, "W");
+    info->gps_longitude[0].num = 122;
+    info->gps_longitude[0].den = 1;
+    info->gps_longitude[1].num = 25;
+    info->gps_longitude[1].den = 1;
+    info->gps_longitude[2].num = 950;
+    info->gps_longitude[2].den = 100;
+    info->gps_altitude_ref = 0;
+    info->gps_altitude.num = 1234;
+    info->gps_altitude.den = 100;
+    info->gps_timestamp[0].num = 3;
+    info->gps_timestamp[0].den = 1;
+    info->gps_timestamp[1].num = 4;
+    info->gps_timestamp[1].den = 1;
+    info->gps_timestamp[2].num = 5;
+    info->gps_timestamp[2].den = 1;
+    strcpy((char *)info->gps_datestamp, "2013:01:02");
+    strcpy((char *)info->gps_processing_method, "GPS");
+}
+
+static int typeSize(unsigned type)
+{
+    switch (type) {
+    case 3:
+        return 2;
+    case 4:
+        return 4;
+    case 5:
+    case 10:
+        return 8;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Checks the IFD at offset ifd of the TIFF data holds exactly tags, in
+ * that (ascending) order, with every value inside the size bytes of TIFF
+ * data and clear of the entries. Returns the offset of its first entry
+ * and stores the next IFD offset.
+ */
+static int checkIfd(const unsigned char *tiff, int size, int ifd,
+                    const unsigned short *tags, int count, unsigned *next)
+{
+    if (ifd < 8 || ifd + 2 > size || get16(tiff + ifd) != (unsigned)count) {
+        fprintf(stderr, "IFD at %d: bad offset or entry count\n", ifd);
+        failures++;
+        return -1;
+    }
+
+    int entries = ifd + 2;
+    int end = entries + count * 12 + 4;
+    if (end > size) {
+        fprintf(stderr, "IFD at %d runs past the segment\n", ifd);
+        failures++;
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char *e = tiff + entries + i * 12;
+        unsigned tag = get16(e);
+        unsigned bytes = get32(e + 4) * typeSize(get16(e + 2));
+
+        if (tag != tags[i] || (i && tag <= get16(e - 12))) {
+            fprintf(stderr, "IFD at %d: entry %d is tag 0x%04x, expected 0x%04x\n",
+                    ifd, i, tag, tags[i]);
+            failures++;
+            return -1;
+        }
+        if (bytes > 4) {
+            unsigned value = get32(e + 8);
+            if (value < (unsigned)end || value + bytes > (unsigned)size || (value & 1)) {
+                fprintf(stderr, "IFD at %d: tag 0x%04x value at %u+%u out of place\n",
+                        ifd, tag, value, bytes);
+                failures++;
+                return -1;
+            }
+        }
+    }
+
+    *next = get32(tiff + end - 4);
+    return entries;
+}
+
+/* the value of entry index of the IFD whose entries start at entries */
+static const unsigned char *value(const unsigned char *tiff, int entries, int index)
+{
+    const unsigned char *e = tiff + entries + index * 12;
+    unsigned bytes = get32(e + 4) * typeSize(get16(e + 2));
+
+    return bytes > 4 ? tiff + get32(e + 8) : e + 8;
+}
+
+static bool checkSegment(const unsigned char *app1, int size, const exif_attribute_t *info,
+                         bool gps, const unsigned char *thumb, int thumbSize)
+{
+    EXPECT(size > APP1_HEADER + 8 && size <= SEGMENT_MAX);
+    EXPECT(app1[0] == 0xFF && app1[1] == 0xE1);
+    /* the length is big endian, counts itself but not the marker */
+    EXPECT((unsigned)((app1[2] << 8) | app1[3]) == (unsigned)size - 2);
+    EXPECT(!memcmp(app1 + 4, "Exif\0\0", 6));
+
+    const unsigned char *tiff = app1 + APP1_HEADER;
+    const int tiffSize = size - APP1_HEADER;
+    EXPECT(!memcmp(tiff, "II\x2A\0", 4) && get32(tiff + 4) == 8);
+
+    unsigned next, unused;
+    int ifd0 = checkIfd(tiff, tiffSize, 8, ifd0Tags, ARRAY_SIZE(ifd0Tags) - !gps, &next);
+    EXPECT(ifd0 >= 0);
+    EXPECT(get32(value(tiff, ifd0, 0)) == info->width);
+    EXPECT(get32(value(tiff, ifd0, 1)) == info->height);
+    EXPECT(!strcmp((const char *)value(tiff, ifd0, 2), (const char *)info->maker));
+    EXPECT(get16(value(tiff, ifd0, 4)) == info->orientation);
+    EXPECT(!strcmp((const char *)value(tiff, ifd0, 6), (const char *)info->date_time));
+
+    int exif = checkIfd(tiff, tiffSize, get32(value(tiff, ifd0, 8)),
+                        exifTags, ARRAY_SIZE(exifTags), &unused);
+    EXPECT(exif >= 0);
+    EXPECT(unused == 0);
+    EXPECT(get32(value(tiff, exif, 0)) == info->exposure_time.num &&
+           get32(value(tiff, exif, 0) + 4) == info->exposure_time.den);
+    EXPECT(get16(value(tiff, exif, 3)) == info->iso_speed_rating);
+    EXPECT(!strcmp((const char *)value(tiff, exif, 5), (const char *)info->date_time));
+    EXPECT((int)get32(value(tiff, exif, 9)) == info->brightness.num);
+    EXPECT(!memcmp(value(tiff, exif, 15), "ASCII\0\0\0User comments", 21));
+    EXPECT(get32(value(tiff, exif, 17)) == info->width);
+
+    if (gps) {
+        int gpsIfd = checkIfd(tiff, tiffSize, get32(value(tiff, ifd0, 9)),
+                              gpsTags, ARRAY_SIZE(gpsTags), &unused);
+        EXPECT(gpsIfd >= 0);
+        EXPECT(unused == 0);
+        EXPECT(value(tiff, gpsIfd, 1)[0] == info->gps_latitude_ref[0]);
+        for (int i = 0; i < 3; i++) {
+            EXPECT(get32(value(tiff, gpsIfd, 2) + i * 8) == info->gps_latitude[i].num);
+            EXPECT(get32(value(tiff, gpsIfd, 4) + i * 8 + 4) == info->gps_longitude[i].den);
+        }
+        /* the method is patched per shot, its count with it */
+        size_t method = strlen((const char *)info->gps_processing_method);
+        EXPECT(get32(tiff + gpsIfd + 8 * 12 + 4) == 8 + method);
+        EXPECT(!memcmp(value(tiff, gpsIfd, 8), "ASCII\0\0\0", 8));
+        EXPECT(!memcmp(value(tiff, gpsIfd, 8) + 8, info->gps_processing_method, method));
+        EXPECT(!strcmp((const char *)value(tiff, gpsIfd, 9), (const char *)info->gps_datestamp));
+    }
+
+    if (!thumb) {
+        EXPECT(next == 0);
+        return true;
+    }
+
+    int ifd1 = checkIfd(tiff, tiffSize, next, ifd1Tags, ARRAY_SIZE(ifd1Tags), &unused);
+    EXPECT(ifd1 >= 0);
+    EXPECT(unused == 0);
+    EXPECT(get32(value(tiff, ifd1, 0)) == info->widthThumb);
+    EXPECT(get32(value(tiff, ifd1, 1)) == info->heightThumb);
+    /* the thumbnail closes the segment, reachable through IFD1 */
+    unsigned offset = get32(value(tiff, ifd1, 7));
+    EXPECT(get32(value(tiff, ifd1, 8)) == (unsigned)thumbSize);
+    EXPECT(offset + thumbSize == (unsigned)tiffSize);
+    EXPECT(!memcmp(tiff + offset, thumb, thumbSize));
+
+    return true;
+}
+
+static bool testLayouts(void)
+{
+    static unsigned char app1[SEGMENT_MAX];
+    unsigned char thumb[THUMB_SIZE];
+    exif_attribute_t info;
+    SecExifWriter writer;
+
+    memset(thumb, 0x5a, sizeof(thumb));
+    thumb[0] = 0xFF;
+    thumb[1] = 0xD8;
+    thumb[THUMB_SIZE - 2] = 0xFF;
+    thumb[THUMB_SIZE - 1] = 0xD9;
+
+    fixedAttributes(&info);
+
+    for (int gps = 0; gps < 2; gps++) {
+        for (int withThumb = 0; withThumb < 2; withThumb++) {
+            info.enableGps = gps;
+            info.enableThumb = withThumb;
+
+            memset(app1, 0xee, sizeof(app1));
+            int size = writer.write(app1, &info, thumb, sizeof(thumb), SEGMENT_MAX);
+            printf("gps %d thumbnail %d: %d bytes\n", gps, withThumb, size);
+            if (!checkSegment(app1, size, &info, gps, withThumb ? thumb : NULL, THUMB_SIZE))
+                return false;
+
+            /* a second shot reuses the template, only the shot fields move */
+            info.iso_speed_rating = 400;
+            info.orientation = 1;
+            strcpy((char *)info.gps_processing_method, "NETWORK");
+            int again = writer.write(app1, &info, thumb, sizeof(thumb), SEGMENT_MAX);
+            bool ok = checkSegment(app1, again, &info, gps, withThumb ? thumb : NULL, THUMB_SIZE);
+            fixedAttributes(&info);
+            if (!ok)
+                return false;
+            EXPECT(again == size);
+        }
+    }
+
+    return true;
+}
+
+static bool testLimits(void)
+{
+    static unsigned char app1[SEGMENT_MAX];
+    unsigned char thumb[THUMB_SIZE];
+    exif_attribute_t info;
+    SecExifWriter writer;
+
+    memset(thumb, 0, sizeof(thumb));
+    fixedAttributes(&info);
+    info.enableGps = true;
+    info.enableThumb = true;
+
+    int full = writer.write(app1, &info, thumb, sizeof(thumb), SEGMENT_MAX);
+    EXPECT(full > THUMB_SIZE);
+
+    /* a thumbnail that does not fit is left out, IFD1 with it */
+    int bare = writer.write(app1, &info, thumb, sizeof(thumb), full - 1);
+    EXPECT(bare > 0 && bare <= full - THUMB_SIZE);
+    if (!checkSegment(app1, bare, &info, true, NULL, 0))
+        return false;
+
+    /* nothing fits */
+    EXPECT(writer.write(app1, &info, thumb, sizeof(thumb), bare - 1) < 0);
+
+    return true;
+}
+
+int main(void)
+{
+    if (testLayouts())
+        testLimits();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,419 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Drives SecCamera's preview, record, back camera JPEG and burst capture paths
+ * against the in-process fake FIMC device, checks what comes out and
+ * reports how long each path took. A recording backend in front of the fake
+ * checks when preview buffers go back to the driver and which sensor ctrls
+ * reach it. Exits non-zero on the first failure.
+ *
+ * usage: camera_fake_fimc_test [frames]
+ */
+
+#define LOG_TAG "SecCameraFakeFimcTest"
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/threads.h>
+
+#include "SecCamera.h"
+#include "SecCameraBackend.h"
+
+using namespace android;
+
+#define PREVIEW_WIDTH   640
+#define PREVIEW_HEIGHT  480
+#define RECORD_WIDTH    720
+#define RECORD_HEIGHT   480
+#define PICTURE_WIDTH   2560
+#define PICTURE_HEIGHT  1920
+
+static int failures;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+/*
+ * Passes everything to the fake device and counts, per buffer index, the
+ * VIDIOC_QBUFs on the preview node. Also logs each VIDIOC_S_CTRL in order
+ * and counts the extended ctrl ioctls, which the drivers do not have.
+ */
+class RecordingBackend : public SecCameraBackend {
+public:
+    enum { MAX_CTRLS = 32 };
+
+    explicit RecordingBackend(SecCameraBackend *fake) :
+        m_fake(fake), m_preview_fd(-1), m_ctrl_count(0), m_ext_ctrls(0)
+    {
+        memset(m_qbufs, 0, sizeof(m_qbufs));
+    }
+
+    virtual int open(const char *path, int flags)
+    {
+        int fd = m_fake->open(path, flags);
+        if (fd >= 0 && !strcmp(path, CAMERA_DEV_NAME))
+            m_preview_fd = fd;
+        return fd;
+    }
+
+    virtual int close(int fd)
+    {
+        if (fd == m_preview_fd)
+            m_preview_fd = -1;
+        return m_fake->close(fd);
+    }
+
+    virtual int ioctl(int fd, unsigned long request, void *arg)
+    {
+        if (request == VIDIOC_QBUF && fd == m_preview_fd) {
+            struct v4l2_buffer *buf = (struct v4l2_buffer *)arg;
+            Mutex::Autolock lock(m_lock);
+            if (buf->index < MAX_BUFFERS)
+                m_qbufs[buf->index]++;
+        } else if (request == VIDIOC_S_CTRL) {
+            Mutex::Autolock lock(m_lock);
+            if (m_ctrl_count < MAX_CTRLS)
+                m_ctrls[m_ctrl_count] = *(struct v4l2_control *)arg;
+            m_ctrl_count++;
+        } else if (request == VIDIOC_S_EXT_CTRLS || request == VIDIOC_G_EXT_CTRLS) {
+            Mutex::Autolock lock(m_lock);
+            m_ext_ctrls++;
+        }
+        return m_fake->ioctl(fd, request, arg);
+    }
+
+    virtual void *mmap(void *addr, size_t length, int prot, int flags,
+                       int fd, off_t offset)
+    {
+        return m_fake->mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    virtual int munmap(void *addr, size_t length)
+    {
+        return m_fake->munmap(addr, length);
+    }
+
+    virtual int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+    {
+        return m_fake->poll(fds, nfds, timeout);
+    }
+
+    int qbufs(int index)
+    {
+        Mutex::Autolock lock(m_lock);
+        return m_qbufs[index];
+    }
+
+    void clearCtrls(void)
+    {
+        Mutex::Autolock lock(m_lock);
+        m_ctrl_count = 0;
+    }
+
+    /* the S_CTRLs since clearCtrls() */
+    int ctrls(struct v4l2_control *ctrls, int max)
+    {
+        Mutex::Autolock lock(m_lock);
+        for (int i = 0; i < m_ctrl_count && i < max && i < MAX_CTRLS; i++)
+            ctrls[i] = m_ctrls[i];
+        return m_ctrl_count;
+    }
+
+    int extCtrls(void)
+    {
+        Mutex::Autolock lock(m_lock);
+        return m_ext_ctrls;
+    }
+
+private:
+    SecCameraBackend *m_fake;
+    Mutex       m_lock;
+    int         m_preview_fd;
+    int         m_qbufs[MAX_BUFFERS];
+    struct v4l2_control m_ctrls[MAX_CTRLS];
+    int         m_ctrl_count;
+    int         m_ext_ctrls;
+};
+
+static RecordingBackend *backend;
+
+static void report(const char *what, int frames, nsecs_t elapsed)
+{
+    printf("%-8s %4d frames %8lld us  %6.1f fps\n", what, frames,
+           (long long)ns2us(elapsed),
+           elapsed ? frames * 1e9 / elapsed : 0.0);
+}
+
+static bool testPreview(SecCamera *cam, int frames)
+{
+    nsecs_t last = 0;
+
+    EXPECT(cam->setPreviewSize(PREVIEW_WIDTH, PREVIEW_HEIGHT, V4L2_PIX_FMT_NV21) == 0);
+    EXPECT(cam->startPreview() == 0);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < frames; i++) {
+        nsecs_t stamp;
+        int index = cam->getPreview(&stamp);
+        EXPECT(0 <= index && index < MAX_BUFFERS);
+        EXPECT(stamp > last);
+        last = stamp;
+        EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    }
+    report("preview", frames, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    EXPECT(cam->stopPreview() == 0);
+
+    /* same settings again, the restart must not set the stream up anew */
+    EXPECT(cam->startPreview() == 0);
+    EXPECT(cam->isPreviewWarmStart());
+    int index = cam->getPreview(NULL);
+    EXPECT(0 <= index && index < MAX_BUFFERS);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    EXPECT(cam->stopPreview() == 0);
+
+    return true;
+}
+
+/* a preview buffer goes back to the driver once, after its last owner lets go */
+static bool testPreviewOwners(SecCamera *cam)
+{
+    EXPECT(cam->setPreviewSize(PREVIEW_WIDTH, PREVIEW_HEIGHT, V4L2_PIX_FMT_NV21) == 0);
+    EXPECT(cam->startPreview() == 0);
+
+    /* display and client take the frame, the HAL and then they let go */
+    int index = cam->getPreview(NULL);
+    EXPECT(0 <= index && index < MAX_BUFFERS);
+    int queued = backend->qbufs(index);
+    cam->acquirePreviewFrame(index, SecCamera::PREVIEW_OWNER_DISPLAY);
+    cam->acquirePreviewFrame(index, SecCamera::PREVIEW_OWNER_CLIENT);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    EXPECT(backend->qbufs(index) == queued);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_DISPLAY) == 0);
+    EXPECT(backend->qbufs(index) == queued);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_CLIENT) == 0);
+    EXPECT(backend->qbufs(index) == queued + 1);
+
+    /* a second release by an owner that already let go queues nothing */
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_CLIENT) == 0);
+    EXPECT(backend->qbufs(index) == queued + 1);
+
+    /* a frame the client still holds stays out of the restarted stream */
+    index = cam->getPreview(NULL);
+    EXPECT(0 <= index && index < MAX_BUFFERS);
+    queued = backend->qbufs(index);
+    cam->acquirePreviewFrame(index, SecCamera::PREVIEW_OWNER_CLIENT);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    EXPECT(cam->stopPreview() == 0);
+    EXPECT(cam->startPreview() == 0);
+    EXPECT(backend->qbufs(index) == queued);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_CLIENT) == 0);
+    EXPECT(backend->qbufs(index) == queued + 1);
+
+    /* one released while the stream is off is queued by the next start */
+    index = cam->getPreview(NULL);
+    EXPECT(0 <= index && index < MAX_BUFFERS);
+    queued = backend->qbufs(index);
+    EXPECT(cam->stopPreview() == 0);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    EXPECT(backend->qbufs(index) == queued);
+    EXPECT(cam->startPreview() == 0);
+    EXPECT(backend->qbufs(index) == queued + 1);
+
+    index = cam->getPreview(NULL);
+    EXPECT(0 <= index && index < MAX_BUFFERS);
+    EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+    EXPECT(cam->stopPreview() == 0);
+
+    return true;
+}
+
+static bool setCtrls(SecCamera *cam, int wb, int ev, int effect, int contrast)
+{
+    EXPECT(cam->setWhiteBalance(wb) == 0);
+    EXPECT(cam->setBrightness(ev) == 0);
+    EXPECT(cam->setImageEffect(effect) == 0);
+    EXPECT(cam->setContrast(contrast) == 0);
+    return true;
+}
+
+/* each changed setting is one S_CTRL, in call order; an unchanged one none */
+static bool testCtrls(SecCamera *cam)
+{
+    struct v4l2_control ctrls[RecordingBackend::MAX_CTRLS];
+
+    EXPECT(cam->setPreviewSize(PREVIEW_WIDTH, PREVIEW_HEIGHT, V4L2_PIX_FMT_NV21) == 0);
+    EXPECT(cam->startPreview() == 0);
+    EXPECT(setCtrls(cam, WHITE_BALANCE_SUNNY, -1, IMAGE_EFFECT_BNW, CONTRAST_MINUS_1));
+
+    backend->clearCtrls();
+    int ioctls = cam->getCtrlIoctlCount();
+    EXPECT(setCtrls(cam, WHITE_BALANCE_CLOUDY, 1, IMAGE_EFFECT_SEPIA, CONTRAST_PLUS_1));
+    EXPECT(backend->ctrls(ctrls, RecordingBackend::MAX_CTRLS) == 4);
+    EXPECT(cam->getCtrlIoctlCount() == ioctls + 4);
+    EXPECT(ctrls[0].id == V4L2_CID_CAMERA_WHITE_BALANCE && ctrls[0].value == WHITE_BALANCE_CLOUDY);
+    EXPECT(ctrls[1].id == V4L2_CID_CAMERA_BRIGHTNESS && ctrls[1].value == EV_DEFAULT + 1);
+    EXPECT(ctrls[2].id == V4L2_CID_CAMERA_EFFECT && ctrls[2].value == IMAGE_EFFECT_SEPIA);
+    EXPECT(ctrls[3].id == V4L2_CID_CAMERA_CONTRAST && ctrls[3].value == CONTRAST_PLUS_1);
+
+    /* the same values again reach neither the driver nor the counter */
+    backend->clearCtrls();
+    ioctls = cam->getCtrlIoctlCount();
+    EXPECT(setCtrls(cam, WHITE_BALANCE_CLOUDY, 1, IMAGE_EFFECT_SEPIA, CONTRAST_PLUS_1));
+    EXPECT(backend->ctrls(ctrls, RecordingBackend::MAX_CTRLS) == 0);
+    EXPECT(cam->getCtrlIoctlCount() == ioctls);
+
+    /* only one of them changed */
+    EXPECT(setCtrls(cam, WHITE_BALANCE_CLOUDY, 2, IMAGE_EFFECT_SEPIA, CONTRAST_PLUS_1));
+    EXPECT(backend->ctrls(ctrls, RecordingBackend::MAX_CTRLS) == 1);
+    EXPECT(ctrls[0].id == V4L2_CID_CAMERA_BRIGHTNESS && ctrls[0].value == EV_DEFAULT + 2);
+
+    /* with the stream off the settings are only kept */
+    EXPECT(cam->stopPreview() == 0);
+    backend->clearCtrls();
+    EXPECT(setCtrls(cam, WHITE_BALANCE_SUNNY, 0, IMAGE_EFFECT_NONE, CONTRAST_DEFAULT));
+    EXPECT(backend->ctrls(ctrls, RecordingBackend::MAX_CTRLS) == 0);
+    EXPECT(cam->getWhiteBalance() == WHITE_BALANCE_SUNNY);
+
+    EXPECT(backend->extCtrls() == 0);
+    return true;
+}
+
+static bool testRecord(SecCamera *cam, int frames)
+{
+    nsecs_t last = 0;
+
+    EXPECT(cam->setRecordingSize(RECORD_WIDTH, RECORD_HEIGHT) == 0);
+    EXPECT(cam->startPreview() == 0);
+    EXPECT(cam->startRecord() == 0);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < frames; i++) {
+        int index = cam->getPreview(NULL);
+        EXPECT(0 <= index && index < MAX_BUFFERS);
+        EXPECT(cam->releasePreviewFrame(index, SecCamera::PREVIEW_OWNER_HAL) == 0);
+
+        nsecs_t stamp;
+        index = cam->getRecordFrame(&stamp);
+        EXPECT(0 <= index && index < MAX_BUFFERS);
+        EXPECT(stamp > last);
+        last = stamp;
+        EXPECT(cam->getRecPhyAddrY(index) != 0xffffffff);
+        EXPECT(cam->releaseRecordFrame(index) == 0);
+    }
+    report("record", frames, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    EXPECT(cam->stopRecord() == 0);
+    EXPECT(cam->stopPreview() == 0);
+
+    return true;
+}
+
+static bool testPicture(SecCamera *cam, int shots)
+{
+    EXPECT(cam->setSnapshotSize(PICTURE_WIDTH, PICTURE_HEIGHT) == 0);
+    EXPECT(cam->setSnapshotPixelFormat(V4L2_PIX_FMT_YUYV) == 0);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < shots; i++) {
+        int jpeg_size = 0;
+        unsigned int phyaddr = 0;
+
+        EXPECT(cam->setSnapshotCmd() == 0);
+        unsigned char *data = cam->getJpeg(&jpeg_size, &phyaddr);
+        EXPECT(data != NULL);
+        /* the interleaved stream still starts with the JPEG SOI */
+        EXPECT(jpeg_size > 2 && data[0] == 0xff && data[1] == 0xd8);
+        EXPECT(cam->endSnapshot() == 0);
+    }
+    report("picture", shots, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    return true;
+}
+
+static bool testBurst(SecCamera *cam, int shots)
+{
+    int held[SecCamera::CAPTURE_BUFFERS];
+    SecCamera::ShotInfo shot;
+
+    EXPECT(cam->setSnapshotSize(PICTURE_WIDTH, PICTURE_HEIGHT) == 0);
+    EXPECT(cam->setSnapshotPixelFormat(V4L2_PIX_FMT_YUYV) == 0);
+    EXPECT(cam->startBurstCapture() == SecCamera::CAPTURE_BUFFERS);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < shots; i++) {
+        int jpeg_size = 0;
+        int slot = i % (SecCamera::CAPTURE_BUFFERS - 1);
+
+        /* keep one buffer with the sensor, hold the rest like the HAL does */
+        if (i >= SecCamera::CAPTURE_BUFFERS - 1)
+            EXPECT(cam->releaseBurstJpeg(held[slot]) == 0);
+        unsigned char *data = cam->getBurstJpeg(&jpeg_size, &held[slot], &shot);
+        EXPECT(data != NULL);
+        EXPECT(0 <= held[slot] && held[slot] < SecCamera::CAPTURE_BUFFERS);
+        EXPECT(jpeg_size > 2 && data[0] == 0xff && data[1] == 0xd8);
+        EXPECT(shot.date_time[4] == ':' && shot.date_time[19] == '\0');
+    }
+    report("burst", shots, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    EXPECT(cam->stopBurstCapture() == 0);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 120;
+
+    backend = new RecordingBackend(SecCameraBackend::createFakeFimc());
+    SecCameraBackend::setInstance(backend);
+
+    SecCamera *cam = SecCamera::createInstance();
+    if (cam->initCamera(SecCamera::CAMERA_ID_BACK) < 0) {
+        fprintf(stderr, "initCamera failed\n");
+        return 1;
+    }
+    /* what the HAL sets before the first preview */
+    cam->setDataLineCheck(SecCamera::CHK_DATALINE_OFF);
+
+    if (testPreview(cam, frames) && testPreviewOwners(cam) && testCtrls(cam) &&
+            testRecord(cam, frames))
+        if (testPicture(cam, 4))
+            testBurst(cam, 8);
+
+    cam->dump(1);
+    cam->DeinitCamera();
+
+    /* none in the whole run, the shot state reads of the captures included */
+    if (backend->extCtrls()) {
+        fprintf(stderr, "%d extended ctrl ioctls\n", backend->extCtrls());
+        failures++;
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,523 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Checks secCopyYuv420ToYv12() and secCopyYv12ToYuv420() against the
+ * per-plane memcpy loop they replaced, secConvertPlanarToNv21() against
+ * the byte-by-byte interleave of the old NV21 callback, secScaleYuyv()
+ * against a plain box filter and secConvertYuyvToNv21() against a plain
+ * per-sample converter on fixed pseudo-random frames, then times them against those references
+ * at the sizes the HAL uses them for. Exits non-zero on the first mismatch.
+ *
+ * usage: camera_image_test [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "SecCameraImage.h"
+
+using namespace android;
+
+static int failures;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+static int64_t nowUs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* the same frames on every run */
+static void fill(uint8_t *buf, int size, uint32_t seed)
+{
+    for (int i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+/* the Y, U, V plane loops previewThread() used before secCopyYuv420ToYv12() */
+static void refCopyYuv420ToYv12(const uint8_t *src, uint8_t *dst,
+                                int width, int height, int stride)
+{
+    uint8_t *v = dst + stride * height;
+    uint8_t *u = v + (stride / 2) * (height / 2);
+
+    for (int h = 0; h < height; h++) {
+        memcpy(dst + h * stride, src, width);
+        src += width;
+    }
+    for (int h = 0; h < height / 2; h++) {
+        memcpy(u + h * (stride / 2), src, width / 2);
+        src += width / 2;
+    }
+    for (int h = 0; h < height / 2; h++) {
+        memcpy(v + h * (stride / 2), src, width / 2);
+        src += width / 2;
+    }
+}
+
+/* luma row by row, then one V and one U byte at a time like the old callback */
+static void refPlanarToNv21(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                            int yStride, int cStride,
+                            uint8_t *dst, int width, int height)
+{
+    uint8_t *vu = dst + width * height;
+
+    for (int h = 0; h < height; h++)
+        memcpy(dst + h * width, y + h * yStride, width);
+    for (int h = 0; h < height / 2; h++) {
+        for (int x = 0; x < width / 2; x++) {
+            *vu++ = v[h * cStride + x];
+            *vu++ = u[h * cStride + x];
+        }
+    }
+}
+
+static void boxRange(int i, int n, int srcN, int *start, int *end)
+{
+    *start = i * srcN / n;
+    *end = (i + 1) * srcN / n;
+    if (*end <= *start)
+        *end = *start + 1;
+}
+
+/* every output sample is the rounded mean of the source samples it covers */
+static void refScaleYuyv(const uint8_t *src, int srcWidth, int srcHeight,
+                         uint8_t *dst, int dstWidth, int dstHeight)
+{
+    for (int dy = 0; dy < dstHeight; dy++) {
+        int y0, y1;
+        boxRange(dy, dstHeight, srcHeight, &y0, &y1);
+
+        for (int x = 0; x < dstWidth; x++) {
+            int x0, x1;
+            uint32_t sum = 0;
+            boxRange(x, dstWidth, srcWidth, &x0, &x1);
+            for (int y = y0; y < y1; y++)
+                for (int i = x0; i < x1; i++)
+                    sum += src[(y * srcWidth + i) * 2];
+            uint32_t n = (y1 - y0) * (x1 - x0);
+            dst[(dy * dstWidth + x) * 2] = (sum + n / 2) / n;
+        }
+
+        for (int p = 0; p < dstWidth / 2; p++) {
+            int x0, x1;
+            uint32_t u = 0, v = 0;
+            boxRange(p, dstWidth / 2, srcWidth / 2, &x0, &x1);
+            for (int y = y0; y < y1; y++) {
+                for (int i = x0; i < x1; i++) {
+                    u += src[y * srcWidth * 2 + i * 4 + 1];
+                    v += src[y * srcWidth * 2 + i * 4 + 3];
+                }
+            }
+            uint32_t n = (y1 - y0) * (x1 - x0);
+            dst[dy * dstWidth * 2 + p * 4 + 1] = (u + n / 2) / n;
+            dst[dy * dstWidth * 2 + p * 4 + 3] = (v + n / 2) / n;
+        }
+    }
+}
+
+/* luma as is, V/U from the first row of each pair */
+static void refYuyvToNv21(const uint8_t *src, int srcStride,
+                          uint8_t *dst, int dstStride, int width, int height)
+{
+    uint8_t *vu = dst + dstStride * height;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *in = src + y * srcStride;
+        for (int x = 0; x < width; x++)
+            dst[y * dstStride + x] = in[x * 2];
+        if (y & 1)
+            continue;
+        for (int x = 0; x < width; x += 2) {
+            vu[(y / 2) * dstStride + x] = in[x * 2 + 3];
+            vu[(y / 2) * dstStride + x + 1] = in[x * 2 + 1];
+        }
+    }
+}
+
+static bool checkYv12(int width, int height, int stride, int offset)
+{
+    const int srcSize = width * height + (width / 2) * (height / 2) * 2;
+    const int dstSize = stride * height + (stride / 2) * (height / 2) * 2;
+
+    uint8_t *src = (uint8_t *)malloc(srcSize);
+    uint8_t *back = (uint8_t *)malloc(srcSize);
+    /* offset moves the destination off the 16-byte streaming alignment */
+    uint8_t *dstBuf = (uint8_t *)malloc(dstSize + offset);
+    uint8_t *ref = (uint8_t *)malloc(dstSize);
+    uint8_t *dst = dstBuf + offset;
+
+    fill(src, srcSize, width * 13 + height);
+    /* row padding belongs to gralloc, neither copier may touch it */
+    memset(dst, 0x5a, dstSize);
+    memset(ref, 0x5a, dstSize);
+    refCopyYuv420ToYv12(src, ref, width, height, stride);
+    secCopyYuv420ToYv12(src, dst, width, height, stride);
+    bool same = !memcmp(dst, ref, dstSize);
+
+    memset(back, 0, srcSize);
+    secCopyYv12ToYuv420(dst, back, width, height, stride);
+    bool roundTrip = !memcmp(back, src, srcSize);
+
+    free(ref);
+    free(dstBuf);
+    free(back);
+    free(src);
+
+    if (!same || !roundTrip)
+        fprintf(stderr, "YV12 %dx%d stride %d offset %d differs from the reference\n",
+                width, height, stride, offset);
+    EXPECT(same);
+    EXPECT(roundTrip);
+    return true;
+}
+
+static bool testYv12(void)
+{
+    /* every tail length of the row kernel, packed and padded rows */
+    for (int width = 2; width <= 140; width += 2) {
+        for (int height = 1; height <= 5; height++) {
+            if (!checkYv12(width, height, width, 0) ||
+                    !checkYv12(width, height, (width + 31) & ~31, 0) ||
+                    !checkYv12(width, height, width + 6, 4))
+                return false;
+        }
+    }
+
+    return checkYv12(640, 480, 640, 0) && checkYv12(720, 480, 736, 0) &&
+           checkYv12(176, 144, 192, 8);
+}
+
+/* a YUV420P frame when stride == width, else a strided YV12 one */
+static bool checkPlanar(int width, int height, int stride)
+{
+    const int cStride = stride / 2;
+    const int srcSize = stride * height + cStride * (height / 2) * 2;
+    const int dstSize = width * height + (width / 2) * (height / 2) * 2;
+
+    uint8_t *src = (uint8_t *)malloc(srcSize);
+    uint8_t *dst = (uint8_t *)malloc(dstSize);
+    uint8_t *ref = (uint8_t *)malloc(dstSize);
+    uint8_t *copy = (uint8_t *)malloc(srcSize);
+
+    const uint8_t *y = src;
+    const uint8_t *c0 = y + stride * height;
+    const uint8_t *c1 = c0 + cStride * (height / 2);
+    const uint8_t *u = stride == width ? c0 : c1;
+    const uint8_t *v = stride == width ? c1 : c0;
+
+    fill(src, srcSize, width * 7 + height);
+    memcpy(copy, src, srcSize);
+    memset(dst, 0x5a, dstSize);
+    refPlanarToNv21(y, u, v, stride, cStride, ref, width, height);
+    secConvertPlanarToNv21(y, u, v, stride, cStride, dst, width, height);
+    bool same = !memcmp(dst, ref, dstSize);
+    /* the source may be a window buffer still on its way to the display */
+    bool untouched = !memcmp(src, copy, srcSize);
+
+    free(copy);
+    free(ref);
+    free(dst);
+    free(src);
+
+    if (!same)
+        fprintf(stderr, "planar NV21 %dx%d stride %d differs from the reference\n",
+                width, height, stride);
+    EXPECT(same);
+    EXPECT(untouched);
+    return true;
+}
+
+static bool testPlanar(void)
+{
+    /* the preview sizes of both cameras */
+    static const int sizes[][2] = {
+        { 720, 480 }, { 640, 480 }, { 352, 288 }, { 320, 240 }, { 176, 144 },
+    };
+
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int width = sizes[i][0], height = sizes[i][1];
+        if (!checkPlanar(width, height, width) ||
+                !checkPlanar(width, height, (width + 31) & ~31) ||
+                !checkPlanar(width, height, width + 64))
+            return false;
+    }
+
+    /* every tail length of the interleave */
+    for (int width = 2; width <= 70; width += 2)
+        for (int height = 2; height <= 6; height += 2)
+            if (!checkPlanar(width, height, width) || !checkPlanar(width, height, width + 4))
+                return false;
+
+    return true;
+}
+
+static bool checkScale(int srcWidth, int srcHeight, int dstWidth, int dstHeight)
+{
+    const int srcSize = srcWidth * srcHeight * 2;
+    const int dstSize = dstWidth * dstHeight * 2;
+    const size_t scratchSize = secScaleYuyvScratchSize(srcWidth, dstWidth);
+
+    EXPECT(scratchSize > 0);
+
+    uint8_t *src = (uint8_t *)malloc(srcSize);
+    uint8_t *dst = (uint8_t *)malloc(dstSize);
+    uint8_t *ref = (uint8_t *)malloc(dstSize);
+    /* a guard word behind the scratch catches an undersized request */
+    uint32_t *scratch = (uint32_t *)malloc(scratchSize + sizeof(uint32_t));
+    scratch[scratchSize / sizeof(uint32_t)] = 0xdeadbeef;
+
+    fill(src, srcSize, srcWidth * 31 + srcHeight);
+    memset(dst, 0, dstSize);
+    refScaleYuyv(src, srcWidth, srcHeight, ref, dstWidth, dstHeight);
+
+    bool scaled = secScaleYuyv(src, srcWidth, srcHeight, dst, dstWidth, dstHeight, scratch);
+    bool same = !memcmp(dst, ref, dstSize);
+    bool guard = scratch[scratchSize / sizeof(uint32_t)] == 0xdeadbeef;
+
+    /* the scratch carries nothing from one call to the next */
+    memset(dst, 0, dstSize);
+    secScaleYuyv(src, srcWidth, srcHeight, dst, dstWidth, dstHeight, scratch);
+    bool again = !memcmp(dst, ref, dstSize);
+
+    free(scratch);
+    free(ref);
+    free(dst);
+    free(src);
+
+    if (!same || !again)
+        fprintf(stderr, "scale %dx%d -> %dx%d differs from the box filter\n",
+                srcWidth, srcHeight, dstWidth, dstHeight);
+    EXPECT(scaled);
+    EXPECT(same);
+    EXPECT(guard);
+    EXPECT(again);
+    return true;
+}
+
+static bool testScale(void)
+{
+    static const int sizes[][4] = {
+        { 640, 480, 320, 240 },     /* postview to back camera thumbnail */
+        { 640, 480, 160, 120 },     /* postview to front camera thumbnail */
+        { 800, 480, 320, 240 },     /* wide postview, uneven boxes */
+        { 2560, 1920, 320, 240 },   /* 8x8 boxes */
+        { 10, 6, 4, 4 },
+        { 6, 4, 2, 1 },
+        { 4, 2, 8, 4 },             /* upscale */
+        { 64, 48, 64, 48 },         /* same size */
+    };
+
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        if (!checkScale(sizes[i][0], sizes[i][1], sizes[i][2], sizes[i][3]))
+            return false;
+
+    EXPECT(secScaleYuyvScratchSize(3, 2) == 0);
+    EXPECT(!secScaleYuyv(NULL, 4, 2, NULL, 2, 1, NULL));
+    return true;
+}
+
+static bool checkNv21(int width, int height, int srcStride, int dstStride)
+{
+    const int srcSize = srcStride * height;
+    const int dstSize = dstStride * (height + (height + 1) / 2);
+
+    uint8_t *src = (uint8_t *)malloc(srcSize);
+    uint8_t *dst = (uint8_t *)malloc(dstSize);
+    uint8_t *ref = (uint8_t *)malloc(dstSize);
+
+    fill(src, srcSize, width * 17 + height);
+    /* the padding of strided rows is left alone by both */
+    memset(dst, 0x5a, dstSize);
+    memset(ref, 0x5a, dstSize);
+    refYuyvToNv21(src, srcStride, ref, dstStride, width, height);
+    secConvertYuyvToNv21(src, srcStride, dst, dstStride, width, height);
+    bool same = !memcmp(dst, ref, dstSize);
+
+    free(ref);
+    free(dst);
+    free(src);
+
+    if (!same)
+        fprintf(stderr, "NV21 %dx%d strides %d/%d differs from the reference\n",
+                width, height, srcStride, dstStride);
+    EXPECT(same);
+    return true;
+}
+
+static bool testNv21(void)
+{
+    /* every tail length of the vector loops, odd heights included */
+    for (int width = 2; width <= 70; width += 2) {
+        for (int height = 1; height <= 7; height++) {
+            if (!checkNv21(width, height, width * 2, width) ||
+                    !checkNv21(width, height, width * 2 + 6, width + 3))
+                return false;
+        }
+    }
+
+    return checkNv21(640, 480, 1280, 640) && checkNv21(720, 480, 1440, 768);
+}
+
+static void report(const char *what, int iterations, int64_t refUs, int64_t us)
+{
+    printf("%-28s %8.1f us  reference %8.1f us  %5.1fx\n", what,
+           (double)us / iterations, (double)refUs / iterations,
+           us ? (double)refUs / us : 0.0);
+}
+
+static void benchYv12(int width, int height, int stride, int iterations)
+{
+    const int srcSize = width * height * 3 / 2;
+    uint8_t *src = (uint8_t *)malloc(srcSize);
+    uint8_t *dst = (uint8_t *)malloc(stride * height * 3 / 2);
+    char what[64];
+
+    fill(src, srcSize, 3);
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        refCopyYuv420ToYv12(src, dst, width, height, stride);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        secCopyYuv420ToYv12(src, dst, width, height, stride);
+    int64_t us = nowUs() - start;
+
+    snprintf(what, sizeof(what), "YUV420 -> YV12 %dx%d/%d", width, height, stride);
+    report(what, iterations, refUs, us);
+
+    free(dst);
+    free(src);
+}
+
+static void benchPlanar(int width, int height, int iterations)
+{
+    const int size = width * height * 3 / 2;
+    uint8_t *src = (uint8_t *)malloc(size);
+    uint8_t *dst = (uint8_t *)malloc(size);
+    const uint8_t *u = src + width * height;
+    const uint8_t *v = u + width * height / 4;
+    char what[64];
+
+    fill(src, size, 4);
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        refPlanarToNv21(src, u, v, width, width / 2, dst, width, height);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        secConvertPlanarToNv21(src, u, v, width, width / 2, dst, width, height);
+    int64_t us = nowUs() - start;
+
+    snprintf(what, sizeof(what), "YUV420 -> NV21 %dx%d", width, height);
+    report(what, iterations, refUs, us);
+
+    free(dst);
+    free(src);
+}
+
+static void benchScale(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+                       int iterations)
+{
+    uint8_t *src = (uint8_t *)malloc(srcWidth * srcHeight * 2);
+    uint8_t *dst = (uint8_t *)malloc(dstWidth * dstHeight * 2);
+    void *scratch = malloc(secScaleYuyvScratchSize(srcWidth, dstWidth));
+    char what[64];
+
+    fill(src, srcWidth * srcHeight * 2, 1);
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        refScaleYuyv(src, srcWidth, srcHeight, dst, dstWidth, dstHeight);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        secScaleYuyv(src, srcWidth, srcHeight, dst, dstWidth, dstHeight, scratch);
+    int64_t us = nowUs() - start;
+
+    snprintf(what, sizeof(what), "scale %dx%d -> %dx%d",
+             srcWidth, srcHeight, dstWidth, dstHeight);
+    report(what, iterations, refUs, us);
+
+    free(scratch);
+    free(dst);
+    free(src);
+}
+
+static void benchNv21(int width, int height, int iterations)
+{
+    uint8_t *src = (uint8_t *)malloc(width * height * 2);
+    uint8_t *dst = (uint8_t *)malloc(width * height * 3 / 2);
+    char what[64];
+
+    fill(src, width * height * 2, 2);
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        refYuyvToNv21(src, width * 2, dst, width, width, height);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        secConvertYuyvToNv21(src, width * 2, dst, width, width, height);
+    int64_t us = nowUs() - start;
+
+    snprintf(what, sizeof(what), "YUYV -> NV21 %dx%d", width, height);
+    report(what, iterations, refUs, us);
+
+    free(dst);
+    free(src);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 50;
+
+    if (testYv12() && testPlanar() && testScale() && testNv21() && iterations > 0) {
+        benchYv12(640, 480, 640, iterations);
+        benchYv12(720, 480, 736, iterations);
+        benchPlanar(720, 480, iterations);
+        benchPlanar(640, 480, iterations);
+        benchScale(640, 480, 320, 240, iterations);
+        benchScale(800, 480, 320, 240, iterations);
+        benchNv21(640, 480, iterations);
+        benchNv21(1280, 720, iterations);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
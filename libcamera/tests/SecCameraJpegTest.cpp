@@ -0,0 +1,496 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Checks secJpegFindEOI() and secJpegWordRun() against the byte and word
+ * loops they replaced, at every length and alignment the vector paths
+ * split on, and secJpegDemuxSony() against the per-word demuxer it
+ * replaced on generated Sony interleaved captures. Then times all three
+ * against those loops on capture-sized streams. Exits non-zero on the
+ * first mismatch.
+ *
+ * usage: camera_jpeg_test [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "SecCameraJpeg.h"
+
+using namespace android;
+
+static int failures;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+static int64_t nowUs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* the same data on every run */
+static void fill(uint8_t *buf, int size, uint32_t seed)
+{
+    for (int i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+/* entropy coded data: every 0xFF is followed by a stuffed 0x00 */
+static void fillScan(uint8_t *buf, int size, uint32_t seed)
+{
+    fill(buf, size, seed);
+    for (int i = 0; i < size - 1; i++)
+        if (buf[i] == 0xFF)
+            buf[++i] = 0x00;
+    if (buf[size - 1] == 0xFF)
+        buf[size - 1] = 0xFE;
+}
+
+/* FindEOIMarkerInJPEG(): one byte pair at a time */
+static int refFindEOI(const uint8_t *buf, int len)
+{
+    for (int i = 0; i < len; i++)
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD9)
+            return i;
+    return -1;
+}
+
+/* the per-word test at the head of decodeInterleaveData() */
+static int refWordRun(const uint8_t *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len / 4; i++)
+        if (buf[i * 4] == 0xFF)
+            break;
+    return i * 4;
+}
+
+static uint32_t loadWord(const uint8_t *p)
+{
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/* decodeInterleaveData() with both destinations given, minus the logging */
+static bool refDemuxSony(const uint8_t *src, int size, int yuvWidth, int yuvHeight,
+                         int *jpegSize, uint8_t *jpeg, uint8_t *yuv)
+{
+    const uint8_t *p = src;
+    uint8_t *j = jpeg;
+    int jsize = 0;
+    int ysize = 0;
+    int i = 0;
+
+    while (i < size) {
+        uint32_t word = loadWord(p);
+        if (word == 0xFFFFFFFF || word == 0x02FFFFFF || word == 0xFF02FFFF) {
+            p += 4;
+            i += 4;
+        } else if ((word & 0xFFFF) == 0x05FF) {
+            p += 2;
+            i += 2;
+            memcpy(yuv, p, yuvWidth * 2);
+            yuv += yuvWidth * 2;
+            ysize += yuvWidth * 2;
+            p += yuvWidth * 2;
+            i += yuvWidth * 2;
+            if (p[0] != 0xFF || p[1] != 0x06)
+                return false;
+            p += 2;
+            i += 2;
+        } else {
+            memcpy(j, p, 4);
+            j += 4;
+            jsize += 4;
+            p += 4;
+            i += 4;
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (*(--j) != 0xFF)
+            break;
+        jsize--;
+    }
+    *jpegSize = jsize;
+
+    return ysize == yuvWidth * yuvHeight * 2;
+}
+
+static uint32_t next(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+/*
+ * A Sony capture of up to max bytes: JPEG words, about one in odds of
+ * them a padding word and one a 0xFF-led word that is no code, with
+ * yuvHeight YUV lines spread over it, ending on the EOI and padding.
+ * Other words lead with 0xFF as often as random entropy data does. With
+ * broken set one line misses its end code. Returns the stream length.
+ */
+static int makeSony(uint8_t *buf, int max, int yuvWidth, int yuvHeight,
+                    int odds, uint32_t seed, bool broken)
+{
+    static const uint8_t ffSecond[] = { 0x00, 0xD8, 0xDB, 0xC4, 0xDA, 0x02, 0x06, 0xFF };
+    static const uint32_t pads[] = { 0xFFFFFFFF, 0x02FFFFFF, 0xFF02FFFF };
+    const int line = yuvWidth * 2;
+    const int jpegMax = max - yuvHeight * (line + 4) - 32;
+    int badLine = broken ? next(&seed) % yuvHeight : -1;
+    int lines = 0;
+    int jsize = 0;
+    int n = 0;
+
+    buf[n++] = 0xFF;
+    buf[n++] = 0xD8;
+    buf[n++] = next(&seed) & 0x7F;
+    buf[n++] = next(&seed) & 0x7F;
+
+    while (lines < yuvHeight || jsize < jpegMax) {
+        if (lines < yuvHeight && (int64_t)jsize * yuvHeight >= (int64_t)lines * jpegMax &&
+                (next(&seed) % 4 == 0 || jsize >= jpegMax)) {
+            buf[n++] = 0xFF;
+            buf[n++] = 0x05;
+            for (int i = 0; i < line; i++)
+                buf[n++] = next(&seed);
+            buf[n++] = 0xFF;
+            buf[n++] = lines == badLine ? 0x07 : 0x06;
+            lines++;
+            continue;
+        }
+
+        uint32_t pick = next(&seed) % odds;
+        if (pick == 0) {
+            uint32_t pad = pads[next(&seed) % 3];
+            memcpy(buf + n, &pad, 4);
+        } else if (pick == 1) {
+            buf[n] = 0xFF;
+            buf[n + 1] = ffSecond[next(&seed) % sizeof(ffSecond)];
+            buf[n + 2] = next(&seed);
+            buf[n + 3] = next(&seed);
+            /* keep clear of the padding patterns */
+            if (buf[n + 1] == 0xFF || buf[n + 1] == 0x02)
+                buf[n + 2] = 0x00;
+        } else {
+            for (int i = 0; i < 4; i++)
+                buf[n + i] = next(&seed);
+            /* a stuffed 0xFF, never a code */
+            if (buf[n] == 0xFF)
+                buf[n + 1] = 0x00;
+        }
+        n += 4;
+        jsize += 4;
+    }
+
+    /* EOI padded out to the word with 0xFF, then padding words */
+    int tail = next(&seed) % 3;
+    buf[n++] = tail == 2 ? next(&seed) & 0x7F : 0xFF;
+    buf[n++] = tail == 2 ? 0xFF : 0xD9;
+    buf[n++] = tail == 2 ? 0xD9 : 0xFF;
+    buf[n++] = 0xFF;
+    for (int i = next(&seed) % 3; i > 0; i--) {
+        memset(buf + n, 0xFF, 4);
+        n += 4;
+    }
+    return n;
+}
+
+static bool checkSony(int yuvWidth, int yuvHeight, uint32_t seed, bool broken)
+{
+    const int max = yuvHeight * (yuvWidth * 2 + 4) + 64 + seed % 2048;
+    const int yuvSize = yuvWidth * yuvHeight * 2;
+    uint8_t *src = (uint8_t *)malloc(max);
+    uint8_t *jpeg = (uint8_t *)malloc(max + 4);
+    uint8_t *ref = (uint8_t *)malloc(max);
+    uint8_t *yuv = (uint8_t *)malloc(yuvSize + 4);
+    uint8_t *refYuv = (uint8_t *)malloc(yuvSize + 4);
+
+    int size = makeSony(src, max, yuvWidth, yuvHeight, 16, seed, broken);
+    int refSize = 0, jpegSize = -1, countSize = -1, clipSize = -1;
+
+    bool want = refDemuxSony(src, size, yuvWidth, yuvHeight, &refSize, ref, refYuv);
+    memset(jpeg, 0x5a, max + 4);
+    memset(yuv, 0x5a, yuvSize + 4);
+    bool got = secJpegDemuxSony(src, size, yuvWidth, yuvHeight,
+                                jpeg, max, &jpegSize, yuv);
+    bool sameJpeg = got && jpegSize == refSize && !memcmp(jpeg, ref, refSize);
+    bool sameYuv = got && !memcmp(yuv, refYuv, yuvSize) && yuv[yuvSize] == 0x5a;
+
+    /* sizing only, and a destination too small for the picture */
+    bool counted = secJpegDemuxSony(src, size, yuvWidth, yuvHeight, NULL, 0, &countSize, NULL);
+    int clip = refSize / 2;
+    memset(jpeg, 0x5a, max + 4);
+    secJpegDemuxSony(src, size, yuvWidth, yuvHeight, jpeg, clip, &clipSize, NULL);
+    bool clipped = !memcmp(jpeg, ref, clip) && jpeg[clip] == 0x5a;
+
+    free(refYuv);
+    free(yuv);
+    free(ref);
+    free(jpeg);
+    free(src);
+
+    if (got != want || (want && (!sameJpeg || !sameYuv)))
+        fprintf(stderr, "Sony demux %dx%d seed %u%s: %d/%d bytes, reference %d/%d\n",
+                yuvWidth, yuvHeight, seed, broken ? " broken" : "",
+                got, jpegSize, want, refSize);
+    EXPECT(got == want);
+    if (!want)
+        return true;
+    EXPECT(sameJpeg);
+    EXPECT(sameYuv);
+    EXPECT(counted);
+    EXPECT(countSize == refSize);
+    EXPECT(clipSize == refSize);
+    EXPECT(clipped);
+    return true;
+}
+
+static bool testSony(void)
+{
+    for (uint32_t seed = 0; seed < 3000; seed++) {
+        int yuvWidth = 2 + (seed % 16) * 2;
+        int yuvHeight = 1 + seed % 13;
+        if (!checkSony(yuvWidth, yuvHeight, seed, false))
+            return false;
+        if (seed % 4 == 0 && !checkSony(yuvWidth, yuvHeight, seed, true))
+            return false;
+    }
+
+    return true;
+}
+
+static bool checkEOI(const uint8_t *buf, int len)
+{
+    int want = refFindEOI(buf, len);
+    int got = secJpegFindEOI(buf, len);
+
+    if (got != want)
+        fprintf(stderr, "EOI in %d bytes at %p: %d, reference %d\n", len, buf, got, want);
+    EXPECT(got == want);
+    return true;
+}
+
+static bool testEOI(void)
+{
+    /* one byte of slack behind the range, the scanner may read it */
+    static uint8_t data[256 + 16 + 1];
+
+    for (int offset = 0; offset < 16; offset++) {
+        for (int len = 0; len <= 256; len++) {
+            uint8_t *buf = data + offset;
+
+            /* no marker, stuffed 0xFF bytes only */
+            fillScan(data, sizeof(data), offset * 1000 + len);
+            if (!checkEOI(buf, len))
+                return false;
+
+            /* a marker at every position, behind a lone 0xFF or a run */
+            for (int at = 0; at < len; at += 7) {
+                fillScan(data, sizeof(data), at);
+                buf[at] = 0xFF;
+                buf[at + 1] = 0xD9;
+                if (at > 1)
+                    buf[at - 1] = buf[at - 2] = 0xFF;
+                if (!checkEOI(buf, len))
+                    return false;
+            }
+
+            /* a 0xFF in the last byte is matched against the one behind it */
+            if (len > 0) {
+                fillScan(data, sizeof(data), len);
+                buf[len - 1] = 0xFF;
+                buf[len] = 0xD9;
+                if (!checkEOI(buf, len))
+                    return false;
+            }
+        }
+    }
+
+    /* every byte a 0xFF, then random bytes with markers wherever they fall */
+    memset(data, 0xFF, sizeof(data));
+    if (!checkEOI(data, 256))
+        return false;
+    for (uint32_t seed = 0; seed < 2000; seed++) {
+        fill(data, sizeof(data), seed);
+        if (!checkEOI(data + seed % 16, 256))
+            return false;
+    }
+
+    return true;
+}
+
+static bool checkWordRun(const uint8_t *buf, int len)
+{
+    int want = refWordRun(buf, len);
+    int got = secJpegWordRun(buf, len);
+
+    if (got != want)
+        fprintf(stderr, "word run in %d bytes at %p: %d, reference %d\n",
+                len, buf, got, want);
+    EXPECT(got == want);
+    return true;
+}
+
+static bool testWordRun(void)
+{
+    static uint8_t data[256 + 4];
+
+    for (int offset = 0; offset < 4; offset++) {
+        uint8_t *buf = data + offset;
+
+        for (int len = 0; len <= 256; len++) {
+            /* 0xFF everywhere but in the leading bytes: a run to the end */
+            memset(data, 0xFF, sizeof(data));
+            for (int i = 0; i < 256; i += 4)
+                buf[i] = i;
+            if (!checkWordRun(buf, len))
+                return false;
+
+            /* one 0xFF-led word at every position, inside and past len */
+            for (int at = 0; at < 256; at += 4) {
+                buf[at] = 0xFF;
+                if (!checkWordRun(buf, len))
+                    return false;
+                buf[at] = at;
+            }
+        }
+    }
+
+    for (uint32_t seed = 0; seed < 2000; seed++) {
+        fill(data, sizeof(data), seed);
+        if (!checkWordRun(data + seed % 4, 256))
+            return false;
+    }
+
+    return true;
+}
+
+static void report(const char *what, int iterations, int64_t refUs, int64_t us)
+{
+    printf("%-28s %8.1f us  reference %8.1f us  %5.1fx\n", what,
+           (double)us / iterations, (double)refUs / iterations,
+           us ? (double)refUs / us : 0.0);
+}
+
+/* SecCamera::getInterleaveDataSize(), the back camera capture buffer */
+static const int kStreamSize = 5242880;
+
+static void benchEOI(int iterations)
+{
+    uint8_t *buf = (uint8_t *)malloc(kStreamSize + 1);
+    volatile int sink = 0;
+
+    fillScan(buf, kStreamSize, 5);
+    buf[kStreamSize - 2] = 0xFF;
+    buf[kStreamSize - 1] = 0xD9;
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        sink += refFindEOI(buf, kStreamSize);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        sink += secJpegFindEOI(buf, kStreamSize);
+    int64_t us = nowUs() - start;
+
+    report("EOI scan 5MB", iterations, refUs, us);
+    free(buf);
+}
+
+static void benchWordRun(int iterations)
+{
+    uint8_t *buf = (uint8_t *)malloc(kStreamSize);
+    volatile int sink = 0;
+
+    fillScan(buf, kStreamSize, 6);
+    for (int i = 0; i < kStreamSize; i += 4)
+        if (buf[i] == 0xFF)
+            buf[i] = 0xFE;
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        sink += refWordRun(buf, kStreamSize);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        sink += secJpegWordRun(buf, kStreamSize);
+    int64_t us = nowUs() - start;
+
+    report("word run 5MB", iterations, refUs, us);
+    free(buf);
+}
+
+static void benchSony(int iterations)
+{
+    /* the back camera postview, mixed into a capture-sized stream */
+    const int yuvWidth = 640, yuvHeight = 480;
+    uint8_t *src = (uint8_t *)malloc(kStreamSize);
+    uint8_t *jpeg = (uint8_t *)malloc(kStreamSize);
+    uint8_t *yuv = (uint8_t *)malloc(yuvWidth * yuvHeight * 2);
+    int size = makeSony(src, kStreamSize, yuvWidth, yuvHeight, 4096, 7, false);
+    int jpegSize;
+
+    int64_t start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        refDemuxSony(src, size, yuvWidth, yuvHeight, &jpegSize, jpeg, yuv);
+    int64_t refUs = nowUs() - start;
+
+    start = nowUs();
+    for (int i = 0; i < iterations; i++)
+        secJpegDemuxSony(src, size, yuvWidth, yuvHeight, jpeg, kStreamSize, &jpegSize, yuv);
+    int64_t us = nowUs() - start;
+
+    report("Sony demux 5MB", iterations, refUs, us);
+
+    free(yuv);
+    free(jpeg);
+    free(src);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+    if (testEOI() && testWordRun() && testSony() && iterations > 0) {
+        benchEOI(iterations);
+        benchWordRun(iterations);
+        benchSony(iterations);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}
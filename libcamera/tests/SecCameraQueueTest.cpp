@@ -0,0 +1,196 @@
+/*
+**
+** Copyright 2013, The CyanogenMod Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Checks SecFrameQueue: FIFO order, a full ring refusing the push that
+ * would overwrite an unread frame, an empty ring refusing the pop, and
+ * the slot index wrapping over many laps. Then runs a producer and a
+ * consumer thread against each other the way the preview stages do and
+ * checks that every frame arrives once, in order. Exits non-zero on the
+ * first failure.
+ *
+ * usage: camera_queue_test [frames]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "SecCameraQueue.h"
+
+using namespace android;
+
+static int failures;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                 \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+static SecPreviewFrame frameOf(int seq)
+{
+    SecPreviewFrame frame;
+
+    frame.index = seq;
+    frame.timestamp = (nsecs_t)seq * 33333333;
+    frame.callback = seq & 1;
+    frame.owner = seq & 3;
+    frame.cbSlot = -1;
+    return frame;
+}
+
+static bool sameFrame(const SecPreviewFrame &frame, int seq)
+{
+    SecPreviewFrame want = frameOf(seq);
+
+    return frame.index == want.index && frame.timestamp == want.timestamp &&
+           frame.callback == want.callback && frame.owner == want.owner &&
+           frame.cbSlot == want.cbSlot;
+}
+
+static bool testEmpty(void)
+{
+    SecFrameQueue queue;
+    SecPreviewFrame frame = frameOf(7);
+
+    EXPECT(queue.empty());
+    EXPECT(queue.size() == 0);
+    EXPECT(!queue.pop(&frame));
+    /* a failed pop leaves the caller's frame alone */
+    EXPECT(sameFrame(frame, 7));
+    return true;
+}
+
+static bool testOverflow(void)
+{
+    SecFrameQueue queue;
+    SecPreviewFrame frame;
+
+    for (int i = 0; i < SecFrameQueue::CAPACITY; i++) {
+        EXPECT(queue.push(frameOf(i)));
+        EXPECT(queue.size() == i + 1);
+    }
+
+    /* full: the oldest unread frame must survive */
+    EXPECT(!queue.push(frameOf(100)));
+    EXPECT(queue.size() == SecFrameQueue::CAPACITY);
+
+    EXPECT(queue.pop(&frame));
+    EXPECT(sameFrame(frame, 0));
+    EXPECT(queue.push(frameOf(SecFrameQueue::CAPACITY)));
+    EXPECT(!queue.push(frameOf(101)));
+
+    for (int i = 1; i <= SecFrameQueue::CAPACITY; i++) {
+        EXPECT(queue.pop(&frame));
+        EXPECT(sameFrame(frame, i));
+    }
+    EXPECT(queue.empty());
+    EXPECT(!queue.pop(&frame));
+    return true;
+}
+
+static bool testWrap(void)
+{
+    SecFrameQueue queue;
+    SecPreviewFrame frame;
+    int pushed = 0, popped = 0;
+
+    /* uneven fill levels so every slot is the head and the tail in turn */
+    for (int lap = 0; lap < 1000; lap++) {
+        int n = 1 + lap % SecFrameQueue::CAPACITY;
+        for (int i = 0; i < n; i++)
+            EXPECT(queue.push(frameOf(pushed++)));
+        for (int i = 0; i < n - (lap & 1); i++) {
+            EXPECT(queue.pop(&frame));
+            EXPECT(sameFrame(frame, popped++));
+        }
+        EXPECT(queue.size() == pushed - popped);
+        while (queue.size() > 0) {
+            EXPECT(queue.pop(&frame));
+            EXPECT(sameFrame(frame, popped++));
+        }
+    }
+
+    EXPECT(popped == pushed);
+    return true;
+}
+
+struct Stress {
+    SecFrameQueue queue;
+    int frames;
+    int full;
+    int misordered;
+};
+
+static void *producer(void *arg)
+{
+    Stress *stress = (Stress *)arg;
+
+    for (int i = 0; i < stress->frames; i++) {
+        while (!stress->queue.push(frameOf(i))) {
+            stress->full++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static bool testThreads(int frames)
+{
+    Stress stress;
+    pthread_t thread;
+    SecPreviewFrame frame;
+    int next = 0;
+
+    stress.frames = frames;
+    stress.full = 0;
+    stress.misordered = 0;
+
+    EXPECT(pthread_create(&thread, NULL, producer, &stress) == 0);
+    while (next < frames) {
+        if (!stress.queue.pop(&frame)) {
+            sched_yield();
+            continue;
+        }
+        if (!sameFrame(frame, next))
+            stress.misordered++;
+        next++;
+    }
+    pthread_join(thread, NULL);
+
+    printf("%d frames across threads, producer found the ring full %d times\n",
+           frames, stress.full);
+    EXPECT(stress.misordered == 0);
+    EXPECT(stress.queue.empty());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    if (testEmpty() && testOverflow() && testWrap())
+        testThreads(frames);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}